@@ -39,12 +39,19 @@ void appdata_init(struct appdata_struct *p)
   p->export_file_final = NULL;
   p->export_file_signal = NULL;
   p->interface = NULL;
+  p->packet_mmap = FALSE;
+  p->bucket_stats = FALSE;
+  p->accumulate_stats = FALSE;
+  p->scalar_headers = FALSE;
+  p->generic_decode = FALSE;
 
   p->mode = IP;
   p->node_limit = -1;
   p->debug_mask = (G_LOG_LEVEL_MASK & ~(G_LOG_LEVEL_DEBUG | G_LOG_LEVEL_INFO));
   p->min_delay = 0;
   p->max_delay = G_MAXULONG;
+  p->replay_speed = 1.0;
+  p->force_layout = FALSE;
 
   p->n_packets = 0;
   p->total_mem_packets = 0;
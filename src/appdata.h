@@ -47,11 +47,25 @@ struct appdata_struct
   gint node_limit;		/* Max number of nodes to show. If <0 it's not
 				 * limited */
   gchar *interface;		/* Network interface to listen to */
+  gboolean packet_mmap;         /* if true, tries to capture through a
+                                 * memory mapped AF_PACKET ring (linux only) */
+  gboolean bucket_stats;        /* if true, traffic stats are kept in fixed
+                                 * time slots instead of packet lists */
+  gboolean scalar_headers;      /* if true, the burst header pre-pass 
+                                 * never uses SIMD instructions */
+  gboolean generic_decode;      /* if true, packets are always decoded by
+                                 * the generic decoders, without fast 
+                                 * paths or caches */
+  gboolean accumulate_stats;    /* if true, packets are summed per flow and
+                                 * added to the stats at each refresh.
+                                 * Implies bucket_stats */
 
   GLogLevelFlags debug_mask;    /* debug mask active */
 
   gulong min_delay;    /* min packet distance when replaying a file */
   gulong max_delay;    /* max packet distance when replaying a file */
+  gdouble replay_speed; /* speed multiplier when replaying a file */
+  gboolean force_layout; /* if true, nodes are placed by the layout thread */
 
 
   unsigned long n_packets;	/* Number of total packets received */
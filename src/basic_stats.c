@@ -22,13 +22,22 @@
 #endif
 
 #include <math.h>
+#include <string.h>
 #include "appdata.h"
 #include "basic_stats.h"
+#include "mem_pool.h"
+#include "preferences.h"
 #include "ui_utils.h"
 #include "util.h"
 
 static long packet_list_item_n = 0;
 
+/* packets and list items come from pools, allocated a chunk at a time */
+#define PACKET_POOL_CHUNK 1024
+static mem_pool_t packet_info_pool;
+static mem_pool_t packet_item_pool;
+static gboolean packet_pools_open = FALSE;
+
 /***************************************************************************
  *
  * utility functions
@@ -89,26 +98,26 @@ double substract_times_ms (const struct timeval *a, const struct timeval *b)
  * packet_protos_t implementation
  *
  **************************************************************************/
-/* init/delete of a packet_protos_t */
-packet_protos_t *packet_protos_init(void)
+/* clears all levels of a packet_protos_t */
+void packet_protos_clear(packet_protos_t *pt)
 {
   guint i;
-  packet_protos_t *pt = g_malloc(sizeof(packet_protos_t));
-  g_assert(pt);
-  if (pt)
-    {
-      for (i = 0; i<=STACK_SIZE ; ++i)
-        pt->protonames[i] = NULL;
-    }
-  return pt;
+  for (i = 0; i<=STACK_SIZE ; ++i)
+    pt->protos[i] = PROTO_ATOM_NONE;
 }
 
-void packet_protos_delete(packet_protos_t *pt)
+void packet_protos_ref(const packet_protos_t *pt)
 {
   guint i;
   for (i = 0; i<=STACK_SIZE ; ++i)
-    g_free(pt->protonames[i]);
-  g_free(pt);
+    proto_atom_ref(pt->protos[i]);
+}
+
+void packet_protos_unref(const packet_protos_t *pt)
+{
+  guint i;
+  for (i = 0; i<=STACK_SIZE ; ++i)
+    proto_atom_unref(pt->protos[i]);
 }
 
 /* returns a newly allocated string with a dump of pt */
@@ -117,15 +126,14 @@ gchar *packet_protos_dump(const packet_protos_t *pt)
   gint i;
   GString *msg;
 
-  msg=g_string_new("");
-  if (pt->protonames[0])
-    msg = g_string_new(pt->protonames[0]);
+  if (pt->protos[0])
+    msg = g_string_new(proto_atom_name(pt->protos[0]));
   else
     msg = g_string_new("UNKNOWN");
   for (i = 1; i<=STACK_SIZE ; ++i)
     {
-      if (pt->protonames[i])
-        g_string_append_printf(msg, "/%s", pt->protonames[i]);
+      if (pt->protos[i])
+        g_string_append_printf(msg, "/%s", proto_atom_name(pt->protos[i]));
       else
         g_string_append(msg, "/UNKNOWN");
     }
@@ -134,6 +142,64 @@ gchar *packet_protos_dump(const packet_protos_t *pt)
   return g_string_free(msg, FALSE);
 }
 
+/***************************************************************************
+ *
+ * packet_info_t implementation
+ *
+ **************************************************************************/
+static void packet_pools_init(void)
+{
+  mem_pool_init(&packet_info_pool, "packet_info", sizeof(packet_info_t), 
+                PACKET_POOL_CHUNK);
+  mem_pool_init(&packet_item_pool, "packet_list_item", 
+                sizeof(packet_list_item_t), PACKET_POOL_CHUNK);
+  packet_pools_open = TRUE;
+}
+
+packet_info_t *packet_info_create(void)
+{
+  packet_info_t *pkt;
+
+  if (!packet_pools_open)
+    packet_pools_init();
+  pkt = mem_pool_alloc(&packet_info_pool);
+  pkt->n_packets = 1;
+  return pkt;
+}
+
+void packet_info_delete(packet_info_t *pkt)
+{
+  packet_protos_unref(&pkt->prot_desc);
+  mem_pool_free(&packet_info_pool, pkt);
+}
+
+/* releases unused pool memory, to be called periodically */
+void packet_pools_trim(void)
+{
+  if (!packet_pools_open)
+    return;
+  mem_pool_trim(&packet_info_pool);
+  mem_pool_trim(&packet_item_pool);
+}
+
+/* returns a newly allocated string with the pool counters */
+gchar *packet_pools_dump(void)
+{
+  gchar *msg_info;
+  gchar *msg_item;
+  gchar *msg;
+
+  if (!packet_pools_open)
+    return g_strdup("packet pools unused");
+
+  msg_info = mem_pool_dump(&packet_info_pool);
+  msg_item = mem_pool_dump(&packet_item_pool);
+  msg = g_strdup_printf("%s; %s", msg_info, msg_item);
+  g_free(msg_info);
+  g_free(msg_item);
+  return msg;
+}
+
 /***************************************************************************
  *
  * packet_list_item_t implementation
@@ -151,8 +217,7 @@ packet_list_item_create(packet_info_t *i, packet_direction d)
 
   g_assert(i);
 
-  newit = g_malloc( sizeof(packet_list_item_t) );
-  g_assert(newit);
+  newit = mem_pool_alloc(&packet_item_pool);
 
   /* increments refcount of packet */
   i->ref_count++;
@@ -176,8 +241,7 @@ void packet_list_item_delete(packet_list_item_t *pli)
           if (pli->info->ref_count < 1)
             {
               /* packet now unused, delete it */
-              packet_protos_delete(pli->info->prot_desc);
-              g_free (pli->info);
+              packet_info_delete(pli->info);
               pli->info = NULL;
 
               /* global packet stats */
@@ -185,7 +249,7 @@ void packet_list_item_delete(packet_list_item_t *pli)
             }
         }
     
-      g_free(pli);
+      mem_pool_free(&packet_item_pool, pli);
       --packet_list_item_n;
     }
 }
@@ -195,6 +259,77 @@ void packet_list_item_delete(packet_list_item_t *pli)
  * basic_stats_t implementation
  *
  **************************************************************************/
+/* slot width in ms needed to cover avg_msecs */
+static gulong window_width(gdouble avg_msecs)
+{
+  gulong width = (gulong)(avg_msecs + STATS_WINDOW_SLOTS - 1) / STATS_WINDOW_SLOTS;
+  return width ? width : 1;
+}
+
+/* absolute number of the slot containing now */
+static gint64 window_slot(const stats_window_t *w, const struct timeval *now)
+{
+  return ((gint64)now->tv_sec * 1000 + now->tv_usec / 1000) / w->width;
+}
+
+static void window_clear(stats_window_t *w, gulong width)
+{
+  memset(w->bytes, 0, sizeof(w->bytes));
+  memset(w->packets, 0, sizeof(w->packets));
+  w->n_packets = 0;
+  w->width = width;
+  w->head = window_slot(w, &appdata.now);
+}
+
+/* moves the window forward to slot, dropping the traffic of the slots 
+ * falling out. The window is freed when it becomes empty */
+static void window_advance(basic_stats_t *tf_stat, gint64 slot)
+{
+  stats_window_t *w = tf_stat->window;
+  gint64 n;
+  gint64 i;
+  guint idx;
+
+  if (slot <= w->head)
+    return;
+
+  n = slot - w->head;
+  if (n > STATS_WINDOW_SLOTS)
+    n = STATS_WINDOW_SLOTS;
+  for (i = 1; i <= n; ++i)
+    {
+      idx = (w->head + i) % STATS_WINDOW_SLOTS;
+      tf_stat->aver_accu -= w->bytes[idx];
+      w->n_packets -= w->packets[idx];
+      w->bytes[idx] = 0;
+      w->packets[idx] = 0;
+    }
+  w->head = slot;
+
+  if (!w->n_packets)
+    {
+      /* window empty, clear also rounding errors */
+      tf_stat->aver_accu = 0;
+      tf_stat->average = 0;
+      g_free(w);
+      tf_stat->window = NULL;
+    }
+}
+
+void basic_stats_open(basic_stats_t *tf_stat)
+{
+  g_assert(tf_stat);
+  tf_stat->window = NULL;
+  basic_stats_reset(tf_stat);
+}
+
+void basic_stats_close(basic_stats_t *tf_stat)
+{
+  g_assert(tf_stat);
+  g_free(tf_stat->window);
+  tf_stat->window = NULL;
+}
+
 /* resets counters */
 void basic_stats_reset(basic_stats_t *tf_stat)
 {
@@ -205,14 +340,41 @@ void basic_stats_reset(basic_stats_t *tf_stat)
   tf_stat->avg_size = 0;
   tf_stat->accu_packets = 0;
   tf_stat->last_time = appdata.now;
+  basic_stats_close(tf_stat);
 }
 
 void basic_stats_add(basic_stats_t *tf_stat, gdouble val)
+{
+  basic_stats_add_packets(tf_stat, val, 1);
+}
+
+void basic_stats_add_packets(basic_stats_t *tf_stat, gdouble val, gulong n)
 {
   g_assert(tf_stat);
+
+  if (appdata.bucket_stats)
+    {
+      /* the packets go in the newest slot */
+      stats_window_t *w = tf_stat->window;
+      guint idx;
+
+      if (w)
+        window_advance(tf_stat, window_slot(w, &appdata.now));
+      if (!tf_stat->window)
+        {
+          /* first traffic since the window emptied */
+          w = tf_stat->window = g_malloc(sizeof(stats_window_t));
+          window_clear(w, window_width(pref.averaging_time));
+        }
+      idx = w->head % STATS_WINDOW_SLOTS;
+      w->bytes[idx] += val;
+      w->packets[idx] += n;
+      w->n_packets += n;
+    }
+
   tf_stat->accumulated += val;
   tf_stat->aver_accu += val;
-  ++tf_stat->accu_packets;
+  tf_stat->accu_packets += n;
   tf_stat->avg_size = tf_stat->accumulated / tf_stat->accu_packets;
   tf_stat->last_time = appdata.now;
   /* averages are calculated by basic_stats_avg */
@@ -237,6 +399,36 @@ basic_stats_avg(basic_stats_t *tf_stat, gdouble avg_msecs)
     tf_stat->average = 8000 * tf_stat->aver_accu / avg_msecs;
 }
 
+/* removes from the window the slots older than avg_msecs */
+void basic_stats_expire(basic_stats_t *tf_stat, gdouble avg_msecs)
+{
+  gulong width;
+
+  g_assert(tf_stat);
+  if (!tf_stat->window)
+    return;
+
+  width = window_width(avg_msecs);
+  if (width != tf_stat->window->width)
+    {
+      /* averaging time changed, the averages restart */
+      basic_stats_close(tf_stat);
+      tf_stat->aver_accu = 0;
+      tf_stat->average = 0;
+      return;
+    }
+
+  /* window covers the slots from head - SLOTS + 1 to head */
+  window_advance(tf_stat, window_slot(tf_stat->window, &appdata.now));
+}
+
+/* packets in the averaging window - only for bucketed stats */
+gulong basic_stats_active_packets(const basic_stats_t *tf_stat)
+{
+  g_assert(tf_stat);
+  return tf_stat->window ? tf_stat->window->n_packets : 0;
+}
+
 /* returns a newly allocated string with a dump of the stats */
 gchar *basic_stats_dump(const basic_stats_t *tf_stat)
 {
@@ -30,6 +30,23 @@ struct timeval substract_times (struct timeval a, struct timeval b);
 /* returns the time difference a-b expressed in ms */
 double substract_times_ms (const struct timeval *a, const struct timeval *b);
 
+/* number of time slots of a stats window */
+#define STATS_WINDOW_SLOTS 32
+
+/* traffic of the last averaging period, split in fixed time slots.
+ * Used instead of packet lists when appdata.bucket_stats is set: memory is
+ * constant and expired traffic is removed a whole slot at a time.
+ * The window exists only while it holds traffic, so idle stats cost 
+ * nothing */
+typedef struct
+{
+  gdouble bytes[STATS_WINDOW_SLOTS];   /* traffic of each slot */
+  guint32 packets[STATS_WINDOW_SLOTS]; /* packets of each slot */
+  gulong n_packets;                    /* packets in the whole window */
+  gint64 head;                         /* absolute number of newest slot */
+  gulong width;                        /* slot width in ms */
+} stats_window_t;
+
 typedef struct
 {
   gdouble average;		/* Average bytes in or out in the last x ms */
@@ -38,12 +55,22 @@ typedef struct
   gdouble avg_size;              /* average packet size */
   unsigned long accu_packets;   /* Accumulated number of packets */
   struct timeval last_time;	/* Timestamp of the last packet added */
+  stats_window_t *window;       /* time slots, NULL if not bucketed or 
+                                 * idle */
 } basic_stats_t;
 
+void basic_stats_open(basic_stats_t *tf_stat); /* initializes counters */
+void basic_stats_close(basic_stats_t *tf_stat); /* releases the window */
 void basic_stats_reset(basic_stats_t *tf_stat); /* resets counters */
 void basic_stats_add(basic_stats_t *tf_stat, gdouble val); 
+/* adds n packets totalling val bytes */
+void basic_stats_add_packets(basic_stats_t *tf_stat, gdouble val, gulong n);
 void basic_stats_sub(basic_stats_t *tf_stat, gdouble val); 
 void basic_stats_avg(basic_stats_t *tf_stat, gdouble avg_msecs);
+/* removes from the window the slots older than avg_msecs */
+void basic_stats_expire(basic_stats_t *tf_stat, gdouble avg_msecs);
+/* packets in the averaging window - only for bucketed stats */
+gulong basic_stats_active_packets(const basic_stats_t *tf_stat);
 gchar *basic_stats_dump(const basic_stats_t *tf_stat);
 gchar *basic_stats_xml(const basic_stats_t *tf_stat);
 
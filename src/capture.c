@@ -24,7 +24,12 @@
 
 #include <gnome.h>
 #include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <pcap.h>
 
 #include "appdata.h"
@@ -32,14 +37,27 @@
 #include "names.h"
 #include "links.h"
 #include "conversations.h"
+#include "flow_cache.h"
 #include "dns.h"
 #include "decode_proto.h"
 #include "protocols.h"
 #include "preferences.h"
 #include "export.h"
+#include "capture_ring.h"
+#include "capture_mmap.h"
+#include "replay.h"
 
 #define MAXSIZE 200
 
+/* packets are handed from the capture (or replay) thread to the main loop 
+ * through a ring of LIVE_RING_SLOTS (REPLAY_RING_SLOTS) packets, drained 
+ * every DRAIN_PERIOD ms. Replayed packets are kept up to REPLAY_MAXSIZE 
+ * bytes, as they were before reading was moved to a thread */
+#define LIVE_RING_SLOTS 16384
+#define REPLAY_RING_SLOTS 4096
+#define REPLAY_MAXSIZE 2048
+#define DRAIN_PERIOD 10
+
 #ifdef DISABLE_GDKINPUTADD
 #define PCAP_TIMEOUT 10
 #else
@@ -48,20 +66,33 @@
 
 static pcap_t *pch_struct;		/* pcap structure */
 static gint pcap_fd;			/* The file descriptor used by libpcap */
-static gint capture_source;		/* It's the input tag or the timeout tag,
-				 * in online or offline mode */
-static gulong ms_to_next;	/* Used for offline mode to store the amount
-				 * of time that we have to wait between
-				 * one packet and the next */
+static gint capture_source = 0;	/* Tag of the timeout decoding queued packets,
+				 * 0 if not active */
 static enum status_t capture_status = STOP;
 
+/* capture thread data */
+static capture_ring_t *pkt_ring = NULL; /* packets read, not yet decoded */
+static pthread_t capture_thread;
+static gboolean capture_thread_running = FALSE;
+static volatile gint capture_thread_stop = 0; /* stop request */
+static volatile gint capture_thread_error = 0; /* thread ended on pcap error */
+static gint wakeup_pipe[2] = { -1, -1 }; /* written to wake the thread */
+static gboolean use_mmap = FALSE;      /* live packets are read from the
+                                         * AF_PACKET ring, not from pcap */
+static pthread_mutex_t pcap_mtx = PTHREAD_MUTEX_INITIALIZER; /* guards pch_struct
+                                           while the thread is running. 
+                                           Live reads are non blocking, so
+                                           it's never held while waiting */
+
 /* Local funtions declarations */
-static guint get_offline_packet (void);
-static void cap_t_o_destroy(gpointer data);
-static guint get_live_packet (void);
-static void live_timeout(gpointer data);
-static void gdk_input_callback(gpointer dummy, gint source,
-			 GdkInputCondition condition);
+static void *capture_thread_routine(void *dt);
+static gboolean start_capture_thread(void);
+static void stop_capture_thread(void);
+static gboolean get_queued_packets (gpointer data);
+static void queued_timeout(gpointer data);
+static gboolean batch_time_exceeded(const struct timeval *start);
+static void batch_update (void);
+static gboolean open_live_mmap(const gchar *device);
 
 
 /* 
@@ -122,7 +153,13 @@ gchar *init_capture (void)
     }
 
 
-  if (!appdata.input_file)
+  use_mmap = FALSE;
+  if (!appdata.input_file && appdata.packet_mmap && open_live_mmap(device))
+    {
+      use_mmap = TRUE;
+      g_my_info (_("Live device %s opened for memory mapped capture"), device);
+    }
+  else if (!appdata.input_file)
     {
       *ebuf = '\0'; /* reset error buffer before calling pcap functions */
       if (!
@@ -226,12 +263,24 @@ set_filter (gchar * filter_string, gchar * device)
                  ebuf);
       netmask = 0;
     }
+  /* the capture thread could be reading from pch_struct. It waits for 
+   * packets without the lock, so we get it at most after a single read */
+  pthread_mutex_lock(&pcap_mtx);
   if (pcap_compile (pch_struct, &fp, filter_string, 1, netmask) < 0)
     g_warning (_("Unable to parse filter string (%s). Filter ignored."), 
                pcap_geterr (pch_struct));
+  else if (use_mmap)
+    {
+      /* pch_struct is only a dead handle, used to compile the filter */
+      if (!mmap_capture_setfilter (&fp))
+        g_warning (_("Can't install filter (%s). Filter ignored."), 
+                   strerror (errno));
+      pcap_freecode (&fp);
+    }
   else if (pcap_setfilter (pch_struct, &fp) < 0)
     g_warning (_("Can't install filter (%s). Filter ignored."), 
                pcap_geterr (pch_struct));
+  pthread_mutex_unlock(&pcap_mtx);
 
   return 0;
 }				/* set_filter */
@@ -281,30 +330,40 @@ start_capture (void)
   if (appdata.interface && (capture_status == STOP))
     {
       g_my_debug (_("Starting live capture"));
-#ifdef DISABLE_GDKINPUTADD
-      /* disabled fd - always use timers */
+      /* pcap is read by a dedicated thread, so that a slow redraw can't 
+       * make the kernel drop packets. The main loop only decodes what
+       * the thread queued */
+      if (!use_mmap && !start_capture_thread())
+        return FALSE;
       capture_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
-					   1,
-					   (GtkFunction) get_live_packet,
+					   DRAIN_PERIOD,
+					   (GSourceFunc) get_queued_packets,
 					   NULL,
-					   (GDestroyNotify) live_timeout);
-      g_my_info(_("Using timers for live capture"));
-#else
-      /* default: use the fd obtained from pcap to optimize readings */
-      capture_source = gdk_input_add (pcap_fd,
-				      GDK_INPUT_READ,
-				      (GdkInputFunction)gdk_input_callback, 
-                                      NULL);
-#endif
+					   (GDestroyNotify) queued_timeout);
     }
   else if (!appdata.interface)
     {
-      g_my_debug (_("Starting offline capture"));
-      capture_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
-					   1,
-					   (GtkFunction) get_offline_packet,
-					   NULL,
-					   (GDestroyNotify) cap_t_o_destroy);
+      if (capture_status == STOP)
+        {
+          g_my_debug (_("Starting offline capture"));
+          /* a dedicated thread reads the file, releasing each packet when 
+           * due at the chosen replay speed */
+          pkt_ring = capture_ring_new(REPLAY_RING_SLOTS, REPLAY_MAXSIZE);
+          if (!replay_start(pch_struct, &pcap_mtx, pkt_ring, 
+                            appdata.replay_speed, appdata.min_delay, 
+                            appdata.max_delay))
+            {
+              g_warning (_("Can't create the replay thread"));
+              return FALSE;
+            }
+          capture_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
+                                               DRAIN_PERIOD,
+                                               (GSourceFunc) get_queued_packets,
+                                               NULL,
+                                               (GDestroyNotify) queued_timeout);
+        }
+      else
+        replay_resume();
     }
 
   /* set the antialiasing */
@@ -325,11 +384,7 @@ pause_capture (void)
   if (!appdata.interface)
     {
       g_my_debug (_("Pausing offline capture"));
-      if (!g_source_remove (capture_source))
-        {
-          g_warning (_("Error while trying to pause capture"));
-          return FALSE;
-        }
+      replay_pause();
     }
 
   capture_status = PAUSE;
@@ -345,40 +400,196 @@ stop_capture (void)
   if (capture_status == STOP)
       return TRUE;
 
+  /* status must be changed before removing the timer, or the destroy 
+   * handler would rearm it */
+  capture_status = STOP;
+
   if (appdata.interface)
     {
       g_my_debug (_("Stopping live capture"));
-      gdk_input_remove (capture_source);	/* gdk_input_remove does not
-						 * return an error code */
+      stop_capture_thread();
     }
   else
+    {
       g_my_debug (_("Stopping offline capture"));
+      replay_stop();
+    }
+  if (capture_source)
+    g_source_remove (capture_source);
 
-  capture_status = STOP;
-
-  /* free nodes, protocols, links, conversations and packets */
+  /* free nodes, protocols, links, conversations and packets.
+   * Links reference nodes, so are freed first */
+  clear_accumulated_packets();
   protocol_summary_close();
-  nodes_catalog_close();
   links_catalog_close();
+  nodes_catalog_close();
   delete_conversations ();
+  flow_cache_clear ();
 
   /* Free the list of new_nodes */
   new_nodes_clear();
 
-  /* Clean the buffer */
-  if (!appdata.interface)
-    get_offline_packet ();
-
   /* Close the capture */
-  pcap_stats (pch_struct, &ps);
-  g_my_info("libpcap received %d packets, dropped %d. EtherApe saw %lu",
-	      ps.ps_recv, ps.ps_drop, appdata.n_packets);
+  if (use_mmap)
+    {
+      if (mmap_capture_stats (&ps.ps_recv, &ps.ps_drop))
+        g_my_info("kernel received %u packets, dropped %u. EtherApe saw %lu",
+                  ps.ps_recv, ps.ps_drop, appdata.n_packets);
+      mmap_capture_close();
+    }
+  else
+    {
+      pcap_stats (pch_struct, &ps);
+      g_my_info("libpcap received %d packets, dropped %d. EtherApe saw %lu",
+                  ps.ps_recv, ps.ps_drop, appdata.n_packets);
+    }
+  if (pkt_ring)
+    {
+      if (appdata.interface)
+        g_my_info("capture ring full, dropped %lu packets", pkt_ring->dropped);
+      capture_ring_delete(pkt_ring);
+      pkt_ring = NULL;
+    }
   pcap_close (pch_struct);
   g_my_info(_("Capture device stopped or file closed"));
 
   return TRUE;
 }				/* stop_capture */
 
+/* packets read by batch_capture, decoded together in a burst */
+typedef struct
+{
+  GByteArray *data;                     /* contents of the packets */
+  guint n;
+  guint offset[HDR_BATCH_MAX];          /* of each packet in data */
+  guint caplen[HDR_BATCH_MAX];
+  guint len[HDR_BATCH_MAX];
+  struct timeval ts[HDR_BATCH_MAX];
+} batch_burst_t;
+
+static void batch_burst_add(batch_burst_t *burst, const u_char *pkt_data,
+                            guint caplen, guint len, 
+                            const struct timeval *ts)
+{
+  burst->offset[burst->n] = burst->data->len;
+  burst->caplen[burst->n] = caplen;
+  burst->len[burst->n] = len;
+  burst->ts[burst->n] = *ts;
+  g_byte_array_append(burst->data, pkt_data, caplen);
+  burst->n++;
+}
+
+/* decodes the packets of the burst, emptying it */
+static void batch_burst_flush(batch_burst_t *burst)
+{
+  guint8 *raw[HDR_BATCH_MAX];
+  guint i;
+
+  if (!burst->n)
+    return;
+  for (i = 0; i < burst->n; ++i)
+    raw[i] = burst->data->data + burst->offset[i];
+  packet_burst_acquired(burst->n, raw, burst->caplen, burst->len, burst->ts);
+  burst->n = 0;
+  g_byte_array_set_size(burst->data, 0);
+}
+
+/* Headless analysis of a capture file, used by --batch. 
+ * The whole file is read as fast as possible, without any GUI. Packet 
+ * timestamps are used as the current time, so that averages and expiration
+ * work as if the file had been replayed at its original speed. 
+ * The catalogs are updated each refresh_period of capture time, and at EOF
+ * the final export, if requested, is written.
+ * init_capture must have been already called. Returns FALSE on read error */
+gboolean
+batch_capture (void)
+{
+  struct pcap_pkthdr *pkt_header;
+  const u_char *pkt_data;
+  struct timeval pkt_time;
+  struct timeval last_update = { 0, 0 };
+  batch_burst_t burst;
+  int result;
+
+  if (!appdata.input_file || capture_status != STOP)
+    return FALSE;
+
+  g_my_info (_("Starting batch analysis of %s"), appdata.input_file);
+  protocol_summary_open();
+  nodes_catalog_open();
+  links_catalog_open();
+  capture_status = PLAY;
+
+  burst.data = g_byte_array_new();
+  burst.n = 0;
+  while ((result = pcap_next_ex(pch_struct, &pkt_header, &pkt_data)) >= 0)
+    {
+      if (result == 0 || !pkt_data)
+        continue;
+
+      /* Redhat's pkt_header.ts is not a timeval, so I can't just copy 
+       * the structures */
+      pkt_time.tv_sec = pkt_header->ts.tv_sec;
+      pkt_time.tv_usec = pkt_header->ts.tv_usec;
+      if (last_update.tv_sec == 0 && last_update.tv_usec == 0)
+        last_update = pkt_time;
+
+      /* pcap reuses its buffer, so the packet is copied */
+      batch_burst_add(&burst, pkt_data, pkt_header->caplen, pkt_header->len,
+                      &pkt_time);
+      if (burst.n == HDR_BATCH_MAX)
+        batch_burst_flush(&burst);
+
+      if (substract_times_ms(&pkt_time, &last_update) >= pref.refresh_period)
+        {
+          batch_burst_flush(&burst);
+          batch_update();
+          last_update = pkt_time;
+        }
+
+      if (appdata.request_dump && appdata.export_file_signal)
+        {
+          batch_burst_flush(&burst);
+          g_my_info (_("Received USR1 signal, dumping state to %s"), 
+                     appdata.export_file_signal);
+          dump_xml(appdata.export_file_signal);
+          appdata.request_dump = FALSE; 
+        }
+    }
+  batch_burst_flush(&burst);
+  g_byte_array_free(burst.data, TRUE);
+
+  if (result == -1)
+    g_warning (_("Error while reading %s: %s"), appdata.input_file,
+               pcap_geterr (pch_struct));
+
+  /* one last update at the time of the last packet, then export */
+  batch_update();
+  capture_status = CAP_EOF;
+  if (appdata.export_file_final)
+    dump_xml(appdata.export_file_final);
+
+  g_my_info (_("Batch analysis completed, %lu packets read"), appdata.n_packets);
+  stop_capture();
+  return result != -1;
+}
+
+/* in batch mode there is no diagram to take new nodes and update the 
+ * catalogs, so we do it here */
+static void
+batch_update (void)
+{
+  flush_accumulated_packets();
+  nodes_catalog_update_all();
+  links_catalog_update_all();
+  protocol_summary_update_all();
+  new_nodes_clear();
+  dirty_nodes_clear();
+  dirty_links_clear();
+  expire_conversations();
+  packet_pools_trim();
+}
+
 /*
  * Makes sure we don't leave any open device behind, or else we
  * might leave it in promiscous mode
@@ -391,133 +602,277 @@ cleanup_capture (void)
 }
 
 
-/* This is a timeout function used when reading from capture files 
- * It forces a waiting time so that it reproduces the rate
- * at which packets were coming */
-static guint
-get_offline_packet (void)
+/* Returns the current time. While replaying a file it's the replay clock,
+ * that is the time as seen by the packets being replayed */
+void get_capture_time(struct timeval *now)
+{
+  if (appdata.interface || !replay_get_time(now))
+    gettimeofday (now, NULL);
+}
+
+/* skips the wait before the next replayed packet */
+void force_next_packet(void)
+{
+  if (!appdata.interface)
+    replay_skip();
+}
+
+/* pcap_dispatch callback, run by the capture thread */
+static void
+ring_packet_handler(u_char *user, const struct pcap_pkthdr *pkt_header, 
+                    const u_char *pkt_data)
 {
-  static struct pcap_pkthdr *pkt_header = NULL;
-  static const u_char *pkt_data = NULL;
-  static struct timeval last_read_time = { 0, 0 }, this_time;
-  double diffms;
+  struct timeval ts;
+
+  if (!pkt_data)
+    return;
+
+  /* Redhat's pkt_header.ts is not a timeval, so I can't just copy 
+   * the structures */
+  ts.tv_sec = pkt_header->ts.tv_sec;
+  ts.tv_usec = pkt_header->ts.tv_usec;
+  capture_ring_push(pkt_ring, &ts, pkt_data, pkt_header->caplen,
+                    pkt_header->len);
+}
+
+/* capture thread: reads packets from pcap as fast as they come, queueing
+ * them for the main loop. It never touches anything except pch_struct and 
+ * pkt_ring.
+ * pch_struct is in non blocking mode: the thread waits in poll, without
+ * holding pcap_mtx, until packets are available or it's woken through 
+ * wakeup_pipe. Where pcap has no selectable fd, it wakes every 
+ * PCAP_TIMEOUT ms to check */
+static void *
+capture_thread_routine(void *dt)
+{
+  struct pollfd fds[2];
+  nfds_t n_fds;
   int result;
 
-  if (capture_status == STOP)
+  fds[0].fd = wakeup_pipe[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = pcap_get_selectable_fd(pch_struct);
+  fds[1].events = POLLIN;
+  n_fds = (fds[1].fd >= 0) ? 2 : 1;
+
+  while (!g_atomic_int_get(&capture_thread_stop))
+    {
+      /* some platforms don't signal the fd until their buffer is full, 
+       * so the wait is limited anyway */
+      if (poll(fds, n_fds, PCAP_TIMEOUT) < 0 && errno != EINTR)
+        {
+          g_atomic_int_set(&capture_thread_error, 1);
+          break;
+        }
+      if (g_atomic_int_get(&capture_thread_stop))
+        break;
+
+      /* reads a whole batch of packets, or what's available in the 
+       * pcap buffer, with a single call */
+      pthread_mutex_lock(&pcap_mtx);
+      result = pcap_dispatch(pch_struct, pref.capture_batch, 
+                             ring_packet_handler, NULL);
+      pthread_mutex_unlock(&pcap_mtx);
+
+      if (result == -2)
+        break; /* pcap_breakloop */
+      if (result < 0)
+        {
+          g_atomic_int_set(&capture_thread_error, 1);
+          break;
+        }
+    }
+  return NULL;
+}
+
+static gboolean
+start_capture_thread(void)
+{
+  gchar ebuf[PCAP_ERRBUF_SIZE];
+
+  if (!pkt_ring)
+    pkt_ring = capture_ring_new(LIVE_RING_SLOTS, MAXSIZE);
+
+  *ebuf = '\0'; /* reset error buffer before calling pcap functions */
+  if (pcap_setnonblock(pch_struct, 1, ebuf) < 0)
+    {
+      g_warning (_("Can't set the capture device in non blocking mode: %s"),
+                 ebuf);
+      return FALSE;
+    }
+  if (pipe(wakeup_pipe) < 0)
+    {
+      g_warning (_("Can't create the capture thread pipe: %s"), 
+                 strerror(errno));
+      return FALSE;
+    }
+
+  g_atomic_int_set(&capture_thread_stop, 0);
+  g_atomic_int_set(&capture_thread_error, 0);
+  if (pthread_create(&capture_thread, NULL, capture_thread_routine, NULL))
     {
-      pkt_header = NULL;
-      pkt_data = NULL;
-      last_read_time.tv_usec = last_read_time.tv_sec = 0;
+      g_warning (_("Can't create the capture thread"));
+      close(wakeup_pipe[0]);
+      close(wakeup_pipe[1]);
+      wakeup_pipe[0] = wakeup_pipe[1] = -1;
       return FALSE;
     }
+  capture_thread_running = TRUE;
+  return TRUE;
+}
+
+/* wakes the thread, wherever it is waiting, and waits for it to end */
+static void
+stop_capture_thread(void)
+{
+  if (!capture_thread_running)
+    return;
+  g_atomic_int_set(&capture_thread_stop, 1);
+  pcap_breakloop(pch_struct);
+  if (write(wakeup_pipe[1], "", 1) < 0)
+    g_warning (_("Can't wake the capture thread: %s"), strerror(errno));
+  pthread_join(capture_thread, NULL);
+  capture_thread_running = FALSE;
+
+  close(wakeup_pipe[0]);
+  close(wakeup_pipe[1]);
+  wakeup_pipe[0] = wakeup_pipe[1] = -1;
+}
+
+/* Timer callback: decodes the packets queued by the capture or replay thread.
+ * At most pref.capture_batch packets are taken each time, so that a fast
+ * producer can't starve the GUI */
+static gboolean 
+get_queued_packets(gpointer data)
+{
+  const ring_pkt_t *burst[HDR_BATCH_MAX];
+  guint8 *raw[HDR_BATCH_MAX];
+  guint caplen[HDR_BATCH_MAX];
+  guint len[HDR_BATCH_MAX];
+  struct timeval ts[HDR_BATCH_MAX];
+  struct timeval start;
+  guint n;
+  guint nb;
+  guint i;
 
-  if (pkt_data)
-  {
-    gettimeofday (&appdata.now, NULL);
-    packet_acquired( (guint8 *)pkt_data, pkt_header->caplen, pkt_header->len);
-  }
+  if (capture_status != PLAY && capture_status != PAUSE )
+    return FALSE; /* stop timer */
 
-  result = pcap_next_ex(pch_struct, &pkt_header, &pkt_data);
-  switch (result)
+  gettimeofday (&start, NULL);
+  if (use_mmap)
     {
-    case 1:
-      if (last_read_time.tv_sec == 0 && last_read_time.tv_usec == 0)
+      /* frames are decoded in place, in bursts */
+      for (n = 0; n < pref.capture_batch; n += nb)
         {
-          last_read_time.tv_sec = pkt_header->ts.tv_sec;
-          last_read_time.tv_usec = pkt_header->ts.tv_usec;
+          nb = mmap_capture_dispatch(MIN(HDR_BATCH_MAX, 
+                                         pref.capture_batch - n), 
+                                     packet_burst_acquired);
+          if (!nb || batch_time_exceeded(&start))
+            break;
         }
+      return FALSE;
+    }
 
-      this_time.tv_sec = pkt_header->ts.tv_sec;
-      this_time.tv_usec = pkt_header->ts.tv_usec;
-
-      diffms = substract_times_ms(&this_time, &last_read_time);
-
-      /* diff can be negative when listening to multiple interfaces.
-       * In that case the delay is zeroed */
-      if (diffms < 0)
-        ms_to_next = 0; 
-      else 
-        ms_to_next = diffms;
-      if (ms_to_next < appdata.min_delay)
-          ms_to_next = appdata.min_delay;
-      else if (ms_to_next > appdata.max_delay)
-          ms_to_next = appdata.max_delay;
+  /* packets are decoded in bursts, released to the ring only after */
+  for (n = 0; n < pref.capture_batch; n += nb)
+    {
+      nb = capture_ring_peek_burst(pkt_ring, burst, 
+                                   MIN(HDR_BATCH_MAX, pref.capture_batch - n));
+      if (!nb)
+        break;
+      for (i = 0; i < nb; ++i)
+        {
+          raw[i] = (guint8 *)burst[i]->data;
+          caplen[i] = burst[i]->caplen;
+          len[i] = burst[i]->len;
+          ts[i] = burst[i]->ts;
+        }
+      packet_burst_acquired(nb, raw, caplen, len, ts);
+      capture_ring_release_burst(pkt_ring, nb);
+      if (!appdata.interface)
+        replay_ring_released();
+
+      /* checking the clock on every packet would cost more than decoding */
+      if (batch_time_exceeded(&start))
+        break;
+    }
 
-      last_read_time = this_time;
-      break;
-    case -2:
+  if (!appdata.interface && !capture_ring_peek(pkt_ring) && replay_eof())
+    {
+      /* all packets of the file were replayed, or reading failed */
+      gchar *msg = replay_error();
+      if (msg)
+        {
+          g_warning (_("Error while reading %s: %s"), appdata.input_file, 
+                     msg);
+          g_free (msg);
+        }
       capture_status = CAP_EOF;
       /* xml dump if needed */
       if (appdata.export_file_final)
         dump_xml(appdata.export_file_final);
-      break;
-    default:
-      ms_to_next=0; /* error or timeout, ignore packet */
     }
-  return FALSE;
-}				/* get_offline_packet */
 
-/* cancels the current timer, forcing another packet */
-void force_next_packet(void)
-{
-  if (ms_to_next > 20)
+  if (g_atomic_int_get(&capture_thread_error) == 1)
     {
-      ms_to_next = 0;
-      g_source_remove(capture_source);
+      g_warning (_("Error while reading from the capture device: %s"),
+                 pcap_geterr (pch_struct));
+      g_atomic_int_set(&capture_thread_error, 2); /* warn only once */
     }
+  return FALSE;
 }
 
-static void
-cap_t_o_destroy (gpointer data)
+static void queued_timeout(gpointer data)
 {
+  guint delay;
 
-  if (capture_status == PLAY)
-    capture_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
-					 ms_to_next,
-					 (GtkFunction) get_offline_packet,
-					 data,
-					 (GDestroyNotify) cap_t_o_destroy);
-
-}				/* cap_t_o_destroy */
+  if (capture_status != PLAY && capture_status != PAUSE)
+    {
+      capture_source = 0;
+      return;
+    }
 
+  /* if the last batch didn't empty the ring, come back as soon as the 
+   * main loop is free */
+  if (use_mmap)
+    delay = mmap_capture_pending() ? 0 : DRAIN_PERIOD;
+  else
+    delay = capture_ring_peek(pkt_ring) ? 0 : DRAIN_PERIOD;
+  capture_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
+                                       delay,
+                                       (GSourceFunc) get_queued_packets,
+                                       data,
+                                       (GDestroyNotify) queued_timeout);
+}
 
-/* This function is the gdk callback called when the capture socket holds data */
-static void
-gdk_input_callback(gpointer dummy, gint source, GdkInputCondition condition)
+/* true if the current batch took more than half a refresh period, meaning 
+ * that we must return to the main loop to keep the GUI responsive */
+static gboolean batch_time_exceeded(const struct timeval *start)
 {
-  get_live_packet();
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+  return substract_times_ms(&now, start) > pref.refresh_period / 2.0;
 }
 
-static guint get_live_packet(void)
+/* opens device with the AF_PACKET backend. A dead pcap handle is still 
+ * kept in pch_struct, to compile filters */
+static gboolean open_live_mmap(const gchar *device)
 {
-  struct pcap_pkthdr *pkt_header = NULL;
-  const u_char *pkt_data = NULL;
-
-  if (capture_status != PLAY && capture_status != PAUSE )
-    return FALSE; /* stop timer */
+  gchar ebuf[PCAP_ERRBUF_SIZE];
 
-  /* Get next packet */
-  if (pcap_next_ex(pch_struct, &pkt_header, &pkt_data) == 1)
+  if (!mmap_capture_open(device, MAXSIZE, DRAIN_PERIOD, 
+                         ebuf, sizeof(ebuf)))
     {
-      /* packet read */
-      
-      /* Redhat's pkt_header.ts is not a timeval, so I can't just copy 
-       * the structures */
-      appdata.now.tv_sec = pkt_header->ts.tv_sec;
-      appdata.now.tv_usec = pkt_header->ts.tv_usec;
-     
-      if (pkt_data)
-        packet_acquired( (guint8 *)pkt_data, pkt_header->caplen, pkt_header->len);
+      g_warning (_("Memory mapped capture on %s failed (%s), using libpcap"),
+                 device, ebuf);
+      return FALSE;
     }
-  return FALSE;
-}
-
-static void live_timeout(gpointer data)
-{
-  if (capture_status == PLAY)
-    capture_source = g_timeout_add_full (G_PRIORITY_DEFAULT,
-                                         1,
-                                         (GtkFunction) get_live_packet,
-                                         data,
-                                         (GDestroyNotify) live_timeout);
+  pch_struct = pcap_open_dead (DLT_EN10MB, MAXSIZE);
+  if (!pch_struct)
+    {
+      mmap_capture_close();
+      return FALSE;
+    }
+  return TRUE;
 }
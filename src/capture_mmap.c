@@ -0,0 +1,355 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include "capture_mmap.h"
+
+#ifdef HAVE_TPACKET_V3
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+/* ring geometry: 64 blocks of 1MB. With a 200 bytes snaplen a block holds 
+ * more than 4000 frames, so the kernel can go on for a long while without 
+ * us */
+#define MMAP_BLOCK_SIZE (1 << 20)
+#define MMAP_BLOCK_NR 64
+#define MMAP_FRAME_SIZE 2048
+
+/* the kernel strips 802.1Q tags, passing them in the frame header. 
+ * We put them back in the frame, as libpcap does, so tagged frames look
+ * the same with both backends. Each frame is preceded by enough room */
+#define VLAN_TAG_LEN 4
+#ifdef TP_STATUS_VLAN_VALID
+#define FRAME_HAS_VLAN(f) \
+  ((f)->hv1.tp_vlan_tci || ((f)->tp_status & TP_STATUS_VLAN_VALID))
+#else
+#define FRAME_HAS_VLAN(f) ((f)->hv1.tp_vlan_tci != 0)
+#endif
+
+#define MMAP_BLOCK(idx) \
+  ((struct tpacket_block_desc *)(ring_map + (gsize)(idx) * MMAP_BLOCK_SIZE))
+
+static gint sock_fd = -1;               /* AF_PACKET socket */
+static guint8 *ring_map = NULL;         /* mmapped block ring */
+static gsize ring_len = 0;
+static guint cur_block = 0;             /* block we are reading */
+static struct tpacket3_hdr *cur_frame = NULL; /* next frame to read in 
+                                                 cur_block, NULL if the block 
+                                                 wasn't yet started */
+static guint frames_left = 0;           /* frames still to read in cur_block */
+static guint stats_received = 0;        /* kernel counters are reset at each */
+static guint stats_dropped = 0;         /* read, so we accumulate them */
+
+static guint8 *frame_data(struct tpacket3_hdr *frame, 
+                          guint *caplen, guint *len);
+
+/* fills ebuf with the failed operation and errno, closing the socket */
+static gboolean mmap_error(const gchar *what, gchar *ebuf, gsize ebuf_size)
+{
+  snprintf(ebuf, ebuf_size, "%s: %s", what, strerror(errno));
+  mmap_capture_close();
+  return FALSE;
+}
+
+gboolean mmap_capture_open(const gchar *device, guint snaplen,
+                           guint block_timeout_ms,
+                           gchar *ebuf, gsize ebuf_size)
+{
+  struct tpacket_req3 req;
+  struct sockaddr_ll ll;
+  struct packet_mreq mr;
+  struct ifreq ifr;
+  struct sock_filter accept_snap = BPF_STMT(BPF_RET | BPF_K, 0);
+  struct sock_fprog prog;
+  int version = TPACKET_V3;
+  int reserve = VLAN_TAG_LEN;
+  unsigned int ifindex;
+
+  mmap_capture_close();
+
+  ifindex = if_nametoindex(device);
+  if (!ifindex)
+    return mmap_error(device, ebuf, ebuf_size);
+
+  /* with protocol 0 the socket receives nothing until bound, so frames of 
+   * other interfaces can't enter the ring while it's set up */
+  sock_fd = socket(AF_PACKET, SOCK_RAW, 0);
+  if (sock_fd < 0)
+    return mmap_error("socket", ebuf, ebuf_size);
+
+  /* frames are passed on as DLT_EN10MB, so only ethernet-like devices 
+   * can be used */
+  memset(&ifr, 0, sizeof(ifr));
+  g_strlcpy(ifr.ifr_name, device, sizeof(ifr.ifr_name));
+  if (ioctl(sock_fd, SIOCGIFHWADDR, &ifr) < 0)
+    return mmap_error("SIOCGIFHWADDR", ebuf, ebuf_size);
+  if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER && 
+      ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK)
+    {
+      snprintf(ebuf, ebuf_size, "%s is not an ethernet device", device);
+      mmap_capture_close();
+      return FALSE;
+    }
+
+  if (setsockopt(sock_fd, SOL_PACKET, PACKET_VERSION, 
+                 &version, sizeof(version)) < 0)
+    return mmap_error("PACKET_VERSION", ebuf, ebuf_size);
+
+  /* until a real filter is installed, accept everything truncating at 
+   * snaplen. Filters compiled by pcap carry their own snaplen */
+  accept_snap.k = snaplen;
+  prog.len = 1;
+  prog.filter = &accept_snap;
+  if (setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, 
+                 &prog, sizeof(prog)) < 0)
+    return mmap_error("SO_ATTACH_FILTER", ebuf, ebuf_size);
+
+  /* room to reinsert vlan tags */
+  if (setsockopt(sock_fd, SOL_PACKET, PACKET_RESERVE, 
+                 &reserve, sizeof(reserve)) < 0)
+    return mmap_error("PACKET_RESERVE", ebuf, ebuf_size);
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = MMAP_BLOCK_SIZE;
+  req.tp_block_nr = MMAP_BLOCK_NR;
+  req.tp_frame_size = MMAP_FRAME_SIZE;
+  req.tp_frame_nr = (MMAP_BLOCK_SIZE / MMAP_FRAME_SIZE) * MMAP_BLOCK_NR;
+  req.tp_retire_blk_tov = block_timeout_ms;
+  if (setsockopt(sock_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+    return mmap_error("PACKET_RX_RING", ebuf, ebuf_size);
+
+  ring_len = (gsize)MMAP_BLOCK_SIZE * MMAP_BLOCK_NR;
+  ring_map = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  sock_fd, 0);
+  if (ring_map == MAP_FAILED)
+    {
+      ring_map = NULL;
+      return mmap_error("mmap", ebuf, ebuf_size);
+    }
+
+  /* only now frames start to arrive, and only from device */
+  memset(&ll, 0, sizeof(ll));
+  ll.sll_family = AF_PACKET;
+  ll.sll_protocol = htons(ETH_P_ALL);
+  ll.sll_ifindex = ifindex;
+  if (bind(sock_fd, (struct sockaddr *)&ll, sizeof(ll)) < 0)
+    return mmap_error("bind", ebuf, ebuf_size);
+
+  memset(&mr, 0, sizeof(mr));
+  mr.mr_ifindex = ifindex;
+  mr.mr_type = PACKET_MR_PROMISC;
+  if (setsockopt(sock_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, 
+                 &mr, sizeof(mr)) < 0)
+    return mmap_error("PACKET_ADD_MEMBERSHIP", ebuf, ebuf_size);
+
+  cur_block = 0;
+  cur_frame = NULL;
+  frames_left = 0;
+  stats_received = 0;
+  stats_dropped = 0;
+  return TRUE;
+}
+
+void mmap_capture_close(void)
+{
+  if (ring_map)
+    {
+      munmap(ring_map, ring_len);
+      ring_map = NULL;
+    }
+  if (sock_fd >= 0)
+    {
+      close(sock_fd); /* closing the socket also drops promiscuous mode */
+      sock_fd = -1;
+    }
+}
+
+gboolean mmap_capture_is_open(void)
+{
+  return sock_fd >= 0;
+}
+
+/* pcap and linux share the classic bpf instruction format, so the 
+ * compiled program can be passed unchanged */
+gboolean mmap_capture_setfilter(struct bpf_program *fp)
+{
+  struct sock_fprog prog;
+
+  if (sock_fd < 0)
+    return FALSE;
+  prog.len = fp->bf_len;
+  prog.filter = (struct sock_filter *)fp->bf_insns;
+  return setsockopt(sock_fd, SOL_SOCKET, SO_ATTACH_FILTER, 
+                    &prog, sizeof(prog)) == 0;
+}
+
+/* returns the frame data, with its vlan tag reinserted if needed */
+static guint8 *frame_data(struct tpacket3_hdr *frame, 
+                          guint *caplen, guint *len)
+{
+  guint8 *data = (guint8 *)frame + frame->tp_mac;
+  guint16 tpid = ETH_P_8021Q;
+
+  *caplen = frame->tp_snaplen;
+  *len = frame->tp_len;
+  if (!FRAME_HAS_VLAN(frame) || *caplen < 2 * ETH_ALEN)
+    return data;
+
+#ifdef TP_STATUS_VLAN_TPID_VALID
+  if (frame->tp_status & TP_STATUS_VLAN_TPID_VALID)
+    tpid = frame->hv1.tp_vlan_tpid;
+#endif
+
+  /* moves the mac addresses back, into the reserved room, and puts the 
+   * tag between them and the ethertype */
+  data -= VLAN_TAG_LEN;
+  memmove(data, data + VLAN_TAG_LEN, 2 * ETH_ALEN);
+  data[2 * ETH_ALEN] = tpid >> 8;
+  data[2 * ETH_ALEN + 1] = tpid & 0xff;
+  data[2 * ETH_ALEN + 2] = frame->hv1.tp_vlan_tci >> 8;
+  data[2 * ETH_ALEN + 3] = frame->hv1.tp_vlan_tci & 0xff;
+  *caplen += VLAN_TAG_LEN;
+  *len += VLAN_TAG_LEN;
+  return data;
+}
+
+guint mmap_capture_dispatch(guint max_pkts, mmap_burst_handler handler)
+{
+  struct tpacket_block_desc *bd;
+  guint8 *frames[MMAP_BURST_MAX];
+  guint caplens[MMAP_BURST_MAX];
+  guint lens[MMAP_BURST_MAX];
+  struct timeval ts[MMAP_BURST_MAX];
+  guint nb;
+  guint n = 0;
+
+  if (!ring_map)
+    return 0;
+
+  max_pkts = MIN(max_pkts, MMAP_BURST_MAX);
+  while (n < max_pkts)
+    {
+      bd = MMAP_BLOCK(cur_block);
+      if (!cur_frame)
+        {
+          if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+            break; /* kernel still filling it */
+          __sync_synchronize(); /* read frames only after the status */
+          cur_frame = (struct tpacket3_hdr *)
+            ((guint8 *)bd + bd->hdr.bh1.offset_to_first_pkt);
+          frames_left = bd->hdr.bh1.num_pkts;
+        }
+
+      /* the frames of a burst are all in this block */
+      for (nb = 0; frames_left && n < max_pkts; --frames_left, ++n, ++nb)
+        {
+          ts[nb].tv_sec = cur_frame->tp_sec;
+          ts[nb].tv_usec = cur_frame->tp_nsec / 1000;
+          frames[nb] = frame_data(cur_frame, caplens + nb, lens + nb);
+          cur_frame = (struct tpacket3_hdr *)
+            ((guint8 *)cur_frame + cur_frame->tp_next_offset);
+        }
+      if (nb)
+        handler(nb, frames, caplens, lens, ts);
+      if (frames_left)
+        break; /* batch full, go on from here next time */
+
+      /* whole block read, give it back to the kernel */
+      __sync_synchronize();
+      bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+      cur_frame = NULL;
+      cur_block = (cur_block + 1) % MMAP_BLOCK_NR;
+    }
+  return n;
+}
+
+/* true if there are frames ready to be read */
+gboolean mmap_capture_pending(void)
+{
+  if (!ring_map)
+    return FALSE;
+  return cur_frame || 
+    (MMAP_BLOCK(cur_block)->hdr.bh1.block_status & TP_STATUS_USER);
+}
+
+gboolean mmap_capture_stats(guint *received, guint *dropped)
+{
+  struct tpacket_stats_v3 st;
+  socklen_t len = sizeof(st);
+
+  if (sock_fd < 0 || 
+      getsockopt(sock_fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0)
+    return FALSE;
+  stats_received += st.tp_packets;
+  stats_dropped += st.tp_drops;
+  *received = stats_received;
+  *dropped = stats_dropped;
+  return TRUE;
+}
+
+#else /* HAVE_TPACKET_V3 */
+
+gboolean mmap_capture_open(const gchar *device, guint snaplen,
+                           guint block_timeout_ms,
+                           gchar *ebuf, gsize ebuf_size)
+{
+  snprintf(ebuf, ebuf_size, "memory mapped capture not available");
+  return FALSE;
+}
+void mmap_capture_close(void)
+{
+}
+gboolean mmap_capture_is_open(void)
+{
+  return FALSE;
+}
+gboolean mmap_capture_setfilter(struct bpf_program *fp)
+{
+  return FALSE;
+}
+guint mmap_capture_dispatch(guint max_pkts, mmap_burst_handler handler)
+{
+  return 0;
+}
+gboolean mmap_capture_pending(void)
+{
+  return FALSE;
+}
+gboolean mmap_capture_stats(guint *received, guint *dropped)
+{
+  return FALSE;
+}
+
+#endif /* HAVE_TPACKET_V3 */
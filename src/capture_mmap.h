@@ -0,0 +1,55 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CAPTURE_MMAP_H
+#define CAPTURE_MMAP_H
+
+#include <sys/time.h>
+#include <pcap.h>
+#include <glib.h>
+
+/* Linux AF_PACKET TPACKET_V3 capture. The kernel fills a memory mapped ring
+ * of blocks, and frames are handed to the caller in place, in bursts of 
+ * consecutive frames of a block */
+
+/* most frames handed in a burst */
+#define MMAP_BURST_MAX 64
+
+typedef void (*mmap_burst_handler)(guint n, guint8 *const *frames,
+                                   const guint *caplens, const guint *lens,
+                                   const struct timeval *ts);
+
+/* opens the device, returning FALSE and filling ebuf on error */
+gboolean mmap_capture_open(const gchar *device, guint snaplen,
+                           guint block_timeout_ms,
+                           gchar *ebuf, gsize ebuf_size);
+void mmap_capture_close(void);
+gboolean mmap_capture_is_open(void);
+
+/* installs a filter compiled with pcap_compile on the socket */
+gboolean mmap_capture_setfilter(struct bpf_program *fp);
+
+/* processes up to max_pkts frames already in the ring, at most 
+ * MMAP_BURST_MAX, returning the number of frames read. The frames are 
+ * valid only inside the handler */
+guint mmap_capture_dispatch(guint max_pkts, mmap_burst_handler handler);
+gboolean mmap_capture_pending(void);
+gboolean mmap_capture_stats(guint *received, guint *dropped);
+
+#endif
@@ -0,0 +1,140 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include "capture_ring.h"
+
+#define RING_SLOT(ring, idx) \
+  ((ring_pkt_t *)((ring)->slots + (gsize)(idx) * (ring)->slot_size))
+
+/***************************************************************************
+ *
+ * capture_ring_t implementation
+ *
+ **************************************************************************/
+
+capture_ring_t *capture_ring_new(guint n_slots, guint maxsize)
+{
+  capture_ring_t *ring;
+  guint n;
+
+  /* rounds up to a power of two, so indexes can be masked */
+  for (n = 2; n < n_slots; n <<= 1)
+    ;
+
+  ring = g_malloc(sizeof(capture_ring_t));
+  ring->maxsize = maxsize;
+  /* keep slots aligned for the timeval at their start */
+  ring->slot_size = (sizeof(ring_pkt_t) + maxsize + 7) & ~7;
+  ring->n_slots = n;
+  ring->slots = g_malloc((gsize)n * ring->slot_size);
+  ring->head = 0;
+  ring->tail = 0;
+  ring->dropped = 0;
+  return ring;
+}
+
+void capture_ring_delete(capture_ring_t *ring)
+{
+  if (!ring)
+    return;
+  g_free(ring->slots);
+  g_free(ring);
+}
+
+/* copies a packet into the ring. Returns FALSE, counting a drop, if the
+ * consumer is too slow and the ring is full */
+gboolean capture_ring_push(capture_ring_t *ring, const struct timeval *ts,
+                           const guint8 *data, guint caplen, guint len)
+{
+  ring_pkt_t *slot;
+  gint head;
+  gint next;
+
+  head = ring->head; /* only we write head */
+  next = (head + 1) & (ring->n_slots - 1);
+  if (next == g_atomic_int_get(&ring->tail))
+    {
+      ring->dropped++;
+      return FALSE;
+    }
+
+  slot = RING_SLOT(ring, head);
+  if (caplen > ring->maxsize)
+    caplen = ring->maxsize;
+  slot->ts = *ts;
+  slot->caplen = caplen;
+  slot->len = len;
+  memcpy(slot->data, data, caplen);
+
+  /* publish the slot only after it is completely filled */
+  g_atomic_int_set(&ring->head, next);
+  return TRUE;
+}
+
+/* true if a push now would fail. Only the producer can rely on this, 
+ * since the consumer could free a slot at any time */
+gboolean capture_ring_is_full(capture_ring_t *ring)
+{
+  gint next = (ring->head + 1) & (ring->n_slots - 1);
+
+  return next == g_atomic_int_get(&ring->tail);
+}
+
+const ring_pkt_t *capture_ring_peek(capture_ring_t *ring)
+{
+  gint tail = ring->tail; /* only we write tail */
+
+  if (tail == g_atomic_int_get(&ring->head))
+    return NULL;
+  return RING_SLOT(ring, tail);
+}
+
+void capture_ring_release(capture_ring_t *ring)
+{
+  gint tail = ring->tail;
+
+  g_atomic_int_set(&ring->tail, (tail + 1) & (ring->n_slots - 1));
+}
+
+guint capture_ring_peek_burst(capture_ring_t *ring, const ring_pkt_t **pkts, 
+                              guint max)
+{
+  gint tail = ring->tail; /* only we write tail */
+  gint head = g_atomic_int_get(&ring->head);
+  guint n;
+
+  for (n = 0; n < max && tail != head; ++n)
+    {
+      pkts[n] = RING_SLOT(ring, tail);
+      tail = (tail + 1) & (ring->n_slots - 1);
+    }
+  return n;
+}
+
+void capture_ring_release_burst(capture_ring_t *ring, guint n)
+{
+  gint tail = ring->tail;
+
+  g_atomic_int_set(&ring->tail, (tail + n) & (ring->n_slots - 1));
+}
@@ -0,0 +1,68 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef CAPTURE_RING_H
+#define CAPTURE_RING_H
+
+#include <sys/time.h>
+#include <glib.h>
+
+/* a captured packet, copied out of the pcap buffers */
+typedef struct
+{
+  struct timeval ts;            /* capture timestamp */
+  guint caplen;                 /* bytes stored in data */
+  guint len;                    /* original packet length */
+  guint8 data[1];               /* caplen bytes, slot is sized at ring creation */
+}
+ring_pkt_t;
+
+/* bounded single-producer/single-consumer packet ring.
+ * The producer (capture thread) only moves head, the consumer (main loop)
+ * only moves tail, so no locking is needed */
+typedef struct
+{
+  guint8 *slots;                /* n_slots * slot_size bytes */
+  guint slot_size;              /* size of a single ring_pkt_t, with data */
+  guint maxsize;                /* max bytes of packet data per slot */
+  guint n_slots;                /* power of two */
+  volatile gint head;           /* next slot to fill - written by producer */
+  volatile gint tail;           /* next slot to read - written by consumer */
+  gulong dropped;               /* packets lost because the ring was full */
+}
+capture_ring_t;
+
+capture_ring_t *capture_ring_new(guint n_slots, guint maxsize);
+void capture_ring_delete(capture_ring_t *ring);
+
+/* producer side */
+gboolean capture_ring_push(capture_ring_t *ring, const struct timeval *ts,
+                           const guint8 *data, guint caplen, guint len);
+gboolean capture_ring_is_full(capture_ring_t *ring);
+
+/* consumer side: peek returns NULL if the ring is empty, release frees
+ * the slot returned by the last peek */
+const ring_pkt_t *capture_ring_peek(capture_ring_t *ring);
+void capture_ring_release(capture_ring_t *ring);
+/* as above, for up to max packets at once. Returns the packets peeked */
+guint capture_ring_peek_burst(capture_ring_t *ring, const ring_pkt_t **pkts, 
+                              guint max);
+void capture_ring_release_burst(capture_ring_t *ring, guint n);
+
+#endif
@@ -27,33 +27,112 @@
 #include "conversations.h"
 #include "dns.h"
 #include "util.h"
+#include "basic_stats.h"
+
+/* conversations unused for this long are forgotten */
+#define CONVERSATION_TIMEOUT 600        /* seconds */
+/* idle conversations are searched at most once in this interval */
+#define CONVERSATION_EXPIRE_INTERVAL 10 /* seconds */
+
+/* all conversations between two addresses, in any direction */
+typedef struct
+{
+  address_t src_address;
+  address_t dst_address;
+  GList *convs;         /* every conversation of the pair */
+  GList *wildcards;     /* the subset with a zero (any) port */
+}
+conv_pair_t;
 
 /* Some protocols add an item here to help identify further packets of the 
- * same protocol */
-static GList *conversations = NULL;
+ * same protocol.
+ * Conversations are indexed by their unordered address pair. Those with both
+ * ports set are also indexed by the full unordered address/port tuple, so
+ * the common case of a packet with no wildcard conversation is just two
+ * hash lookups */
+static GHashTable *pairs = NULL;        /* conv_pair_t, keyed by itself */
+static GHashTable *exact_convs = NULL;  /* conversation_t, keyed by itself */
 static long n_conversations = 0;
+static struct timeval last_expire = {0, 0};
 
 long active_conversations(void)
 {
   return n_conversations;
 }
 
-/* Returns the item ptr if there is any matching conversation in any of the
- * two directions */
-/* A zero in any of the ports matches any port number */
-static GList
-  * find_conversation_ptr(address_t * src_address, address_t * dst_address,
-		       guint16 src_port, guint16 dst_port)
+/***************************************************************************
+ *
+ * hashing
+ *
+ **************************************************************************/
+
+static guint address_hash(const address_t *addr)
 {
-  GList *item = conversations;
-  conversation_t *conv = NULL;
+  guint h = 2166136261U;
+  guint i;
 
-  g_assert(src_address);
-  g_assert(dst_address);
-  while (item)
+  for (i = 0; i < sizeof(address_t); ++i)
     {
-      conv = item->data;
-      if ((is_addr_eq(src_address, &conv->src_address)
+      h ^= addr->all8[i];
+      h *= 16777619U;
+    }
+  return h;
+}
+
+/* both hashes are symmetric, so a pair hashes the same in each direction */
+static guint conv_pair_hash(gconstpointer key)
+{
+  const conv_pair_t *pair = key;
+
+  return address_hash(&pair->src_address) + address_hash(&pair->dst_address);
+}
+
+static gboolean conv_pair_equal(gconstpointer a, gconstpointer b)
+{
+  const conv_pair_t *pa = a;
+  const conv_pair_t *pb = b;
+
+  return (is_addr_eq(&pa->src_address, &pb->src_address) && 
+          is_addr_eq(&pa->dst_address, &pb->dst_address)) ||
+         (is_addr_eq(&pa->src_address, &pb->dst_address) && 
+          is_addr_eq(&pa->dst_address, &pb->src_address));
+}
+
+static guint conv_exact_hash(gconstpointer key)
+{
+  const conversation_t *conv = key;
+
+  return (address_hash(&conv->src_address) ^ conv->src_port * 0x9E3779B1U) +
+         (address_hash(&conv->dst_address) ^ conv->dst_port * 0x9E3779B1U);
+}
+
+static gboolean conv_exact_equal(gconstpointer a, gconstpointer b)
+{
+  const conversation_t *ca = a;
+  const conversation_t *cb = b;
+
+  return (ca->src_port == cb->src_port && ca->dst_port == cb->dst_port &&
+          is_addr_eq(&ca->src_address, &cb->src_address) && 
+          is_addr_eq(&ca->dst_address, &cb->dst_address)) ||
+         (ca->src_port == cb->dst_port && ca->dst_port == cb->src_port &&
+          is_addr_eq(&ca->src_address, &cb->dst_address) && 
+          is_addr_eq(&ca->dst_address, &cb->src_address));
+}
+
+/***************************************************************************
+ *
+ * conversation handling
+ *
+ **************************************************************************/
+
+/* true if conv matches in any of the two directions */
+/* A zero in any of the ports matches any port number */
+static gboolean conv_matches(const conversation_t *conv,
+                             const address_t * src_address, 
+                             const address_t * dst_address,
+                             guint16 src_port, guint16 dst_port)
+{
+  return (is_addr_eq(src_address, &conv->src_address)
 	   && is_addr_eq(dst_address, &conv->dst_address)
 	   && (!src_port || !conv->src_port || (src_port == conv->src_port))
 	   && (!dst_port || !conv->dst_port || (dst_port == conv->dst_port))
@@ -62,24 +141,103 @@ static GList
 	      && is_addr_eq(dst_address, &conv->src_address)
 	      && (!src_port || !conv->dst_port || (src_port == conv->dst_port)) 
               && (!dst_port || !conv->src_port || (dst_port == conv->src_port))
-              )
-          )
-	{
-          /* found */
-	  break;
-	}
-      item = item->next;
+              );
+}
+
+static conv_pair_t *find_pair(const address_t * src_address, 
+                              const address_t * dst_address)
+{
+  conv_pair_t key;
+
+  if (!pairs)
+    return NULL;
+
+  address_copy(&key.src_address, src_address);
+  address_copy(&key.dst_address, dst_address);
+  return g_hash_table_lookup(pairs, &key);
+}
+
+/* Returns the conversation if there is any matching conversation in any 
+ * of the two directions */
+/* A zero in any of the ports matches any port number */
+static conversation_t *
+find_conversation_ptr(const address_t * src_address, 
+                      const address_t * dst_address,
+                      guint16 src_port, guint16 dst_port)
+{
+  conv_pair_t *pair;
+  GList *item;
+
+  g_assert(src_address);
+  g_assert(dst_address);
+
+  if (src_port && dst_port && exact_convs)
+    {
+      conversation_t key;
+      conversation_t *conv;
+
+      address_copy(&key.src_address, src_address);
+      address_copy(&key.dst_address, dst_address);
+      key.src_port = src_port;
+      key.dst_port = dst_port;
+      conv = g_hash_table_lookup(exact_convs, &key);
+      if (conv)
+        return conv;
+    }
+
+  pair = find_pair(src_address, dst_address);
+  if (!pair)
+    return NULL;
+
+  /* with both ports set, only a wildcard conversation can still match */
+  if (src_port && dst_port)
+    item = pair->wildcards;
+  else
+    item = pair->convs;
+  for (; item ; item = item->next)
+    {
+      if (conv_matches(item->data, src_address, dst_address, 
+                       src_port, dst_port))
+        return item->data;
     }
 
-  return item;
+  return NULL;
 }				/* find_conversation_ptr */
 
+static void conversation_delete(conversation_t *conv)
+{
+  g_my_debug ("Removing conversation %s:%d-%s:%d %s",
+              address_to_str (&conv->src_address), conv->src_port,
+              address_to_str (&conv->dst_address), conv->dst_port, conv->data);
+  g_free (conv->data);
+  g_free (conv);
+  n_conversations--;
+}
+
+/* frees a pair with all its conversations */
+static void conv_pair_delete(gpointer data)
+{
+  conv_pair_t *pair = data;
+  GList *item;
+
+  for (item = pair->convs; item ; item = item->next)
+    {
+      conversation_t *conv = item->data;
+      if (conv->src_port && conv->dst_port)
+        g_hash_table_remove(exact_convs, conv);
+      conversation_delete(conv);
+    }
+  g_list_free(pair->convs);
+  g_list_free(pair->wildcards);
+  g_free(pair);
+}
 
 void
 add_conversation (address_t * src_address, address_t * dst_address,
 		  guint16 src_port, guint16 dst_port, const gchar * data)
 {
   conversation_t *conv = NULL;
+  conv_pair_t *pair;
   const gchar *old_data = NULL;
 
   if (!src_address || !dst_address)
@@ -109,6 +267,13 @@ add_conversation (address_t * src_address, address_t * dst_address,
 	      address_to_str (src_address), src_port,
 	      address_to_str (dst_address), dst_port, data);
 
+  if (!pairs)
+    {
+      pairs = g_hash_table_new_full(conv_pair_hash, conv_pair_equal, 
+                                    NULL, conv_pair_delete);
+      exact_convs = g_hash_table_new(conv_exact_hash, conv_exact_equal);
+    }
+
   conv = g_malloc (sizeof (conversation_t));
   g_assert(conv);
   
@@ -117,8 +282,22 @@ add_conversation (address_t * src_address, address_t * dst_address,
   conv->src_port = src_port;
   conv->dst_port = dst_port;
   conv->data = g_strdup (data);
+  conv->last_used = appdata.now;
+
+  pair = find_pair(src_address, dst_address);
+  if (!pair)
+    {
+      pair = g_malloc0 (sizeof (conv_pair_t));
+      address_copy(&pair->src_address, src_address);
+      address_copy(&pair->dst_address, dst_address);
+      g_hash_table_insert(pairs, pair, pair);
+    }
+  pair->convs = g_list_prepend (pair->convs, conv);
+  if (src_port && dst_port)
+    g_hash_table_insert(exact_convs, conv, conv);
+  else
+    pair->wildcards = g_list_prepend (pair->wildcards, conv);
 
-  conversations = g_list_prepend (conversations, conv);
   n_conversations++;
 }				/* add_conversation */
 
@@ -130,7 +309,7 @@ const gchar*
 find_conversation (address_t * src_address, address_t * dst_address,
 		      guint16 src_port, guint16 dst_port)
 {
-  GList *item;
+  conversation_t *conv;
 
   if (!src_address || !dst_address)
     {
@@ -138,11 +317,11 @@ find_conversation (address_t * src_address, address_t * dst_address,
       return NULL;
     }
 
-  item = find_conversation_ptr(src_address, dst_address, src_port, dst_port);
-  if (item)
+  conv = find_conversation_ptr(src_address, dst_address, src_port, dst_port);
+  if (conv)
     {
       /* found */
-      conversation_t *conv = item->data;
+      conv->last_used = appdata.now;
       return conv->data;
     }
   else
@@ -153,7 +332,7 @@ find_conversation (address_t * src_address, address_t * dst_address,
 void
 delete_conversation_link(address_t * src_address, address_t * dst_address)
 {
-  GList *item;
+  conv_pair_t *pair;
 
   if (!src_address || !dst_address)
     {
@@ -161,38 +340,65 @@ delete_conversation_link(address_t * src_address, address_t * dst_address)
       return;
     }
 
-  while ( (item = find_conversation_ptr(src_address, dst_address, 0, 0)) )
-    {
-      conversation_t *conv = NULL;
-      conv = item->data;
-      g_my_debug ("Removing conversation %s:%d-%s:%d %s",
-		  address_to_str (&conv->src_address), conv->src_port,
-		  address_to_str (&conv->dst_address), conv->dst_port, conv->data);
-      g_free (conv->data);
-      g_free (conv);
-      conversations = g_list_delete_link(conversations, item);
-      n_conversations--;
-    }
+  pair = find_pair(src_address, dst_address);
+  if (pair)
+    g_hash_table_remove(pairs, pair);
 }
 
 void
 delete_conversations (void)
 {
-  GList *item = conversations;
-  conversation_t *conv = NULL;
+  if (pairs)
+    {
+      /* pairs first, since they remove their conversations from the
+       * exact index */
+      g_hash_table_destroy(pairs);
+      g_hash_table_destroy(exact_convs);
+      pairs = NULL;
+      exact_convs = NULL;
+    }
+  last_expire.tv_sec = 0;
+  last_expire.tv_usec = 0;
+}				/* delete_conversations */
+
+/* removes the idle conversations of a pair. Returns TRUE if the pair 
+ * became empty and must be removed */
+static gboolean expire_pair(gpointer key, gpointer value, gpointer data)
+{
+  conv_pair_t *pair = value;
+  GList *item = pair->convs;
+  GList *next;
 
   while (item)
     {
-      conv = item->data;
-      g_my_debug ("Removing conversation %s:%d-%s:%d %s",
-		  address_to_str (&conv->src_address), conv->src_port,
-		  address_to_str (&conv->dst_address), conv->dst_port, conv->data);
-      g_free (conv->data);
-      g_free (conv);
-      item = item->next;
-      n_conversations--;
+      conversation_t *conv = item->data;
+      next = item->next;
+      if (substract_times_ms(&appdata.now, &conv->last_used) > 
+          CONVERSATION_TIMEOUT * 1000.0)
+        {
+          if (conv->src_port && conv->dst_port)
+            g_hash_table_remove(exact_convs, conv);
+          else
+            pair->wildcards = g_list_remove(pair->wildcards, conv);
+          pair->convs = g_list_delete_link(pair->convs, item);
+          conversation_delete(conv);
+        }
+      item = next;
     }
 
-  g_list_free (conversations);
-  conversations = NULL;
-}				/* delete_conversations */
+  return pair->convs == NULL;
+}
+
+/* forgets conversations not matched in the last CONVERSATION_TIMEOUT 
+ * seconds. Cheap to call at every refresh */
+void
+expire_conversations (void)
+{
+  if (!pairs || 
+      substract_times_ms(&appdata.now, &last_expire) < 
+      CONVERSATION_EXPIRE_INTERVAL * 1000.0)
+    return;
+
+  last_expire = appdata.now;
+  g_hash_table_foreach_remove(pairs, expire_pair, NULL);
+}				/* expire_conversations */
@@ -25,6 +25,7 @@ typedef struct
   guint16 src_port;
   guint16 dst_port;
   gchar *data;
+  struct timeval last_used;     /* last time the conversation matched */
 }
 conversation_t;
 
@@ -35,5 +36,6 @@ const gchar *find_conversation (address_t * src_address,
 void delete_conversation_link(address_t * src_address, 
 		       address_t * dst_address);
 void delete_conversations (void);
+void expire_conversations (void);
 
 long active_conversations(void);
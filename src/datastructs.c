@@ -38,6 +38,20 @@
 static GTree *service_names = NULL;
 static GTree *tcp_services = NULL;
 static GTree *udp_services = NULL;
+
+/* per packet lookups use a two level direct index, built from the trees 
+ * when the services are loaded: the high byte of the port selects a page of
+ * 256 entries, allocated only if it holds at least a service */
+#define PORT_PAGE_SIZE 256
+#define PORT_N_PAGES 256
+typedef struct
+{
+  const port_service_t **pages[PORT_N_PAGES];
+}
+port_index_t;
+static port_index_t tcp_index;
+static port_index_t udp_index;
+
 static void services_fill_preferred(void);
 static port_service_t *port_service_new(port_type_t port, const gchar *name);
 static void port_service_free(port_service_t *);
@@ -360,6 +374,40 @@ static gboolean services_port_trv(gpointer key, gpointer value, gpointer data)
   return FALSE;
 }
 
+/* traverse function to fill a port_index_t */
+static gboolean services_index_trv(gpointer key, gpointer value, gpointer data)
+{
+  const port_service_t *svc = (const port_service_t *)value;
+  port_index_t *index = (port_index_t *)data;
+  guint page = svc->port / PORT_PAGE_SIZE;
+
+  if (!index->pages[page])
+    index->pages[page] = g_malloc0(PORT_PAGE_SIZE * sizeof(port_service_t *));
+  index->pages[page][svc->port % PORT_PAGE_SIZE] = svc;
+  return FALSE;
+}
+
+static void port_index_clear(port_index_t *index)
+{
+  guint i;
+
+  for (i = 0; i < PORT_N_PAGES; ++i)
+    {
+      g_free(index->pages[i]);
+      index->pages[i] = NULL;
+    }
+}
+
+static inline const port_service_t *
+port_index_find(const port_index_t *index, port_type_t port)
+{
+  const port_service_t **page = index->pages[port / PORT_PAGE_SIZE];
+
+  if (!page)
+    return NULL;
+  return page[port % PORT_PAGE_SIZE];
+}
+
 /* traverse function to fill preferred field */
 static gboolean services_pref_trv(gpointer key, gpointer value, gpointer data)
 {
@@ -495,12 +543,18 @@ void services_init(void)
   g_tree_foreach(udp_services, services_port_trv, service_names);
   g_tree_foreach(tcp_services, services_port_trv, service_names);
 
+  /* and the direct port indexes */
+  g_tree_foreach(udp_services, services_index_trv, &udp_index);
+  g_tree_foreach(tcp_services, services_index_trv, &tcp_index);
+
   /* and finally assign preferred services */
   services_fill_preferred();
 }				/* services_init */
 
 void services_clear(void)
 {
+  port_index_clear(&tcp_index);
+  port_index_clear(&udp_index);
   g_tree_destroy(service_names);
   g_tree_destroy(tcp_services);
   g_tree_destroy(udp_services);
@@ -508,18 +562,61 @@ void services_clear(void)
 
 const port_service_t *services_tcp_find(port_type_t port)
 {
-  if (tcp_services)
-      return (port_service_t *)g_tree_lookup (tcp_services, &port);
-  else
-    return NULL;
+  return port_index_find(&tcp_index, port);
 }
 
 const port_service_t *services_udp_find(port_type_t port)
 {
-  if (udp_services)
-      return (port_service_t *)g_tree_lookup (udp_services, &port);
+  return port_index_find(&udp_index, port);
+}
+
+/* Given two port numbers, it returns the 
+ * one that is a privileged port if the other
+ * is not. If not, just returns the lower numbered */
+port_type_t services_choose_port (port_type_t a, port_type_t b)
+{
+  if ((a < 1024) && (b >= 1024))
+    return a;
+  else if ((a >= 1024) && (b < 1024))
+    return b;
+  else if (a <= b)
+    return a;
   else
-    return NULL;
+    return b;
+}				/* services_choose_port */
+
+/* chooses between the services of the two ports of a packet.
+ * If one of the services has user-defined color, then we favor it,
+ * otherwise the port given by services_choose_port wins */
+static const port_service_t *
+services_choose(const port_index_t *index, 
+                port_type_t src_port, port_type_t dst_port)
+{
+  const port_service_t *src_service = port_index_find(index, src_port);
+  const port_service_t *dst_service = port_index_find(index, dst_port);
+
+  if (!src_service)
+    return dst_service;
+  if (!dst_service)
+    return src_service;
+
+  if (src_service->preferred != dst_service->preferred)
+    return src_service->preferred ? src_service : dst_service;
+  if (services_choose_port(src_port, dst_port) == src_port)
+    return src_service;
+  return dst_service;
+}
+
+const port_service_t *services_tcp_choose(port_type_t src_port, 
+                                          port_type_t dst_port)
+{
+  return services_choose(&tcp_index, src_port, dst_port);
+}
+
+const port_service_t *services_udp_choose(port_type_t src_port, 
+                                          port_type_t dst_port)
+{
+  return services_choose(&udp_index, src_port, dst_port);
 }
 
 /************************************************************************
@@ -535,6 +632,8 @@ port_service_t *port_service_new(port_type_t port, const gchar *name)
   
   p->port = port; 
   p->name = g_strdup(name);
+  p->atom = proto_atom_intern(name);
+  proto_atom_ref(p->atom);
   p->preferred = FALSE;
   return p;
 }
@@ -542,7 +641,10 @@ port_service_t *port_service_new(port_type_t port, const gchar *name)
 void port_service_free(port_service_t *p)
 {
   if (p)
-    g_free(p->name);
+    {
+      g_free(p->name);
+      proto_atom_unref(p->atom);
+    }
   g_free(p);
 }
 
@@ -25,6 +25,7 @@
 #endif
 //#include "appdata.h"
 #include "prot_types.h"
+#include "proto_atoms.h"
 
 typedef struct
 {
@@ -59,6 +60,7 @@ typedef struct
 {
   port_type_t port;
   gchar *name;
+  proto_atom_t atom;    /* interned name */
   gboolean preferred;   /* true if has to be favored when choosing proto name */
 } port_service_t;
 
@@ -68,6 +70,12 @@ void services_clear(void);
 
 const port_service_t *services_tcp_find(port_type_t port);
 const port_service_t *services_udp_find(port_type_t port);
+/* service to use as protocol name for a tcp/udp packet, NULL if unknown */
+const port_service_t *services_tcp_choose(port_type_t src_port, 
+                                          port_type_t dst_port);
+const port_service_t *services_udp_choose(port_type_t src_port, 
+                                          port_type_t dst_port);
+port_type_t services_choose_port (port_type_t a, port_type_t b);
 const port_service_t *services_port_find(const gchar *name);
 
 #endif
@@ -40,6 +40,8 @@
 #include "node.h"
 #include "links.h"
 #include "names.h"
+#include "flow_cache.h"
+#include "mem_pool.h"
 
 #define TCP_FTP 21
 #define TCP_NETBIOS_SSN 139
@@ -77,7 +79,7 @@ typedef struct
   const guint8 *cur_packet; /* pointer to current level start of packet */
   guint cur_len;        /* current level remaining length */
 
-  packet_protos_t *pr; /* detected protocol stack */
+  packet_protos_t pr; /* detected protocol stack */
   guint cur_level;      /* current protocol depth on stack */
 
   /* node ids */
@@ -90,23 +92,90 @@ typedef struct
   guint16 global_src_port;
   guint16 global_dst_port;
 
+  gboolean flow_cacheable; /* true if the protocols found above IP depend 
+                            * only on addresses and ports */
+
+  packet_addrs_t addrs;    /* addresses found at each level, for names */
+
+  const hdr_batch_t *hdrs; /* burst pre-pass results, NULL if none */
+  guint hdr_idx;           /* index of this packet in hdrs */
 } decode_proto_t;
 
+/* with accumulated stats, packets of the same flow (nodes and protocols) 
+ * are summed here, and added to the catalogs at refresh time */
+typedef struct
+{
+  node_id_t src_node_id;        /* key */
+  node_id_t dst_node_id;        /* key */
+  packet_protos_t prot_desc;    /* key */
+  guint bytes;                  /* packet sizes */
+  guint raw_bytes;              /* captured sizes, for names */
+  guint n_packets;
+  packet_names_t names;         /* names of the first packet */
+} packet_accum_t;
+
+#define ACCUM_POOL_CHUNK 256
+static GHashTable *accumulators = NULL; /* packet_accum_t keyed by itself */
+static mem_pool_t accum_pool;
+
+static void accumulate_packet (const decode_proto_t *dp, 
+                               const guint8 *raw_packet, 
+                               guint raw_size, guint pkt_size);
+
+/* RPC can't be recognized by port, so each tcp/udp packet would be probed
+ * with get_rpc. Port pairs whose probes keep failing are remembered here 
+ * and not probed again, except once every RPC_SKIP_PACKETS packets */
+#define RPC_CACHE_BITS 12
+#define RPC_CACHE_SIZE (1 << RPC_CACHE_BITS)
+#define RPC_MISSES_TO_SKIP 8    /* consecutive misses before skipping */
+#define RPC_SKIP_PACKETS 256    /* skipped probes before a new probe */
+
+typedef struct
+{
+  guint32 ports;        /* src port << 16 | dst port */
+  guint32 generation;   /* entry is valid only in its generation */
+  gboolean is_udp;
+  guint16 misses;
+  guint16 skipped;
+} rpc_cache_entry_t;
+
+static rpc_cache_entry_t rpc_cache[RPC_CACHE_SIZE];
+/* incremented at each new rpc conversation, since RPC replies are
+ * recognized by those, invalidating the whole cache */
+static guint32 rpc_cache_generation = 1;
+
 /* extracts the protocol stack from packet */
 static void get_packet_prot (decode_proto_t *dp);
 
-/* starts a new decode, allocating a new packet_protos_t */
+/* starts a new decode, clearing the protocol stack */
 static void decode_proto_start(decode_proto_t *dp, 
                                const guint8 *pkt, guint caplen);
 
 /* sets protoname at current level, and passes at next level */
 static void decode_proto_add(decode_proto_t *dp, const gchar *fmt, ...);
+static void decode_proto_add_atom(decode_proto_t *dp, proto_atom_t atom);
 
 /* advances current packet start to prepare for next protocol */
 static void add_offset(decode_proto_t *dp, guint offset);
 
-static void add_node_packet (const guint8 * packet,
-                             guint raw_size,
+/* remember the addresses found at a level, to name the nodes */
+static packet_addr_t *add_level_addr(decode_proto_t *dp, guint level,
+                                     packet_addr_type_t type);
+static void add_eth_addrs(decode_proto_t *dp, guint level, 
+                          const guint8 *dst, const guint8 *src);
+static void add_ip_addrs(decode_proto_t *dp, guint level, int family,
+                         const guint8 *dst, const guint8 *src);
+static void add_tcp_addrs(decode_proto_t *dp, guint level);
+static void add_arp_addr(decode_proto_t *dp, guint level);
+
+static void acquire_packet(guint8 * raw_packet, guint raw_size, 
+                           guint pkt_size, const hdr_batch_t *hdrs, 
+                           guint hdr_idx);
+static void add_packet_to_catalogs (packet_info_t *packet, 
+                                    const node_id_t *src_id,
+                                    const node_id_t *dst_id, 
+                                    const packet_names_t *names);
+static node_t *add_node_packet (const packet_names_t *names,
 			     packet_info_t * packet_info,
                              const node_id_t *node_id,
 			     packet_direction direction);
@@ -130,9 +199,14 @@ static void get_linux_sll (decode_proto_t *dp);
 
 static void get_llc (decode_proto_t *dp);
 static void get_ip (decode_proto_t *dp);
+static void fill_eth_node_ids(decode_proto_t *dp);
+static void fill_ipv4_node_ids(decode_proto_t *dp, const guint8 *dst,
+                               const guint8 *src);
+static gboolean get_eth_ipv4_fast (decode_proto_t *dp);
 static void get_ipx (decode_proto_t *dp);
 static void get_tcp (decode_proto_t *dp);
 static void get_udp (decode_proto_t *dp);
+static void get_flow (decode_proto_t *dp, iptype_t ip_type);
 
 static void get_netbios (decode_proto_t *dp);
 static void get_netbios_ssn (decode_proto_t *dp);
@@ -140,7 +214,7 @@ static void get_netbios_dgm (decode_proto_t *dp);
 static void get_ftp (decode_proto_t *dp);
 
 static gboolean get_rpc (decode_proto_t *dp, gboolean is_udp);
-static guint16 choose_port (guint16 a, guint16 b);
+static gboolean get_rpc_cached (decode_proto_t *dp, gboolean is_udp);
 static void append_etype_prot (decode_proto_t *dp, etype_t etype);
 
 /* etherape has to handle several data link layer (OSI L2) packet types.
@@ -214,14 +288,14 @@ gboolean has_linklevel(void)
 /* ------------------------------------------------------------
  * Implementation
  * ------------------------------------------------------------*/
-/* starts a new decode, allocating a new packet_protos_t */
+/* starts a new decode, clearing the protocol stack */
 void decode_proto_start(decode_proto_t *dp, const guint8 *pkt, guint caplen)
 {
   dp->original_packet = pkt;
   dp->original_len = caplen;
   dp->cur_packet = pkt;
   dp->cur_len = caplen;
-  dp->pr = packet_protos_init();
+  packet_protos_clear(&dp->pr);
   dp->cur_level = 1; /* level zero is topmost protocol, will be filled later */
   node_id_clear(&dp->dst_node_id);
   node_id_clear(&dp->src_node_id);
@@ -229,21 +303,45 @@ void decode_proto_start(decode_proto_t *dp, const guint8 *pkt, guint caplen)
   address_clear(&dp->global_dst_address);
   dp->global_src_port = 0;
   dp->global_dst_port = 0;
+  dp->flow_cacheable = FALSE;
+  dp->addrs.n_addrs = 0;
+  dp->hdrs = NULL;
+  dp->hdr_idx = 0;
 }
 void decode_proto_add(decode_proto_t *dp, const gchar *fmt, ...)
 {
   va_list ap;
+  gchar name[64];
+
   if (dp->cur_level <= STACK_SIZE)
     {
-      va_start(ap, fmt);
-      dp->pr->protonames[dp->cur_level] = g_strdup_vprintf(fmt, ap);
-      va_end(ap);
+      /* most names are constant, and can be interned directly. The others
+       * are formatted on the stack, never allocating */
+      if (!strchr(fmt, '%'))
+        dp->pr.protos[dp->cur_level] = proto_atom_intern(fmt);
+      else
+        {
+          va_start(ap, fmt);
+          g_vsnprintf(name, sizeof(name), fmt, ap);
+          va_end(ap);
+          dp->pr.protos[dp->cur_level] = proto_atom_intern(name);
+        }
       dp->cur_level++;
     }
   else
     g_warning("protocol \"%.10s\" too deeply nested, ignored", fmt ? fmt : "");
 }
 
+/* as decode_proto_add, for an already interned name */
+static void decode_proto_add_atom(decode_proto_t *dp, proto_atom_t atom)
+{
+  if (dp->cur_level <= STACK_SIZE)
+    dp->pr.protos[dp->cur_level++] = atom;
+  else
+    g_warning("protocol \"%.10s\" too deeply nested, ignored", 
+              proto_atom_name(atom));
+}
+
 static void add_offset(decode_proto_t *dp, guint offset)
 {
   if (dp->cur_len < offset)
@@ -255,15 +353,147 @@ static void add_offset(decode_proto_t *dp, guint offset)
     }
 }
 
+/* returns a new address entry for level, with its payload at the current
+ * position. Returns NULL if level is beyond the stack */
+static packet_addr_t *add_level_addr(decode_proto_t *dp, guint level,
+                                     packet_addr_type_t type)
+{
+  packet_addr_t *pa;
+
+  if (level > STACK_SIZE || dp->addrs.n_addrs > STACK_SIZE)
+    return NULL;
+
+  pa = dp->addrs.addrs + dp->addrs.n_addrs++;
+  pa->type = type;
+  pa->level = level;
+  pa->offset = dp->cur_packet - dp->original_packet;
+  return pa;
+}
+
+/* ethernet addresses found at level */
+static void add_eth_addrs(decode_proto_t *dp, guint level, 
+                          const guint8 *dst, const guint8 *src)
+{
+  packet_addr_t *pa;
+
+  pa = add_level_addr(dp, level, PACKET_ADDR_NODES);
+  if (!pa)
+    return;
+  node_id_clear(&pa->node_id[INBOUND]);
+  pa->node_id[INBOUND].node_type = LINK6;
+  g_memmove(pa->node_id[INBOUND].addr.eth, dst, 
+            sizeof(pa->node_id[INBOUND].addr.eth));
+  node_id_clear(&pa->node_id[OUTBOUND]);
+  pa->node_id[OUTBOUND].node_type = LINK6;
+  g_memmove(pa->node_id[OUTBOUND].addr.eth, src, 
+            sizeof(pa->node_id[OUTBOUND].addr.eth));
+}
+
+/* ip addresses found at level, whatever the ape mode */
+static void add_ip_addrs(decode_proto_t *dp, guint level, int family,
+                         const guint8 *dst, const guint8 *src)
+{
+  packet_addr_t *pa;
+
+  pa = add_level_addr(dp, level, PACKET_ADDR_NODES);
+  if (!pa)
+    return;
+  node_id_clear(&pa->node_id[INBOUND]);
+  pa->node_id[INBOUND].node_type = IP;
+  pa->node_id[INBOUND].addr.ip.type = family;
+  g_memmove(pa->node_id[INBOUND].addr.ip.addr8, dst, address_len(family));
+  node_id_clear(&pa->node_id[OUTBOUND]);
+  pa->node_id[OUTBOUND].node_type = IP;
+  pa->node_id[OUTBOUND].addr.ip.type = family;
+  g_memmove(pa->node_id[OUTBOUND].addr.ip.addr8, src, address_len(family));
+}
+
+/* tcp endpoints found at level. They are named only in tcp mode */
+static void add_tcp_addrs(decode_proto_t *dp, guint level)
+{
+  packet_addr_t *pa;
+
+  if (appdata.mode != TCP)
+    return;
+  pa = add_level_addr(dp, level, PACKET_ADDR_NODES);
+  if (!pa)
+    return;
+  node_id_clear(&pa->node_id[INBOUND]);
+  pa->node_id[INBOUND].node_type = TCP;
+  address_copy(&pa->node_id[INBOUND].addr.tcp4.host, &dp->global_dst_address);
+  pa->node_id[INBOUND].addr.tcp4.port = dp->global_dst_port;
+  node_id_clear(&pa->node_id[OUTBOUND]);
+  pa->node_id[OUTBOUND].node_type = TCP;
+  address_copy(&pa->node_id[OUTBOUND].addr.tcp4.host, 
+               &dp->global_src_address);
+  pa->node_id[OUTBOUND].addr.tcp4.port = dp->global_src_port;
+}
+
+/* the sender ip address of an arp packet, with dp at the arp header.
+ * The target is most of the times broadcast, and isn't named */
+static void add_arp_addr(decode_proto_t *dp, guint level)
+{
+#define ARPTYPE_IP 0x0800
+  packet_addr_t *pa;
+  guint8 hardware_len;
+
+  /* we only know about IP ARP queries */
+  if (dp->cur_len < 8 || pntohs (dp->cur_packet + 2) != ARPTYPE_IP)
+    return;
+  hardware_len = dp->cur_packet[4];
+  if (dp->cur_len < 8 + hardware_len + 4)
+    return;
+
+  pa = add_level_addr(dp, level, PACKET_ADDR_ARP);
+  if (!pa)
+    return;
+  node_id_clear(&pa->node_id[OUTBOUND]);
+  pa->node_id[OUTBOUND].node_type = IP;
+  pa->node_id[OUTBOUND].addr.ip.type = AF_INET;
+  g_memmove(pa->node_id[OUTBOUND].addr.ip.addr_v4, 
+            dp->cur_packet + 8 + hardware_len, 
+            sizeof(pa->node_id[OUTBOUND].addr.ip.addr_v4));
+}
+
 /* This function is called everytime there is a new packet in
  * the network interface. It then updates traffic information
  * for the appropriate nodes and links 
  * Receives both the captured (raw) size and the real packet size */
 void packet_acquired(guint8 * raw_packet, guint raw_size, guint pkt_size)
+{
+  acquire_packet(raw_packet, raw_size, pkt_size, NULL, 0);
+}
+
+/* ethernet, ip and port fields of the whole burst are extracted at once, 
+ * before decoding the single packets */
+void packet_burst_acquired(guint n, guint8 *const *packets, 
+                           const guint *raw_sizes, const guint *pkt_sizes,
+                           const struct timeval *ts)
+{
+  hdr_batch_t hdrs;
+  gboolean is_eth;
+  guint i;
+
+  is_eth = lkentry && lkentry->fun == get_eth_type && 
+    !appdata.generic_decode;
+  if (is_eth)
+    hdr_batch_extract(&hdrs, n, (const guint8 *const *)packets, raw_sizes);
+
+  for (i = 0; i < n; ++i)
+    {
+      appdata.now = ts[i];
+      acquire_packet(packets[i], raw_sizes[i], pkt_sizes[i], 
+                     is_eth ? &hdrs : NULL, i);
+    }
+}
+
+static void acquire_packet(guint8 * raw_packet, guint raw_size, 
+                           guint pkt_size, const hdr_batch_t *hdrs, 
+                           guint hdr_idx)
 {
   packet_info_t *packet;
-  link_id_t link_id;
   decode_proto_t decp;
+  packet_names_t names;
 
   g_assert (raw_packet != NULL);
   if (!lkentry || !lkentry->fun)
@@ -273,60 +503,206 @@ void packet_acquired(guint8 * raw_packet, guint raw_size, guint pkt_size)
     }
 
   decode_proto_start(&decp, raw_packet, raw_size);
+  decp.hdrs = hdrs;
+  decp.hdr_idx = hdr_idx;
+
+  /* Get the protocol tree */
+  get_packet_prot (&decp);
+
+  appdata.n_packets++;
+
+  if (appdata.accumulate_stats)
+    {
+      /* stats will be updated at next refresh */
+      accumulate_packet (&decp, raw_packet, raw_size, pkt_size);
+      return;
+    }
                                        
   /* create a packet structure to hold data */
-  packet = g_malloc (sizeof (packet_info_t));
-  g_assert(packet);
+  packet = packet_info_create();
   
   packet->size = pkt_size;
   packet->timestamp = appdata.now;
   packet->ref_count = 0;
+  packet->prot_desc = decp.pr;
+  packet_protos_ref(&packet->prot_desc);
 
-  /* Get the protocol tree */
-  get_packet_prot (&decp);
-  if (!decp.pr)
+  /* Get the names of both nodes, from the addresses found decoding */
+  get_packet_names (&names, raw_packet, raw_size, &packet->prot_desc, 
+                    &decp.addrs);
+
+  appdata.total_mem_packets++;
+
+  add_packet_to_catalogs (packet, &decp.src_node_id, &decp.dst_node_id, 
+                          &names);
+  packet_names_clear (&names);
+
+  if (!packet->ref_count)
     {
-      /* fatal error, discard packet */
-      g_free(packet); 
-      return;
+      /* nobody keeps the packet (bucketed stats), delete it */
+      packet_info_delete(packet);
+      appdata.total_mem_packets--;
     }
-  packet->prot_desc = decp.pr;
+}
 
-  appdata.n_packets++;
-  appdata.total_mem_packets++;
+/* updates nodes, link and protocol summary with a packet */
+static void
+add_packet_to_catalogs (packet_info_t *packet, const node_id_t *src_id,
+                        const node_id_t *dst_id, const packet_names_t *names)
+{
+  node_t *src_node;
+  node_t *dst_node;
 
   /* Add this packet information to the src and dst nodes. If they
    * don't exist, create them */
-  add_node_packet (raw_packet, raw_size, packet, &decp.src_node_id, OUTBOUND);
-  add_node_packet (raw_packet, raw_size, packet, &decp.dst_node_id, INBOUND);
+  src_node = add_node_packet (names, packet, src_id, OUTBOUND);
+  dst_node = add_node_packet (names, packet, dst_id, INBOUND);
 
   /* And now we update link traffic information for this packet */
-  if (node_id_compare (&decp.src_node_id, &decp.dst_node_id) < 1)
+  if (node_id_compare (&src_node->node_id, &dst_node->node_id) < 1)
     {
       /* src id <= dst id, direct packet */
-      link_id.src = decp.src_node_id;
-      link_id.dst = decp.dst_node_id;
-      links_catalog_add_packet(&link_id, packet, OUTBOUND);
+      links_catalog_add_packet(src_node, dst_node, packet, OUTBOUND);
     } 
   else
     {
       /* src id <= dst id, inverse packet */
-      link_id.src = decp.dst_node_id;
-      link_id.dst = decp.src_node_id;
-      links_catalog_add_packet(&link_id, packet, INBOUND);
+      links_catalog_add_packet(dst_node, src_node, packet, INBOUND);
     }
 
   /* finally, update global protocol stats */
   protocol_summary_add_packet(packet);
 }
 
+/* ------------------------------------------------------------
+ * Accumulated stats
+ * ------------------------------------------------------------*/
+
+static guint packet_accum_hash(gconstpointer key)
+{
+  const packet_accum_t *acc = key;
+  guint h;
+  guint i;
+
+  h = node_id_hash(&acc->src_node_id) ^ 
+    node_id_hash(&acc->dst_node_id) * 0x9E3779B1U;
+  for (i = 0; i <= STACK_SIZE; ++i)
+    h = h * 31 + acc->prot_desc.protos[i];
+  return h;
+}
+
+static gboolean packet_accum_equal(gconstpointer a, gconstpointer b)
+{
+  const packet_accum_t *aa = a;
+  const packet_accum_t *ab = b;
+
+  return !node_id_compare(&aa->src_node_id, &ab->src_node_id) &&
+    !node_id_compare(&aa->dst_node_id, &ab->dst_node_id) &&
+    !memcmp(&aa->prot_desc, &ab->prot_desc, sizeof(packet_protos_t));
+}
+
+/* sums a decoded packet into the accumulator of its flow */
+static void 
+accumulate_packet (const decode_proto_t *dp, const guint8 *raw_packet, 
+                   guint raw_size, guint pkt_size)
+{
+  packet_accum_t key;
+  packet_accum_t *acc;
+
+  if (!accumulators)
+    {
+      accumulators = g_hash_table_new(packet_accum_hash, packet_accum_equal);
+      mem_pool_init(&accum_pool, "packet_accum", sizeof(packet_accum_t),
+                    ACCUM_POOL_CHUNK);
+    }
+
+  key.src_node_id = dp->src_node_id;
+  key.dst_node_id = dp->dst_node_id;
+  key.prot_desc = dp->pr;
+  acc = g_hash_table_lookup(accumulators, &key);
+  if (!acc)
+    {
+      /* first packet of the flow in this refresh period: names are
+       * taken from it */
+      acc = mem_pool_alloc(&accum_pool);
+      *acc = key;
+      acc->bytes = 0;
+      acc->raw_bytes = 0;
+      acc->n_packets = 0;
+      packet_protos_ref(&acc->prot_desc);
+      get_packet_names (&acc->names, raw_packet, raw_size, &acc->prot_desc, 
+                        &dp->addrs);
+      packet_names_keep (&acc->names); /* used after the packet is gone */
+      g_hash_table_insert(accumulators, acc, acc);
+    }
+
+  acc->bytes += pkt_size;
+  acc->raw_bytes += raw_size;
+  acc->n_packets++;
+}
+
+static gboolean flush_accum(gpointer key, gpointer value, gpointer data)
+{
+  packet_accum_t *acc = value;
+  packet_info_t packet;
+
+  /* bucketed stats don't keep packets, so the sum can be on the stack */
+  packet.size = acc->bytes;
+  packet.n_packets = acc->n_packets;
+  packet.timestamp = appdata.now;
+  packet.prot_desc = acc->prot_desc;
+  packet.ref_count = 0;
+  acc->names.packet_size = acc->raw_bytes;
+
+  add_packet_to_catalogs (&packet, &acc->src_node_id, &acc->dst_node_id, 
+                          &acc->names);
+  g_assert(!packet.ref_count);
+
+  packet_names_clear (&acc->names);
+  packet_protos_unref (&acc->prot_desc);
+  mem_pool_free(&accum_pool, acc);
+  return TRUE;
+}
+
+/* adds the traffic accumulated since last call to the catalogs */
+void flush_accumulated_packets(void)
+{
+  if (!accumulators)
+    return;
+
+  /* the pool is kept, the next period will need as many accumulators.
+   * It is released by clear_accumulated_packets */
+  g_hash_table_foreach_remove(accumulators, flush_accum, NULL);
+}
+
+static gboolean discard_accum(gpointer key, gpointer value, gpointer data)
+{
+  packet_accum_t *acc = value;
+
+  packet_names_clear (&acc->names);
+  packet_protos_unref (&acc->prot_desc);
+  mem_pool_free(&accum_pool, acc);
+  return TRUE;
+}
+
+/* drops the traffic accumulated and not yet flushed */
+void clear_accumulated_packets(void)
+{
+  if (!accumulators)
+    return;
+
+  g_hash_table_foreach_remove(accumulators, discard_accum, NULL);
+  g_hash_table_destroy(accumulators);
+  mem_pool_destroy(&accum_pool);
+  accumulators = NULL;
+}
+
 
 /* We update node information for each new packet that arrives in the
  * network. If the node the packet refers to is unknown, we
- * create it. */
-static void
-add_node_packet (const guint8 * raw_packet,
-                 guint raw_size,
+ * create it. Returns the node */
+static node_t *
+add_node_packet (const packet_names_t *names,
 		 packet_info_t * packet,
                  const node_id_t *node_id,
 		 packet_direction direction)
@@ -342,17 +718,18 @@ add_node_packet (const guint8 * raw_packet,
     }
 
   traffic_stats_add_packet(&node->node_stats, packet, direction);
+  nodes_catalog_touch(node);
 
   /* If this is the first packet we've heard from the node in a while, 
    * we add it to the list of new nodes so that the main app know this 
    * node is active again */
-  if (node->node_stats.pkt_list.length == 1)
+  if (traffic_stats_active_packets(&node->node_stats) == packet->n_packets)
     new_nodes_add(node);
 
   /* Update names list for this node */
-  get_packet_names (&node->node_stats.stats_protos, raw_packet, raw_size,
-		    packet->prot_desc, direction, lkentry->dlt_linktype);
+  packet_names_add (&node->node_stats.stats_protos, names, direction);
 
+  return node;
 }				/* add_node_packet */
 
 static void get_packet_prot (decode_proto_t *dp)
@@ -360,14 +737,16 @@ static void get_packet_prot (decode_proto_t *dp)
   guint i;
 
   g_assert(lkentry && lkentry->fun);
-  lkentry->fun(dp);
+  if (appdata.generic_decode || lkentry->fun != get_eth_type ||
+      !get_eth_ipv4_fast(dp))
+    lkentry->fun(dp);
 
   /* first position is top proto */
   for (i = STACK_SIZE ; i>0 ; --i)
     {
-      if (dp->pr->protonames[i])
+      if (dp->pr.protos[i])
         {
-          dp->pr->protonames[0] = g_strdup(dp->pr->protonames[i]);
+          dp->pr.protos[0] = dp->pr.protos[i];
           break;
         }
     }
@@ -389,6 +768,87 @@ static void get_loop(decode_proto_t *dp)
   get_ip(dp);
 }
 
+/* ethernet addresses as node ids */
+static void fill_eth_node_ids(decode_proto_t *dp)
+{
+  dp->dst_node_id.node_type = LINK6;
+  g_memmove(dp->dst_node_id.addr.eth, dp->cur_packet + 0, 
+            sizeof(dp->dst_node_id.addr.eth));
+  dp->src_node_id.node_type = LINK6;
+  g_memmove(dp->src_node_id.addr.eth, dp->cur_packet + 6, 
+            sizeof(dp->src_node_id.addr.eth));
+}
+
+/* Straight line decoder for the most common packets, non fragmented
+ * TCP or UDP over IPv4 over Ethernet II. The result is the same of
+ * get_eth_type, without passing through the generic decoders.
+ * Returns FALSE, without touching dp, for any other packet */
+static gboolean get_eth_ipv4_fast (decode_proto_t *dp)
+{
+  static proto_atom_t atom_eth_ii = PROTO_ATOM_NONE;
+  static proto_atom_t atom_ip = PROTO_ATOM_NONE;
+  const guint8 *pkt = dp->cur_packet;
+  const guint8 *src;
+  const guint8 *dst;
+  guint ip_hl;
+  iptype_t ip_type;
+
+  if (dp->hdrs)
+    {
+      /* already checked and extracted by the burst pre-pass */
+      guint idx = dp->hdr_idx;
+
+      if (!dp->hdrs->fast[idx])
+        return FALSE;
+      ip_hl = dp->hdrs->ip_hl[idx];
+      ip_type = dp->hdrs->ip_proto[idx];
+      src = (const guint8 *)(dp->hdrs->src_addr + idx);
+      dst = (const guint8 *)(dp->hdrs->dst_addr + idx);
+    }
+  else
+    {
+      if (dp->cur_len < 14 + 20 || 
+          pntohs (pkt + 12) != ETHERTYPE_IP || (pkt[14] >> 4) != 4)
+        return FALSE;
+
+      ip_hl = (pkt[14] & 15) << 2;
+      ip_type = pkt[14 + 9];
+      if (ip_hl < 20 || dp->cur_len < 14 + ip_hl ||
+          (ip_type != IP_PROTO_TCP && ip_type != IP_PROTO_UDP) ||
+          (pntohs (pkt + 14 + 6) & 0x0fff))
+        return FALSE; /* short, fragmented or neither tcp nor udp */
+      src = pkt + 14 + 12;
+      dst = pkt + 14 + 16;
+    }
+
+  if (!atom_eth_ii)
+    {
+      /* kept forever */
+      atom_eth_ii = proto_atom_intern("ETH_II");
+      proto_atom_ref(atom_eth_ii);
+      atom_ip = proto_atom_intern("IP");
+      proto_atom_ref(atom_ip);
+    }
+
+  fill_eth_node_ids(dp);
+  add_eth_addrs(dp, dp->cur_level, pkt, pkt + 6);
+  add_offset(dp, 14);
+  decode_proto_add_atom(dp, atom_eth_ii);
+
+  add_ip_addrs(dp, dp->cur_level, AF_INET, dst, src);
+  decode_proto_add_atom(dp, atom_ip);
+  if (appdata.mode !=  LINK6)
+    fill_ipv4_node_ids(dp, dst, src);
+  add_offset(dp, ip_hl);
+
+  /* This is used for conversations */
+  address_copy(&dp->global_src_address, &dp->src_node_id.addr.ip);
+  address_copy(&dp->global_dst_address, &dp->dst_node_id.addr.ip);
+
+  get_flow (dp, ip_type);
+  return TRUE;
+}				/* get_eth_ipv4_fast */
+
 static void get_eth_type (decode_proto_t *dp)
 {
   guint16 ethsize;
@@ -448,19 +908,14 @@ static void get_eth_type (decode_proto_t *dp)
           dp->cur_packet[4] == 0x00)
         {
           /* TODO Analyze ISL frames */
+          add_eth_addrs(dp, dp->cur_level, 
+                        dp->cur_packet, dp->cur_packet + 6);
           decode_proto_add(dp, "ISL");
           return;
         }
     }
 
-  /* node ids */
-  dp->dst_node_id.node_type = LINK6;
-  g_memmove(dp->dst_node_id.addr.eth, dp->cur_packet + 0, 
-            sizeof(dp->dst_node_id.addr.eth));
-  dp->src_node_id.node_type = LINK6;
-  g_memmove(dp->src_node_id.addr.eth, dp->cur_packet + 6, 
-            sizeof(dp->src_node_id.addr.eth));
-
+  fill_eth_node_ids(dp);
   add_offset(dp, size_offset + 2);
 
   if (ethhdr_type == ETHERNET_802_3)
@@ -471,12 +926,16 @@ static void get_eth_type (decode_proto_t *dp)
 
   if (ethhdr_type == ETHERNET_802_2)
     {
+      add_eth_addrs(dp, dp->cur_level, 
+                    dp->dst_node_id.addr.eth, dp->src_node_id.addr.eth);
       decode_proto_add(dp, "802.3");
       get_eth_802_3 (dp, ethhdr_type);
       return;
     }
 
   /* Else, it's ETHERNET_II, so the size is really a type field */
+  add_eth_addrs(dp, dp->cur_level, 
+                dp->dst_node_id.addr.eth, dp->src_node_id.addr.eth);
   decode_proto_add(dp, "ETH_II");
   get_eth_II (dp, (etype_t)ethsize);
 }				/* get_eth_type */
@@ -500,6 +959,8 @@ get_eth_802_3 (decode_proto_t *dp, ethhdrtype_t ethhdr_type)
 static void
 get_fddi_type (decode_proto_t *dp)
 {
+  guint fddi_level = dp->cur_level;
+
   decode_proto_add(dp, "FDDI");
 
   if (dp->cur_len < 14)
@@ -514,6 +975,7 @@ get_fddi_type (decode_proto_t *dp)
   dp->src_node_id.node_type = LINK6;
   g_memmove(dp->src_node_id.addr.eth, dp->cur_packet + 7, 
             sizeof(dp->src_node_id.addr.eth));
+  add_eth_addrs(dp, fddi_level, dp->cur_packet + 1, dp->cur_packet + 7);
   
   /* Ok, this is only temporary while I truly dissect LLC 
    * and fddi */
@@ -530,6 +992,8 @@ get_fddi_type (decode_proto_t *dp)
 static void
 get_ieee802_5_type (decode_proto_t *dp)
 {
+  guint tr_level = dp->cur_level;
+
   decode_proto_add(dp, "Token Ring");
 
   if (dp->cur_len < 15)
@@ -542,6 +1006,7 @@ get_ieee802_5_type (decode_proto_t *dp)
   dp->src_node_id.node_type = LINK6;
   g_memmove(dp->src_node_id.addr.eth, dp->cur_packet + 8, 
             sizeof(dp->src_node_id.addr.eth));
+  add_eth_addrs(dp, tr_level, dp->cur_packet + 2, dp->cur_packet + 8);
 
   if (dp->cur_len < 22)
     return; /* not big enough */
@@ -953,6 +1418,7 @@ get_llc (decode_proto_t *dp)
       decode_proto_add(dp, "PROWAY-ASLM");
       break;
     case SAP_ARP:
+      add_arp_addr(dp, dp->cur_level);
       decode_proto_add(dp, "ARP");
       break;
     case SAP_SNAP:
@@ -995,6 +1461,22 @@ get_llc (decode_proto_t *dp)
 
 }				/* get_llc */
 
+/* IPv4 addresses as node ids */
+static void fill_ipv4_node_ids(decode_proto_t *dp, const guint8 *dst,
+                               const guint8 *src)
+{
+  dp->dst_node_id.node_type = IP;
+  address_clear(&dp->dst_node_id.addr.ip);
+  dp->dst_node_id.addr.ip.type = AF_INET;
+  g_memmove(dp->dst_node_id.addr.ip.addr_v4, dst, 
+            sizeof(dp->dst_node_id.addr.ip.addr_v4));
+  dp->src_node_id.node_type = IP;
+  address_clear(&dp->src_node_id.addr.ip);
+  dp->src_node_id.addr.ip.type = AF_INET;
+  g_memmove(dp->src_node_id.addr.ip.addr_v4, src, 
+            sizeof(dp->src_node_id.addr.ip.addr_v4));
+}
+
 static void
 get_ip (decode_proto_t *dp)
 {
@@ -1012,6 +1494,8 @@ get_ip (decode_proto_t *dp)
       ip_hl = (dp->cur_packet[0] & 15) << 2;
       if (ip_hl < 20)
         return;
+      add_ip_addrs(dp, dp->cur_level, AF_INET, 
+                   dp->cur_packet + 16, dp->cur_packet + 12);
       decode_proto_add(dp, "IP");
 
       ip_type = dp->cur_packet[9];
@@ -1019,25 +1503,15 @@ get_ip (decode_proto_t *dp)
       fragment_offset &= 0x0fff;
 
       if (appdata.mode !=  LINK6)
-        {
-          /* we want node higher level node ids */
-          dp->dst_node_id.node_type = IP;
-          address_clear(&dp->dst_node_id.addr.ip);
-          dp->dst_node_id.addr.ip.type = AF_INET;
-          g_memmove(dp->dst_node_id.addr.ip.addr_v4, dp->cur_packet + 16, 
-                    sizeof(dp->dst_node_id.addr.ip.addr_v4));
-          dp->src_node_id.node_type = IP;
-          address_clear(&dp->src_node_id.addr.ip);
-          dp->src_node_id.addr.ip.type = AF_INET;
-          g_memmove(dp->src_node_id.addr.ip.addr_v4, dp->cur_packet + 12, 
-                    sizeof(dp->src_node_id.addr.ip.addr_v4));
-        }
+        fill_ipv4_node_ids(dp, dp->cur_packet + 16, dp->cur_packet + 12);
 
       add_offset(dp, ip_hl);
       break;
     case 6:
       if (dp->cur_len < 40)
         return; 
+      add_ip_addrs(dp, dp->cur_level, AF_INET6, 
+                   dp->cur_packet + 24, dp->cur_packet + 8);
       decode_proto_add(dp, "IPV6");
 
       ip_type = dp->cur_packet[6];
@@ -1075,13 +1549,13 @@ get_ip (decode_proto_t *dp)
       if (fragment_offset)
 	decode_proto_add(dp, "TCP_FRAGMENT");
       else
-        get_tcp (dp);
+        get_flow (dp, ip_type);
       break;
     case IP_PROTO_UDP:
       if (fragment_offset)
 	decode_proto_add(dp, "UDP_FRAGMENT");
       else
-        get_udp (dp);
+        get_flow (dp, ip_type);
       break;
     case IP_PROTO_IGMP:
       decode_proto_add(dp, "IGMP");
@@ -1110,6 +1584,9 @@ get_ip (decode_proto_t *dp)
       decode_proto_add(dp, "TP");
       break;
     case IP_PROTO_IPV6:
+      if (dp->cur_len >= 40)
+        add_ip_addrs(dp, dp->cur_level, AF_INET6, 
+                     dp->cur_packet + 24, dp->cur_packet + 8);
       decode_proto_add(dp, "IPV6");
       break;
     case IP_PROTO_ROUTING:
@@ -1214,7 +1691,15 @@ get_ipx (decode_proto_t *dp)
     return;
 
   if ((ipx_dsocket == IPX_SOCKET_SAP) || (ipx_ssocket == IPX_SOCKET_SAP))
-    decode_proto_add(dp, "IPX-SAP");
+    {
+      packet_addr_t *pa;
+
+      /* sap names follow the ipx header */
+      pa = add_level_addr(dp, dp->cur_level, PACKET_ADDR_IPXSAP);
+      if (pa)
+        pa->offset += 30;
+      decode_proto_add(dp, "IPX-SAP");
+    }
   else if ((ipx_dsocket == IPX_SOCKET_ATTACHMATE_GW)
 	   || (ipx_ssocket == IPX_SOCKET_ATTACHMATE_GW))
     decode_proto_add(dp, "ATTACHMATE-GW");
@@ -1276,17 +1761,16 @@ get_ipx (decode_proto_t *dp)
 static void
 get_tcp (decode_proto_t *dp)
 {
-  const port_service_t *src_service, *dst_service, *chosen_service;
+  const port_service_t *chosen_service;
   port_type_t src_port, dst_port, chosen_port;
   guint8 th_off_x2;
   guint8 tcp_len;
   const gchar *str;
-  gboolean src_pref = FALSE;
-  gboolean dst_pref = FALSE;
 
-  decode_proto_add(dp, "TCP");
   dp->global_src_port = src_port = pntohs (dp->cur_packet);
   dp->global_dst_port = dst_port = pntohs (dp->cur_packet + 2);
+  add_tcp_addrs(dp, dp->cur_level);
+  decode_proto_add(dp, "TCP");
 
   if (appdata.mode ==  TCP)
     {
@@ -1313,36 +1797,37 @@ get_tcp (decode_proto_t *dp)
 				src_port, dst_port)))
     {
       decode_proto_add(dp, str);
+      dp->flow_cacheable = FALSE;
       return;
     }
 
   /* It's not possible to know in advance whether an UDP
    * cur_packet is an RPC cur_packet. We'll try */
   /* False means we are calling rpc from a TCP cur_packet */
-  if (get_rpc (dp, FALSE))
+  if (get_rpc_cached (dp, FALSE))
     return;
 
   if (src_port==TCP_NETBIOS_SSN || dst_port==TCP_NETBIOS_SSN)
     {
       get_netbios_ssn (dp);
+      dp->flow_cacheable = FALSE;
       return;
     }
   else if (src_port==TCP_FTP || dst_port == TCP_FTP)
     {
       get_ftp (dp);
+      dp->flow_cacheable = FALSE;
       return;
     }
 
-  src_service = services_tcp_find(src_port);
-  dst_service = services_tcp_find(dst_port);
-  chosen_port = choose_port (src_port, dst_port);
-
-  if (!src_service && !dst_service)
+  chosen_service = services_tcp_choose(src_port, dst_port);
+  if (!chosen_service)
     {
       if (pref.group_unk)
         decode_proto_add(dp, "TCP-UNKNOwN");
       else
         {
+          chosen_port = services_choose_port (src_port, dst_port);
           if (chosen_port == src_port)
             decode_proto_add(dp, "TCP:%d-%d", chosen_port, dst_port);
           else
@@ -1351,32 +1836,14 @@ get_tcp (decode_proto_t *dp)
       return;
     }
 
-  /* if one of the services has user-defined color, then we favor it,
-   * otherwise chosen_port wins */
-  if (src_service)
-    src_pref = src_service->preferred;
-  if (dst_service)
-    dst_pref = dst_service->preferred;
-  
-  if (src_pref && !dst_pref)
-    chosen_service = src_service;
-  else if (!src_pref && dst_pref)
-    chosen_service = dst_service;
-  else if (!dst_service || ((src_port == chosen_port) && src_service))
-    chosen_service = src_service;
-  else
-    chosen_service = dst_service;
-
-  decode_proto_add(dp, "%s", chosen_service->name);
+  decode_proto_add_atom(dp, chosen_service->atom);
 }				/* get_tcp */
 
 static void
 get_udp (decode_proto_t *dp)
 {
-  const port_service_t *src_service, *dst_service, *chosen_service;
+  const port_service_t *chosen_service;
   port_type_t src_port, dst_port, chosen_port;
-  gboolean src_pref = FALSE;
-  gboolean dst_pref = FALSE;
 
   decode_proto_add(dp, "UDP");
   dp->global_src_port = src_port = pntohs (dp->cur_packet);
@@ -1401,26 +1868,24 @@ get_udp (decode_proto_t *dp)
 
   /* It's not possible to know in advance whether an UDP
    * cur_packet is an RPC cur_packet. We'll try */
-  if (get_rpc (dp, TRUE))
+  if (get_rpc_cached (dp, TRUE))
     return;
 
   if (src_port==UDP_NETBIOS_NS || dst_port==UDP_NETBIOS_NS)
     {
       get_netbios_dgm (dp);
+      dp->flow_cacheable = FALSE;
       return;
     }
 
-  src_service = services_udp_find(src_port);
-  dst_service = services_udp_find(dst_port);
-
-  chosen_port = choose_port (src_port, dst_port);
-
-  if (!dst_service && !src_service)
+  chosen_service = services_udp_choose(src_port, dst_port);
+  if (!chosen_service)
     {
       if (pref.group_unk)
         decode_proto_add(dp, "UDP-UNKNOWN");
       else
         {
+          chosen_port = services_choose_port (src_port, dst_port);
           if (chosen_port == src_port)
             decode_proto_add(dp, "UDP:%d-%d", chosen_port, dst_port);
           else
@@ -1429,24 +1894,89 @@ get_udp (decode_proto_t *dp)
       return;
     }
 
-  /* if one of the services has user-defined color, then we favor it,
-   * otherwise chosen_port wins */
-  if (src_service)
-    src_pref = src_service->preferred;
-  if (dst_service)
-    dst_pref = dst_service->preferred;
-  
-  if (src_pref && !dst_pref)
-    chosen_service = src_service;
-  else if (!src_pref && dst_pref)
-    chosen_service = dst_service;
-  else if (!dst_service || ((src_port == chosen_port) && src_service))
-    chosen_service = src_service;
-  else
-    chosen_service = dst_service;
-  decode_proto_add(dp, "%s", chosen_service->name);
+  decode_proto_add_atom(dp, chosen_service->atom);
 }				/* get_udp */
 
+/* decodes tcp and udp, reusing the result of previous packets of the 
+ * same flow when possible */
+static void
+get_flow (decode_proto_t *dp, iptype_t ip_type)
+{
+  flow_key_t key;
+  flow_decode_t decode;
+  const flow_decode_t *cached;
+  guint start_level;
+
+  if (dp->cur_len < 4 || appdata.generic_decode)
+    {
+      /* no ports, no flow. Or no cache wanted */
+      if (ip_type == IP_PROTO_TCP)
+        get_tcp (dp);
+      else
+        get_udp (dp);
+      return;
+    }
+
+  memset(&key, 0, sizeof(key));
+  address_copy(&key.src_address, &dp->global_src_address);
+  address_copy(&key.dst_address, &dp->global_dst_address);
+  if (dp->hdrs && dp->hdrs->has_ports[dp->hdr_idx])
+    {
+      /* fast frame, ports taken by the burst pre-pass */
+      key.src_port = dp->hdrs->src_port[dp->hdr_idx];
+      key.dst_port = dp->hdrs->dst_port[dp->hdr_idx];
+    }
+  else
+    {
+      key.src_port = pntohs (dp->cur_packet);
+      key.dst_port = pntohs (dp->cur_packet + 2);
+    }
+  key.ip_proto = ip_type;
+
+  cached = flow_cache_find(&key);
+  if (cached && cached->start_level == dp->cur_level && 
+      cached->mode == appdata.mode && cached->group_unk == pref.group_unk)
+    {
+      dp->global_src_port = key.src_port;
+      dp->global_dst_port = key.dst_port;
+      if (ip_type == IP_PROTO_TCP)
+        add_tcp_addrs(dp, dp->cur_level);
+      g_memmove(dp->pr.protos + dp->cur_level, cached->protos, 
+                cached->n_protos * sizeof(proto_atom_t));
+      dp->cur_level += cached->n_protos;
+      if (appdata.mode == TCP)
+        {
+          /* tcp mode node ids depend on the flow only */
+          dp->src_node_id = cached->src_node_id;
+          dp->dst_node_id = cached->dst_node_id;
+        }
+      return;
+    }
+
+  /* full decode. The decoders clear flow_cacheable if they look at 
+   * the payload */
+  start_level = dp->cur_level;
+  dp->flow_cacheable = TRUE;
+  if (ip_type == IP_PROTO_TCP)
+    get_tcp (dp);
+  else
+    get_udp (dp);
+
+  if (dp->flow_cacheable)
+    {
+      memset(&decode, 0, sizeof(decode));
+      decode.start_level = start_level;
+      decode.n_protos = dp->cur_level - start_level;
+      g_memmove(decode.protos, dp->pr.protos + start_level, 
+                decode.n_protos * sizeof(proto_atom_t));
+      decode.mode = appdata.mode;
+      decode.group_unk = pref.group_unk;
+      decode.src_node_id = dp->src_node_id;
+      decode.dst_node_id = dp->dst_node_id;
+      flow_cache_add(&key, &decode);
+    }
+}				/* get_flow */
+
 static gboolean
 get_rpc (decode_proto_t *dp, gboolean is_udp)
 {
@@ -1538,8 +2068,14 @@ get_rpc (decode_proto_t *dp, gboolean is_udp)
          using the same address for both src and dst */
       g_assert(rpc_prot);
       if (!find_conversation (&dp->global_src_address, &dp->global_src_address, dp->global_src_port, 0))
-	add_conversation (&dp->global_src_address, &dp->global_src_address,
-			  dp->global_src_port, 0, rpc_prot);
+        {
+          add_conversation (&dp->global_src_address, &dp->global_src_address,
+                            dp->global_src_port, 0, rpc_prot);
+          rpc_cache_generation++;
+          /* replies to the caller port, from any address, are now rpc */
+          flow_cache_invalidate_endpoint(&dp->global_src_address, 
+                                         dp->global_src_port, NULL);
+        }
 
       decode_proto_add(dp, "ONC-RPC");
       decode_proto_add(dp, rpc_prot);
@@ -1552,6 +2088,57 @@ get_rpc (decode_proto_t *dp, gboolean is_udp)
   return FALSE;
 }				/* get_rpc */
 
+/* calls get_rpc, unless the port pair is known to not carry rpc */
+static gboolean
+get_rpc_cached (decode_proto_t *dp, gboolean is_udp)
+{
+  rpc_cache_entry_t *entry;
+  guint32 ports;
+  guint idx;
+
+  /* only flows known to not carry rpc can skip the probe */
+  dp->flow_cacheable = FALSE;
+
+  if (dp->cur_len < 24)
+    return FALSE; /* too small for rpc, tells nothing about the ports */
+
+  if (appdata.generic_decode)
+    return get_rpc (dp, is_udp);
+
+  ports = ((guint32)dp->global_src_port << 16) | dp->global_dst_port;
+  idx = ((ports ^ (is_udp ? 0x5bd1e995U : 0)) * 0x9E3779B1U) >> 
+    (32 - RPC_CACHE_BITS);
+  entry = rpc_cache + idx;
+
+  if (entry->generation != rpc_cache_generation || entry->ports != ports ||
+      entry->is_udp != is_udp)
+    {
+      /* new port pair */
+      entry->ports = ports;
+      entry->is_udp = is_udp;
+      entry->generation = rpc_cache_generation;
+      entry->misses = 0;
+    }
+  else if (entry->misses >= RPC_MISSES_TO_SKIP && 
+           ++entry->skipped < RPC_SKIP_PACKETS)
+    {
+      /* not rpc, at least last time we checked */
+      dp->flow_cacheable = TRUE;
+      return FALSE;
+    }
+
+  entry->skipped = 0;
+  if (get_rpc (dp, is_udp))
+    {
+      entry->misses = 0;
+      return TRUE;
+    }
+
+  if (entry->misses < RPC_MISSES_TO_SKIP)
+    entry->misses++;
+  return FALSE;
+}				/* get_rpc_cached */
+
 /* This function is only called from a straight llc cur_packet,
  * never from an IP cur_packet */
 void
@@ -1583,6 +2170,7 @@ get_netbios_ssn (decode_proto_t *dp)
 #define SESSION_MESSAGE 0
   guint8 mesg_type;
 
+  add_level_addr(dp, dp->cur_level, PACKET_ADDR_NBSS);
   decode_proto_add(dp, "NETBIOS-SSN");
 
   mesg_type = dp->cur_packet[0];
@@ -1599,6 +2187,7 @@ get_netbios_dgm (decode_proto_t *dp)
 {
   guint8 mesg_type;
 
+  add_level_addr(dp, dp->cur_level, PACKET_ADDR_NBDGM);
   decode_proto_add(dp, "NETBIOS-DGM");
 
   mesg_type = dp->cur_packet[0];
@@ -1670,31 +2259,12 @@ get_ftp (decode_proto_t *dp)
   /* A port number zero means any port */
   add_conversation (&dp->global_src_address, &dp->global_dst_address,
 		    server_port, 0, "FTP-PASSIVE");
+  flow_cache_invalidate_endpoint(&dp->global_src_address, server_port,
+                                 &dp->global_dst_address);
 
   g_free (mesg);
 }
 
-/* Given two port numbers, it returns the 
- * one that is a privileged port if the other
- * is not. If not, just returns the lower numbered */
-static guint16
-choose_port (guint16 a, guint16 b)
-{
-  guint ret;
-
-  if ((a < 1024) && (b >= 1024))
-    ret = a;
-  else if ((a >= 1024) && (b < 1024))
-    ret = b;
-  else if (a <= b)
-    ret = a;
-  else
-    ret = b;
-
-  return ret;
-
-}				/* choose_port */
-
 static void
 append_etype_prot (decode_proto_t *dp, etype_t etype)
 {
@@ -1704,6 +2274,7 @@ append_etype_prot (decode_proto_t *dp, etype_t etype)
       decode_proto_add(dp, "IP");
       break;
     case ETHERTYPE_ARP:
+      add_arp_addr(dp, dp->cur_level);
       decode_proto_add(dp, "ARP");
       break;
     case ETHERTYPE_IPv6:
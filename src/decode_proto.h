@@ -23,9 +23,18 @@
 
 #include "pkt_info.h"
 #include "node_id.h"
+#include "hdr_batch.h"
 
 gboolean has_linklevel(void); /* true if current device captures l2 data */ 
 gboolean setup_link_type(unsigned int linktype);
 void packet_acquired(guint8 * packet, guint raw_size, guint pkt_size);
+/* decodes n <= HDR_BATCH_MAX packets, setting appdata.now to each ts */
+void packet_burst_acquired(guint n, guint8 *const *packets, 
+                           const guint *raw_sizes, const guint *pkt_sizes,
+                           const struct timeval *ts);
+/* with appdata.accumulate_stats, packets are summed per flow and added to
+ * the catalogs only when flushed */
+void flush_accumulated_packets(void);
+void clear_accumulated_packets(void);
 
 #endif
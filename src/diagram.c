@@ -34,13 +34,24 @@
 #include "menus.h"
 #include "capture.h"
 #include "conversations.h"
+#include "decode_proto.h"
 #include "preferences.h"
 #include "export.h"
+#include "links.h"
+#include "timer_wheel.h"
+#include "layout.h"
 
 /* maximum node and link size */
 #define MAX_NODE_SIZE 5000
 #define MAX_LINK_SIZE (MAX_NODE_SIZE/4)
 
+/* canvas items aren't redrawn for size changes under this, in pixels */
+#define MIN_SIZE_DELTA 1.0
+
+/* traffic of shown nodes is scaled up by this when choosing the nodes
+ * to show, so nodes near the node limit don't flap */
+#define SHOWN_NODE_BONUS 1.25
+
 
 /***************************************************************************
  *
@@ -57,6 +68,14 @@ typedef struct
   gboolean is_new;
   gboolean shown;		/* True if it is to be displayed. */
   gboolean centered;            /* true if is a center node */
+  gdouble traffic;              /* node average traffic, for limit_nodes */
+  gdouble size;                 /* drawn size, negative if never drawn */
+  gchar *name;                  /* drawn name */
+  guint frame;                  /* last refresh that updated the node */
+  wheel_timer_t gui_timer;      /* fires at gui node timeout */
+  gint layout_slot;             /* slot in the force layout, -1 if none */
+  gdouble x;                    /* position set from the force layout */
+  gdouble y;
 }
 canvas_node_t;
 static gint canvas_node_compare(const node_id_t *a, const node_id_t *b, 
@@ -78,6 +97,12 @@ typedef struct
   GnomeCanvasItem *src_item;    /* triangle for src side */
   GnomeCanvasItem *dst_item;    /* triangle for dst side */
   GdkColor color;
+  gboolean drawn;               /* true if the fields below are on canvas */
+  gdouble xs, ys, xd, yd;       /* drawn node centers */
+  gdouble src_size, dst_size;   /* drawn triangle sizes */
+  guint32 scaled_color;         /* drawn color */
+  guint frame;                  /* last refresh that updated the link */
+  wheel_timer_t fade_timer;     /* fires at next refresh while fading */
 }
 canvas_link_t;
 static gint canvas_link_compare(const link_id_t *a, const link_id_t *b, 
@@ -105,6 +130,13 @@ typedef struct
   
 } reposition_node_t;
 
+/* a canvas node ranked by limit_nodes */
+typedef struct
+{
+  gdouble rank;
+  canvas_node_t *canvas_node;
+} ranked_node_t;
+
 
 
 
@@ -120,6 +152,9 @@ static GTree *canvas_nodes;	/* We don't use the nodes tree directly in order to
 				 * keep a list of CanvasItems, but we do not want to keep
 				 * that info on the nodes tree itself */
 static GTree *canvas_links;	/* See canvas_nodes */
+static GTree *node_canvas_links; /* ids of the canvas links of each node, 
+                                  * so that the links of a moved node can
+                                  * follow it */
 
 static guint known_protocols = 0;
 
@@ -133,25 +168,52 @@ static gint diagram_timeout;	/* Descriptor of the diagram timeout function
 				 * (Used to change the refresh_period in the callback */
 
 static long canvas_obj_count = 0; /* counter of canvas objects */
+static gboolean need_refresh = TRUE;	/* Force update of all canvas items */
+static gboolean need_limit = TRUE;	/* Canvas nodes traffic changed */
+static gboolean layout_edges_changed = FALSE; /* Force layout needs new edges */
+static guint refresh_frame = 0;	/* Counts diagram refreshes */
+static timer_wheel_t *canvas_nodes_wheel; /* gui node timeouts */
+static timer_wheel_t *canvas_links_wheel; /* link color fading */
+static GList *wheel_delete_list; /* canvas items queued by wheel timers */
+
+/* preferences the canvas items were drawn with */
+static struct
+{
+  size_mode_t size_mode;
+  node_size_variable_t node_size_variable;
+  gdouble node_radius_multiplier;
+  gdouble link_node_ratio;
+  guint stack_level;
+  gdouble gui_node_timeout_time;
+  gdouble gui_link_timeout_time;
+} drawn_pref;
 
 /***************************************************************************
  *
  * local Function definitions
  *
  **************************************************************************/
-static void diagram_update_nodes(GtkWidget * canvas); /* updates ALL nodes */
-static void diagram_update_links(GtkWidget * canvas); /* updates ALL links */
+static void diagram_update_nodes(GtkWidget * canvas); /* updates changed nodes */
+static void diagram_update_links(GtkWidget * canvas); /* updates changed links */
+static gboolean drawn_pref_changed(void);
+static void canvas_node_timer_fired(wheel_timer_t *timer);
+static void canvas_link_timer_fired(wheel_timer_t *timer);
+static void show_canvas_node(canvas_node_t *canvas_node);
+static gint move_canvas_node(node_id_t * node_id, canvas_node_t * canvas_node,
+                             gpointer dummy);
+static gint add_layout_edge(link_id_t * link_id, canvas_link_t * canvas_link,
+                            GArray *layout_edges);
+static void update_layout_edges(void);
 
 static void check_new_protocol (GtkWidget *prot_table, const protostack_t *pstk);
 static gint check_new_node (node_t * node, GtkWidget * canvas);
 static gboolean display_node (node_t * node);
 static void limit_nodes (void);
-static gint add_ordered_node (node_id_t * node_id,
-			      canvas_node_t * canvas_node,
-			      GTree * ordered_nodes);
-static gint check_ordered_node (gdouble * traffic, canvas_node_t * node,
-				guint * count);
-static gint traffic_compare (gconstpointer a, gconstpointer b);
+static gint add_ranked_node (node_id_t * node_id,
+                             canvas_node_t * canvas_node,
+                             GArray * ranked);
+static gboolean ranked_before (const ranked_node_t *a, const ranked_node_t *b);
+static void select_top_nodes (ranked_node_t *v, guint n, guint k);
 static gint reposition_canvas_nodes (node_id_t * node_id,
 				     canvas_node_t * canvas_node,
 				     reposition_node_t *data);
@@ -164,12 +226,18 @@ static gint link_item_event (GnomeCanvasItem * item,
 static gint node_item_event (GnomeCanvasItem * item,
 			     GdkEvent * event, canvas_node_t * canvas_node);
 static void update_legend(void);
+static gdouble get_oneside_link_size(const basic_stats_t *link_stats);
 static void draw_oneside_link(double xs, double ys, double xd, double yd,
-                              const basic_stats_t *link_data, 
+                              gdouble link_size, 
                               guint32 scaledColor, GnomeCanvasItem *item);
 static void init_reposition(reposition_node_t *data,
                             GtkWidget * canvas, 
                             guint total_nodes);
+static void node_links_add(const node_id_t *node_id, 
+                           const link_id_t *link_id);
+static void node_links_remove(const node_id_t *node_id, 
+                              const link_id_t *link_id);
+static void node_links_free(GArray *link_ids);
 
 
 void ask_reposition(gboolean r_font)
@@ -181,22 +249,26 @@ void ask_reposition(gboolean r_font)
 void dump_stats(guint32 diff_msecs)
 {
   gchar *status_string;
+  gchar *pools_string;
   long ipc=ipcache_active_entries();
+  pools_string = packet_pools_dump();
   status_string = g_strdup_printf (
     _("Nodes: %d (on canvas: %d, shown: %u), Links: %d, Conversations: %ld, "
       "names %ld, protocols %ld. Total Packets seen: %lu (in memory: %ld, "
-      "on list %ld). IP cache entries %ld. Canvas objs: %ld. Refreshed: %u ms"),
+      "on list %ld). Pools: %s. IP cache entries %ld. Canvas objs: %ld. "
+      "Refreshed: %u ms"),
                                    node_count(), 
                                    g_tree_nnodes(canvas_nodes), displayed_nodes, 
                                    links_catalog_size(), active_conversations(), 
                                    active_names(), protocol_summary_size(),
                                    appdata.n_packets, appdata.total_mem_packets, 
-                                   packet_list_item_count(), ipc,
+                                   packet_list_item_count(), pools_string, ipc,
                                    canvas_obj_count,
                                    (unsigned int) diff_msecs);
   
   g_my_info ("%s", status_string);
   g_free(status_string);
+  g_free(pools_string);
 }
 
 /* called when a watched object is finalized */
@@ -232,6 +304,16 @@ init_diagram (GladeXML *xml)
                             NULL, NULL, (GDestroyNotify)canvas_node_delete);
   canvas_links = g_tree_new_full( (GCompareDataFunc)canvas_link_compare,
                             NULL, NULL, (GDestroyNotify)canvas_link_delete);
+  node_canvas_links = g_tree_new_full( (GCompareDataFunc)canvas_node_compare,
+                            NULL, g_free, (GDestroyNotify)node_links_free);
+  canvas_nodes_wheel = timer_wheel_new();
+  canvas_links_wheel = timer_wheel_new();
+
+  if (appdata.force_layout && !layout_open())
+    {
+      g_warning (_("Can't start the layout thread, using the default layout"));
+      appdata.force_layout = FALSE;
+    }
 
   initialize_pref_controls();
   
@@ -300,6 +382,14 @@ canvas_node_delete(canvas_node_t *canvas_node)
       canvas_node->group_item = NULL;
     }
 
+  wheel_timer_cancel(canvas_nodes_wheel, &canvas_node->gui_timer);
+  g_free (canvas_node->name);
+  need_limit = TRUE;
+  if (canvas_node->layout_slot >= 0)
+    {
+      layout_node_remove (canvas_node->layout_slot);
+      layout_edges_changed = TRUE;
+    }
   g_free (canvas_node);
 }
 
@@ -317,17 +407,51 @@ gfunc_remove_canvas_link(gpointer data, gpointer user_data)
   g_tree_remove (canvas_links, (const link_id_t *)data);
 }
 
+/* true if a preference changed the look of every canvas item */
+static gboolean drawn_pref_changed(void)
+{
+  if (drawn_pref.size_mode == pref.size_mode &&
+      drawn_pref.node_size_variable == pref.node_size_variable &&
+      drawn_pref.node_radius_multiplier == pref.node_radius_multiplier &&
+      drawn_pref.link_node_ratio == pref.link_node_ratio &&
+      drawn_pref.stack_level == pref.stack_level &&
+      drawn_pref.gui_node_timeout_time == pref.gui_node_timeout_time &&
+      drawn_pref.gui_link_timeout_time == pref.gui_link_timeout_time)
+    return FALSE;
+
+  drawn_pref.size_mode = pref.size_mode;
+  drawn_pref.node_size_variable = pref.node_size_variable;
+  drawn_pref.node_radius_multiplier = pref.node_radius_multiplier;
+  drawn_pref.link_node_ratio = pref.link_node_ratio;
+  drawn_pref.stack_level = pref.stack_level;
+  drawn_pref.gui_node_timeout_time = pref.gui_node_timeout_time;
+  drawn_pref.gui_link_timeout_time = pref.gui_link_timeout_time;
+  return TRUE;
+}
+
+/* a canvas node reached its gui timeout */
+static void canvas_node_timer_fired(wheel_timer_t *timer)
+{
+  canvas_node_t *canvas_node;
+
+  canvas_node = (canvas_node_t *)((gchar *)timer - 
+                                  G_STRUCT_OFFSET(canvas_node_t, gui_timer));
+  canvas_node_update(&canvas_node->canvas_node_id, canvas_node, 
+                     &wheel_delete_list);
+}
+
+/* Only the canvas nodes whose node changed since last refresh, or whose
+ * gui timeout is reached, are updated. All of them are updated only when
+ * drawing preferences change */
 static void
 diagram_update_nodes(GtkWidget * canvas)
 {
   GList *delete_list = NULL;
   node_t *new_node = NULL;
+  canvas_node_t *canvas_node;
+  node_id_t node_id;
 
-  /* Deletes all nodes and updates traffic values */
-  /* TODO To reduce CPU usage, I could just as well update each specific
-   * node in update_canvas_nodes and create a new timeout function that would
-   * make sure that old nodes get deleted by calling update_nodes, but
-   * not as often as with diagram_refresh_period */
+  /* Deletes expired nodes and updates traffic values of changed nodes */
   nodes_catalog_update_all();
 
   /* Check if there are any new nodes */
@@ -335,9 +459,23 @@ diagram_update_nodes(GtkWidget * canvas)
     check_new_node (new_node, canvas);
 
   /* Update nodes look and queue outdated canvas_nodes for deletion */
-  g_tree_foreach(canvas_nodes,
-	       (GTraverseFunc) canvas_node_update,
-	       &delete_list);
+  if (need_refresh)
+    g_tree_foreach(canvas_nodes,
+                   (GTraverseFunc) canvas_node_update,
+                   &delete_list);
+  while (dirty_nodes_pop(&node_id))
+    {
+      canvas_node = g_tree_lookup (canvas_nodes, &node_id);
+      if (!canvas_node)
+        {
+          /* node could be active again after its gui timeout */
+          check_new_node (nodes_catalog_find(&node_id), canvas);
+          canvas_node = g_tree_lookup (canvas_nodes, &node_id);
+        }
+      if (canvas_node)
+        canvas_node_update(&canvas_node->canvas_node_id, canvas_node, 
+                           &delete_list);
+    }
 
   /* delete all canvas nodes queued */
   g_list_foreach(delete_list, gfunc_remove_canvas_node, NULL);
@@ -345,47 +483,131 @@ diagram_update_nodes(GtkWidget * canvas)
   /* free the list - list items are already destroyed */
   g_list_free(delete_list);
 
+  /* then the canvas nodes reaching gui timeout */
+  timer_wheel_advance(canvas_nodes_wheel, &appdata.now, 
+                      canvas_node_timer_fired);
+  g_list_foreach(wheel_delete_list, gfunc_remove_canvas_node, NULL);
+  g_list_free(wheel_delete_list);
+  wheel_delete_list = NULL;
+
   /* Limit the number of nodes displayed, if a limit has been set */
   /* TODO check whether this is the right function to use, now that we have a more
    * general display_node called in update_canvas_nodes */
   limit_nodes ();
 
-  /* Reposition canvas_nodes */
+  /* Reposition canvas_nodes. Link positions depend on them, so links
+   * need a full update too */
   if (need_reposition)
     {
       reposition_node_t rdata;
       init_reposition(&rdata, canvas, displayed_nodes);
+      if (appdata.force_layout)
+        layout_set_area(rdata.xmin, rdata.ymin, rdata.xmax, rdata.ymax);
       g_tree_foreach(canvas_nodes,
                     (GTraverseFunc) reposition_canvas_nodes,
                     &rdata);
       need_reposition = FALSE;
       need_font_refresh = FALSE;
+      need_refresh = TRUE;
     }
+
+  /* with the force layout, nodes move to the last positions computed */
+  if (appdata.force_layout && layout_fetch())
+    g_tree_foreach(canvas_nodes, (GTraverseFunc) move_canvas_node, NULL);
 }
 
+/* a fading canvas link needs a new color */
+static void canvas_link_timer_fired(wheel_timer_t *timer)
+{
+  canvas_link_t *canvas_link;
+
+  canvas_link = (canvas_link_t *)((gchar *)timer - 
+                                  G_STRUCT_OFFSET(canvas_link_t, fade_timer));
+  canvas_link_update(&canvas_link->canvas_link_id, canvas_link, 
+                     &wheel_delete_list);
+}
+
+/* as diagram_update_nodes, only the canvas links whose link changed, or
+ * that are still fading, are updated */
 static void
 diagram_update_links(GtkWidget * canvas)
 {
   GList *delete_list = NULL;
+  canvas_link_t *canvas_link;
+  link_t *link;
+  link_id_t link_id;
 
   /* Delete old capture links and update capture link variables */
   links_catalog_update_all();
 
-  /* Check if there are any new links */
-  links_catalog_foreach((GTraverseFunc) check_new_link, canvas);
-
   /* Update links look 
    * We also queue timedout links for deletion */
-  delete_list = NULL;
-  g_tree_foreach(canvas_links,
+  if (need_refresh)
+    g_tree_foreach(canvas_links,
                    (GTraverseFunc) canvas_link_update,
                    &delete_list);
+  while (dirty_links_pop(&link_id))
+    {
+      canvas_link = g_tree_lookup (canvas_links, &link_id);
+      if (!canvas_link && (link = links_catalog_find(&link_id)))
+        {
+          /* Check if it's a new link */
+          check_new_link (&link->link_id, link, canvas);
+          canvas_link = g_tree_lookup (canvas_links, &link_id);
+        }
+      if (canvas_link)
+        canvas_link_update(&canvas_link->canvas_link_id, canvas_link, 
+                           &delete_list);
+    }
 
   /* delete all canvas links queued */
   g_list_foreach(delete_list, gfunc_remove_canvas_link, NULL);
 
   /* free the list - list items are already destroyed */
   g_list_free(delete_list);
+
+  /* fading links */
+  timer_wheel_advance(canvas_links_wheel, &appdata.now, 
+                      canvas_link_timer_fired);
+  g_list_foreach(wheel_delete_list, gfunc_remove_canvas_link, NULL);
+  g_list_free(wheel_delete_list);
+  wheel_delete_list = NULL;
+
+  if (appdata.force_layout && layout_edges_changed)
+    update_layout_edges();
+}
+
+/* adds the link to the force layout edges, if both nodes are laid out */
+static gint
+add_layout_edge(link_id_t * link_id, canvas_link_t * canvas_link,
+                GArray *layout_edges)
+{
+  const canvas_node_t *canvas_src;
+  const canvas_node_t *canvas_dst;
+
+  canvas_src = g_tree_lookup (canvas_nodes, &link_id->src);
+  canvas_dst = g_tree_lookup (canvas_nodes, &link_id->dst);
+  if (canvas_src && canvas_src->layout_slot >= 0 &&
+      canvas_dst && canvas_dst->layout_slot >= 0)
+    {
+      g_array_append_val(layout_edges, canvas_src->layout_slot);
+      g_array_append_val(layout_edges, canvas_dst->layout_slot);
+    }
+  return FALSE;
+}
+
+/* gives the force layout the links between laid out nodes */
+static void
+update_layout_edges(void)
+{
+  GArray *layout_edges;
+
+  layout_edges = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_tree_foreach(canvas_links, (GTraverseFunc) add_layout_edge, 
+                 layout_edges);
+  layout_set_edges((const guint *)layout_edges->data, layout_edges->len / 2);
+  g_array_free (layout_edges, TRUE);
+  layout_edges_changed = FALSE;
 }
 
 /* Refreshes the diagram. Called each refresh_period ms
@@ -396,6 +618,7 @@ diagram_update_links(GtkWidget * canvas)
 guint update_diagram(GtkWidget * canvas)
 {
   static struct timeval last_refresh_time = { 0, 0 };
+  struct timeval now;
   double diffms;
   enum status_t status;
 
@@ -432,17 +655,34 @@ guint update_diagram(GtkWidget * canvas)
     }
 
   already_updating = TRUE;
-  gettimeofday (&appdata.now, NULL);
+  get_capture_time (&appdata.now);
+  refresh_frame++;
+  if (drawn_pref_changed())
+    need_refresh = TRUE;
+
+  /* add traffic accumulated since last refresh */
+  flush_accumulated_packets();
 
   /* update nodes */
   diagram_update_nodes(canvas);
 
   /* update links */
   diagram_update_links(canvas);
+  need_refresh = FALSE;
+
+  /* hand the changes of this refresh to the layout thread */
+  if (appdata.force_layout)
+    layout_commit();
 
   /* Update protocol information */
   protocol_summary_update_all();
 
+  /* forget idle conversations */
+  expire_conversations();
+
+  /* give back memory left unused by traffic bursts */
+  packet_pools_trim();
+
   /* update proto legend */
   update_legend();
 
@@ -452,16 +692,19 @@ guint update_diagram(GtkWidget * canvas)
   /* With this we make sure that we don't overload the
    * CPU with redraws */
 
+  /* while replaying appdata.now is the replay clock, so the refresh
+   * time is measured on the wall clock */
   if ((last_refresh_time.tv_sec == 0) && (last_refresh_time.tv_usec == 0))
-    last_refresh_time = appdata.now;
+    gettimeofday (&last_refresh_time, NULL);
 
   /* Force redraw */
   while (gtk_events_pending ())
     gtk_main_iteration ();
 
-  gettimeofday (&appdata.now, NULL);
-  diffms = substract_times_ms(&appdata.now, &last_refresh_time);
-  last_refresh_time = appdata.now;
+  gettimeofday (&now, NULL);
+  diffms = substract_times_ms(&now, &last_refresh_time);
+  last_refresh_time = now;
+  get_capture_time (&appdata.now);
 
   already_updating = FALSE;
 
@@ -519,8 +762,8 @@ update_legend()
 static void
 check_new_protocol (GtkWidget *prot_table, const protostack_t *pstk)
 {
-  const GList *protocol_item;
   const protocol_t *protocol;
+  guint pos = 0;
   GdkColor color;
   GtkStyle *style;
   GtkLabel *lab;
@@ -531,14 +774,9 @@ check_new_protocol (GtkWidget *prot_table, const protostack_t *pstk)
     return; /* nothing to do */
 
   childlist = gtk_container_get_children(GTK_CONTAINER(prot_table));
-  protocol_item = pstk->protostack[pref.stack_level];
-  while (protocol_item)
+  while ((protocol = protocol_stack_next(pstk, pref.stack_level, &pos)))
     {
       const GList *cur;
-      protocol = protocol_item->data;
-
-      /* prepare next */
-      protocol_item = protocol_item->next; 
 
       /* First, we check whether the diagram already knows about this protocol,
        * checking whether it is shown on the legend. */
@@ -590,6 +828,10 @@ delete_gui_protocols (void)
 
   known_protocols = 0;
 
+  /* colors could change, and a stopped capture leaves canvas items of 
+   * nodes no more in catalog */
+  need_refresh = TRUE;
+
   /* restart color cycle */
   protohash_reset_cycle();
 
@@ -674,6 +916,12 @@ check_new_node (node_t * node, GtkWidget * canvas)
       new_canvas_node->is_new = TRUE;
       new_canvas_node->shown = TRUE;
       new_canvas_node->centered = FALSE;
+      new_canvas_node->traffic = 0;
+      new_canvas_node->size = -1;
+      new_canvas_node->name = g_strdup (node->name->str);
+      new_canvas_node->frame = 0;
+      wheel_timer_init(&new_canvas_node->gui_timer);
+      new_canvas_node->layout_slot = -1;
 
       g_tree_insert (canvas_nodes,
 		     &new_canvas_node->canvas_node_id, new_canvas_node);
@@ -682,23 +930,30 @@ check_new_node (node_t * node, GtkWidget * canvas)
 	     node->name->str, g_tree_nnodes (canvas_nodes));
 
       need_reposition = TRUE;
+      need_limit = TRUE;
     }
 
   return FALSE;			/* False to keep on traversing */
 }				/* check_new_node */
 
 
-/* - updates sizes, names, etc */
+/* - updates sizes, names, etc 
+ * Canvas items are changed only if the change is visible */
 static gint
 canvas_node_update(node_id_t * node_id, canvas_node_t * canvas_node,
 		     GList **delete_list)
 {
   node_t *node;
   gdouble node_size;
+  GdkColor color;
   static clock_t start = 0;
   clock_t end;
   gdouble cpu_time_used;
-  char *nametmp = NULL;
+
+  /* already updated during this refresh */
+  if (canvas_node->frame == refresh_frame)
+    return FALSE;
+  canvas_node->frame = refresh_frame;
 
   node = nodes_catalog_find(node_id);
 
@@ -712,6 +967,12 @@ canvas_node_update(node_id_t * node_id, canvas_node_t * canvas_node,
       return FALSE;
     }
 
+  if (canvas_node->traffic != node->node_stats.stats.average)
+    {
+      canvas_node->traffic = node->node_stats.stats.average;
+      need_limit = TRUE;
+    }
+
   switch (pref.node_size_variable)
     {
     case INST_TOTAL:
@@ -724,7 +985,7 @@ canvas_node_update(node_id_t * node_id, canvas_node_t * canvas_node,
       node_size = get_node_size (node->node_stats.stats_out.average);
       break;
     case INST_PACKETS:
-      node_size = get_node_size (node->node_stats.pkt_list.length);
+      node_size = get_node_size (traffic_stats_active_packets(&node->node_stats));
       break;
     case ACCU_TOTAL:
       node_size = get_node_size (node->node_stats.stats.accumulated);
@@ -751,45 +1012,45 @@ canvas_node_update(node_id_t * node_id, canvas_node_t * canvas_node,
     node_size = MAX_NODE_SIZE; 
 
   if (node->main_prot[pref.stack_level])
-    {
-      canvas_node->color = protohash_color(node->main_prot[pref.stack_level]);
-
-      gnome_canvas_item_set (canvas_node->node_item,
-			     "x1", -node_size / 2,
-			     "x2", node_size / 2,
-			     "y1", -node_size / 2,
-			     "y2", node_size / 2,
-			     "fill_color_gdk", &(canvas_node->color), NULL);
-    }
+    color = protohash_color(proto_atom_name(node->main_prot[pref.stack_level]));
   else
+    color = black_color;
+
+  if (canvas_node->size < 0 || 
+      fabs (node_size - canvas_node->size) >= MIN_SIZE_DELTA ||
+      !gdk_color_equal (&color, &canvas_node->color))
     {
-      guint32 black = 0x000000ff;
+      canvas_node->size = node_size;
+      canvas_node->color = color;
       gnome_canvas_item_set (canvas_node->node_item,
 			     "x1", -node_size / 2,
 			     "x2", node_size / 2,
 			     "y1", -node_size / 2,
 			     "y2", node_size / 2,
-			     "fill_color_rgba", black, NULL);
+			     "fill_color_gdk", &(canvas_node->color), NULL);
     }
 
   /* We check the name of the node, and update the canvas node name
    * if it has changed (useful for non blocking dns resolving) */
   /*TODO why is it exactly that sometimes it is NULL? */
-  if (canvas_node->text_item)
+  if (canvas_node->text_item && strcmp (canvas_node->name, node->name->str))
     {
-      g_object_get (G_OBJECT (canvas_node->text_item), 
-                    "text", &nametmp,
-		    NULL);
-      if (strcmp (nametmp, node->name->str))
-	{
-	  gnome_canvas_item_set (canvas_node->text_item,
-				 "text", node->name->str, 
-                                 NULL);
-	  gnome_canvas_item_request_update (canvas_node->text_item);
-	}
-      g_free (nametmp);
+      g_free (canvas_node->name);
+      canvas_node->name = g_strdup (node->name->str);
+      gnome_canvas_item_set (canvas_node->text_item,
+                             "text", canvas_node->name, 
+                             NULL);
+      gnome_canvas_item_request_update (canvas_node->text_item);
     }
 
+  /* the node will be checked again at gui timeout */
+  if (pref.gui_node_timeout_time)
+    wheel_timer_set(canvas_nodes_wheel, &canvas_node->gui_timer, 
+                    &node->node_stats.stats.last_time, 
+                    pref.gui_node_timeout_time);
+  else
+    wheel_timer_cancel(canvas_nodes_wheel, &canvas_node->gui_timer);
+
   /* Processor time check. If too much time has passed, update the GUI */
   end = clock ();
   cpu_time_used = ((gdouble) (end - start)) / CLOCKS_PER_SEC;
@@ -823,100 +1084,131 @@ display_node (node_t * node)
   /* Remove canvas_node if node is too old */
   if (diffms >= pref.gui_node_timeout_time
       && pref.gui_node_timeout_time 
-      && !node->node_stats.pkt_list.length)
+      && !traffic_stats_active_packets(&node->node_stats))
     return FALSE;
 
 #if 1
-  if ((pref.gui_node_timeout_time == 1) && !node->node_stats.pkt_list.length)
+  if ((pref.gui_node_timeout_time == 1) && !traffic_stats_active_packets(&node->node_stats))
     g_my_critical ("Impossible situation in display node");
 #endif
 
   return TRUE;
 }				/* display_node */
 
-/* Sorts canvas nodes with the criterium set in preferences and sets
- * which will be displayed in the diagram */
-static void
-limit_nodes (void)
+/* true if a ranks before b. Ties go to the node already shown, then to
+ * the lowest node_id, so the order is total and stable across refreshes */
+static gboolean
+ranked_before (const ranked_node_t *a, const ranked_node_t *b)
 {
-  static GTree *ordered_nodes = NULL;
-  static guint limit;
-  displayed_nodes = 0;		/* We'll increment for each node we don't
-				 * limit */
+  if (a->rank != b->rank)
+    return a->rank > b->rank;
+  if (!a->canvas_node->shown != !b->canvas_node->shown)
+    return a->canvas_node->shown;
+  return node_id_compare (&a->canvas_node->canvas_node_id, 
+                          &b->canvas_node->canvas_node_id) < 0;
+}
 
-  if (appdata.node_limit < 0)
-    {
-      displayed_nodes = g_tree_nnodes (canvas_nodes);
-      return;
-    }
+#define SWAP_RANKED(v, i, j) \
+  do { ranked_node_t t_ = (v)[i]; (v)[i] = (v)[j]; (v)[j] = t_; } while (0)
 
-  limit = appdata.node_limit;
+/* quickselect: reorders v so that its first k items are the top k, in
+ * no particular order. k must be less than n */
+static void
+select_top_nodes (ranked_node_t *v, guint n, guint k)
+{
+  guint lo = 0;
+  guint hi = n - 1;
+  guint mid;
+  guint i;
+  guint store;
 
-  ordered_nodes = g_tree_new (traffic_compare);
+  while (lo < hi)
+    {
+      /* median of three as pivot, moved to hi */
+      mid = lo + (hi - lo) / 2;
+      if (ranked_before (&v[mid], &v[lo]))
+        SWAP_RANKED (v, lo, mid);
+      if (ranked_before (&v[hi], &v[lo]))
+        SWAP_RANKED (v, lo, hi);
+      if (ranked_before (&v[mid], &v[hi]))
+        SWAP_RANKED (v, mid, hi);
+
+      for (i = store = lo; i < hi; ++i)
+        if (ranked_before (&v[i], &v[hi]))
+          {
+            SWAP_RANKED (v, i, store);
+            store++;
+          }
+      SWAP_RANKED (v, store, hi);
 
-  g_tree_foreach(canvas_nodes, (GTraverseFunc) add_ordered_node, ordered_nodes);
-  g_tree_foreach(ordered_nodes, (GTraverseFunc) check_ordered_node,
-		   &limit);
-  g_tree_destroy (ordered_nodes);
-  ordered_nodes = NULL;
-}				/* limit_nodes */
+      if (store == k)
+        break;
+      if (k < store)
+        hi = store - 1;
+      else
+        lo = store + 1;
+    }
+}
 
 static gint
-add_ordered_node (node_id_t * node_id, canvas_node_t * node,
-		  GTree * ordered_nodes)
+add_ranked_node (node_id_t * node_id, canvas_node_t * canvas_node,
+                 GArray * ranked)
 {
-  g_tree_insert (ordered_nodes, node, node);
-  g_my_debug ("Adding ordered node. Number of nodes: %d",
-	      g_tree_nnodes (ordered_nodes));
-  return FALSE;			/* keep on traversing */
-}				/* add_ordered_node */
+  ranked_node_t item;
 
-static gint
-check_ordered_node (gdouble * traffic, canvas_node_t * node, guint * count)
-{
-  /* TODO We can probably optimize this by stopping the traversion once
-   * the limit has been reached */
-  if (*count)
-    {
-      if (!node->shown)
-	need_reposition = TRUE;
-      node->shown = TRUE;
-      displayed_nodes++;
-      (*count)--;
-    }
-  else
-    {
-      if (node->shown)
-	need_reposition = TRUE;
-      node->shown = FALSE;
-    }
+  item.canvas_node = canvas_node;
+  item.rank = canvas_node->traffic;
+  if (canvas_node->shown)
+    item.rank *= SHOWN_NODE_BONUS;
+  g_array_append_val (ranked, item);
   return FALSE;			/* keep on traversing */
-}				/* check_ordered_node */
+}				/* add_ranked_node */
 
-/* Comparison function used to order the (GTree *) nodes
- * and canvas_nodes heard on the network */
-static gint
-traffic_compare (gconstpointer a, gconstpointer b)
+/* Selects the canvas nodes with most traffic and sets which will be 
+ * displayed in the diagram. Shown nodes are ranked up to avoid 
+ * flapping, so a hidden node replaces them only with clearly more 
+ * traffic */
+static void
+limit_nodes (void)
 {
-  node_t *node_a, *node_b;
+  static GArray *ranked = NULL;
+  ranked_node_t *v;
+  guint limit;
+  guint i;
+  gboolean show;
 
-  g_assert (a != NULL);
-  g_assert (b != NULL);
-
-  node_a = (node_t *) a;
-  node_b = (node_t *) b;
+  if (appdata.node_limit < 0)
+    {
+      displayed_nodes = g_tree_nnodes (canvas_nodes);
+      return;
+    }
 
-  if (node_a->node_stats.stats.average < node_b->node_stats.stats.average)
-    return 1;
-  if (node_a->node_stats.stats.average > node_b->node_stats.stats.average)
-    return -1;
+  /* nothing changed since last selection */
+  if (!need_limit)
+    return;
+  need_limit = FALSE;
 
-  /* If two nodes have the same traffic, we still have
-   * to distinguish them somehow. We use the node_id */
+  if (!ranked)
+    ranked = g_array_new (FALSE, FALSE, sizeof (ranked_node_t));
+  g_array_set_size (ranked, 0);
+  g_tree_foreach(canvas_nodes, (GTraverseFunc) add_ranked_node, ranked);
 
-  return (node_id_compare (&node_a->node_id, &node_b->node_id));
+  v = (ranked_node_t *) ranked->data;
+  limit = appdata.node_limit;
+  if (limit < ranked->len)
+    select_top_nodes (v, ranked->len, limit);
+  else
+    limit = ranked->len;
+  displayed_nodes = limit;
 
-}				/* traffic_compare */
+  for (i = 0; i < ranked->len; ++i)
+    {
+      show = (i < limit);
+      if (!v[i].canvas_node->shown != !show)
+        need_reposition = TRUE;
+      v[i].canvas_node->shown = show;
+    }
+}				/* limit_nodes */
 
 
 /* initialize reposition struct */
@@ -964,6 +1256,27 @@ static gint reposition_canvas_nodes(node_id_t * node_id,
     {
       gnome_canvas_item_hide (canvas_node->node_item);
       gnome_canvas_item_hide (canvas_node->text_item);
+      if (canvas_node->layout_slot >= 0)
+        {
+          layout_node_remove (canvas_node->layout_slot);
+          canvas_node->layout_slot = -1;
+          canvas_node->is_new = TRUE;
+          layout_edges_changed = TRUE;
+        }
+      return FALSE;
+    }
+
+  if (appdata.force_layout)
+    {
+      /* the layout thread places the node, see move_canvas_node. 
+       * Until then new nodes stay hidden */
+      if (canvas_node->layout_slot < 0)
+        {
+          canvas_node->layout_slot = layout_node_add ();
+          layout_edges_changed = TRUE;
+        }
+      if (!canvas_node->is_new)
+        show_canvas_node (canvas_node);
       return FALSE;
     }
 
@@ -1044,6 +1357,63 @@ static gint reposition_canvas_nodes(node_id_t * node_id,
       canvas_node->is_new = FALSE;
     }
 
+  show_canvas_node (canvas_node);
+
+  data->node_i--;
+
+  if (data->node_i)
+    data->angle += 2 * M_PI / data->n_nodes;
+  else
+    {
+      data->angle = 0.0;
+      data->n_nodes = 0;
+    }
+
+  return FALSE;
+}
+
+/* moves a laid out node to its position in the layout snapshot, if it
+ * changed visibly. New nodes are shown once placed */
+static gint
+move_canvas_node(node_id_t * node_id, canvas_node_t * canvas_node,
+                 gpointer dummy)
+{
+  gdouble x, y;
+
+  if (!canvas_node->shown || canvas_node->layout_slot < 0 ||
+      !layout_get_position (canvas_node->layout_slot, &x, &y))
+    return FALSE;
+
+  if (canvas_node->is_new ||
+      fabs (x - canvas_node->x) >= MIN_SIZE_DELTA ||
+      fabs (y - canvas_node->y) >= MIN_SIZE_DELTA)
+    {
+      GArray *link_ids;
+      guint i;
+
+      canvas_node->x = x;
+      canvas_node->y = y;
+      gnome_canvas_item_set(GNOME_CANVAS_ITEM (canvas_node->group_item),
+                            "x", x, "y", y, NULL);
+
+      /* its links must follow */
+      link_ids = g_tree_lookup (node_canvas_links, node_id);
+      for (i = 0; link_ids && i < link_ids->len; ++i)
+        dirty_links_add(&g_array_index(link_ids, link_id_t, i));
+    }
+
+  if (canvas_node->is_new)
+    {
+      canvas_node->is_new = FALSE;
+      show_canvas_node (canvas_node);
+    }
+  return FALSE;
+}
+
+/* shows a positioned node, with the current text settings */
+static void
+show_canvas_node(canvas_node_t *canvas_node)
+{
   if (need_font_refresh)
     {
       /* We update the text font */
@@ -1065,18 +1435,6 @@ static gint reposition_canvas_nodes(node_id_t * node_id,
 
   gnome_canvas_item_show (canvas_node->node_item);
   gnome_canvas_item_request_update (canvas_node->node_item);
-
-  data->node_i--;
-
-  if (data->node_i)
-    data->angle += 2 * M_PI / data->n_nodes;
-  else
-    {
-      data->angle = 0.0;
-      data->n_nodes = 0;
-    }
-
-  return FALSE;
 }
 
 
@@ -1097,6 +1455,9 @@ check_new_link (link_id_t * link_id, link_t * link, GtkWidget * canvas)
       new_canvas_link = g_malloc (sizeof (canvas_link_t));
       g_assert(new_canvas_link);
       new_canvas_link->canvas_link_id = *link_id;
+      new_canvas_link->drawn = FALSE;
+      new_canvas_link->frame = 0;
+      wheel_timer_init(&new_canvas_link->fade_timer);
 
       /* We set the lines position using groups positions */
       points = gnome_canvas_points_new (3);
@@ -1118,6 +1479,8 @@ check_new_link (link_id_t * link_id, link_t * link, GtkWidget * canvas)
 
       g_tree_insert (canvas_links,
 		     &new_canvas_link->canvas_link_id, new_canvas_link);
+      node_links_add(&link_id->src, link_id);
+      node_links_add(&link_id->dst, link_id);
       gnome_canvas_item_lower_to_bottom (new_canvas_link->src_item);
       gnome_canvas_item_lower_to_bottom (new_canvas_link->dst_item);
 
@@ -1127,6 +1490,7 @@ check_new_link (link_id_t * link_id, link_t * link, GtkWidget * canvas)
 			(GtkSignalFunc) link_item_event, new_canvas_link);
       g_signal_connect (G_OBJECT (new_canvas_link->dst_item), "event",
 			(GtkSignalFunc) link_item_event, new_canvas_link);
+      layout_edges_changed = TRUE;
 
     }
 
@@ -1136,7 +1500,8 @@ check_new_link (link_id_t * link_id, link_t * link, GtkWidget * canvas)
 
 /* - calls update_links, so that the related link updates its average
  *   traffic and main protocol, and old links are deleted
- * - caculates link size and color fading */
+ * - caculates link size and color fading 
+ * Canvas items are changed only if the change is visible */
 static gint
 canvas_link_update(link_id_t * link_id, canvas_link_t * canvas_link,
 		     GList **delete_list)
@@ -1146,6 +1511,12 @@ canvas_link_update(link_id_t * link_id, canvas_link_t * canvas_link,
   const canvas_node_t *canvas_src;
   guint32 scaledColor;
   double xs, ys, xd, yd, scale;
+  gdouble src_size, dst_size;
+
+  /* already updated during this refresh */
+  if (canvas_link->frame == refresh_frame)
+    return FALSE;
+  canvas_link->frame = refresh_frame;
 
   /* We used to run update_link here, but that was a major performance penalty, 
    * and now it is done in update_diagram */
@@ -1162,19 +1533,14 @@ canvas_link_update(link_id_t * link_id, canvas_link_t * canvas_link,
 
   /* We get coords for the destination node */
   canvas_dst = g_tree_lookup (canvas_nodes, &link_id->dst);
-  if (!canvas_dst || !canvas_dst->shown)
-    {
-      gnome_canvas_item_hide (canvas_link->src_item);
-      gnome_canvas_item_hide (canvas_link->dst_item);
-      return FALSE;
-    }
-
-  /* We get coords from source node */
   canvas_src = g_tree_lookup (canvas_nodes, &link_id->src);
-  if (!canvas_src || !canvas_src->shown)
+  if (!canvas_dst || !canvas_dst->shown || !canvas_src || !canvas_src->shown)
     {
+      /* hidden links are drawn again when their nodes are repositioned */
       gnome_canvas_item_hide (canvas_link->src_item);
       gnome_canvas_item_hide (canvas_link->dst_item);
+      canvas_link->drawn = FALSE;
+      wheel_timer_cancel(canvas_links_wheel, &canvas_link->fade_timer);
       return FALSE;
     }
 
@@ -1183,7 +1549,8 @@ canvas_link_update(link_id_t * link_id, canvas_link_t * canvas_link,
   if (link->main_prot[pref.stack_level])
     {
       double diffms;
-      canvas_link->color = protohash_color(link->main_prot[pref.stack_level]);
+      canvas_link->color = 
+        protohash_color(proto_atom_name(link->main_prot[pref.stack_level]));
 
       /* scale color down to 10% at link timeout */
       diffms = substract_times_ms(&appdata.now, &link->link_stats.stats.last_time);
@@ -1200,36 +1567,70 @@ canvas_link_update(link_id_t * link_id, canvas_link_t * canvas_link,
       scaledColor = black;
     }
 
+  /* a fading link is updated at each refresh, until it's black */
+  if (scaledColor != 0x000000ff)
+    wheel_timer_set(canvas_links_wheel, &canvas_link->fade_timer, 
+                    &appdata.now, 0);
+  else
+    wheel_timer_cancel(canvas_links_wheel, &canvas_link->fade_timer);
+
   /* retrieve coordinates of node centers */
   g_object_get (G_OBJECT (canvas_src->group_item), "x", &xs, "y", &ys, NULL);
   g_object_get (G_OBJECT (canvas_dst->group_item), "x", &xd, "y", &yd, NULL);
 
+  src_size = get_oneside_link_size(&(link->link_stats.stats_out));
+  dst_size = get_oneside_link_size(&(link->link_stats.stats_in));
+
+  if (canvas_link->drawn && 
+      canvas_link->xs == xs && canvas_link->ys == ys &&
+      canvas_link->xd == xd && canvas_link->yd == yd &&
+      fabs (src_size - canvas_link->src_size) < MIN_SIZE_DELTA &&
+      fabs (dst_size - canvas_link->dst_size) < MIN_SIZE_DELTA &&
+      canvas_link->scaled_color == scaledColor)
+    return FALSE; /* no visible change */
+
+  canvas_link->drawn = TRUE;
+  canvas_link->xs = xs;
+  canvas_link->ys = ys;
+  canvas_link->xd = xd;
+  canvas_link->yd = yd;
+  canvas_link->src_size = src_size;
+  canvas_link->dst_size = dst_size;
+  canvas_link->scaled_color = scaledColor;
+
   /* first draw triangle for src->dst */
-  draw_oneside_link(xs, ys, xd, yd, &(link->link_stats.stats_out), scaledColor, 
+  draw_oneside_link(xs, ys, xd, yd, src_size, scaledColor, 
                     canvas_link->src_item);
 
   /* then draw triangle for dst->src */
-  draw_oneside_link(xd, yd, xs, ys, &(link->link_stats.stats_in), scaledColor, 
+  draw_oneside_link(xd, yd, xs, ys, dst_size, scaledColor, 
                     canvas_link->dst_item);
 
   return FALSE;
 
 }				/* update_canvas_links */
 
-/* given the src and dst node centers, plus a size, draws a triangle in the 
- * specified color on the provided canvas item*/
-static void draw_oneside_link(double xs, double ys, double xd, double yd,
-                              const basic_stats_t *link_stats, 
-                              guint32 scaledColor, GnomeCanvasItem *item)
+/* returns the half width of the base of a link triangle */
+static gdouble get_oneside_link_size(const basic_stats_t *link_stats)
 {
-  GnomeCanvasPoints *points;
-  gdouble versorx, versory, modulus, link_size;
+  gdouble link_size;
 
   link_size = get_link_size(link_stats) / 2;
 
   /* limit the maximum size to avoid overload */
   if (link_size > MAX_LINK_SIZE)
     link_size = MAX_LINK_SIZE; 
+  return link_size;
+}
+
+/* given the src and dst node centers, plus a size, draws a triangle in the 
+ * specified color on the provided canvas item*/
+static void draw_oneside_link(double xs, double ys, double xd, double yd,
+                              gdouble link_size, 
+                              guint32 scaledColor, GnomeCanvasItem *item)
+{
+  GnomeCanvasPoints *points;
+  gdouble versorx, versory, modulus;
 
   versorx = -(yd - ys);
   versory = xd - xs;
@@ -1348,7 +1749,7 @@ link_item_event (GnomeCanvasItem * item, GdkEvent * event,
         link = links_catalog_find(&canvas_link->canvas_link_id);
       if (link && link->main_prot[pref.stack_level])
 	str = g_strdup_printf (_("Link main protocol: %s"),
-			   link->main_prot[pref.stack_level]);
+			   proto_atom_name(link->main_prot[pref.stack_level]));
       else
 	str = g_strdup_printf (_("Link main protocol unknown"));
       gtk_statusbar_push(appdata.statusbar, 1, str);
@@ -1457,7 +1858,58 @@ canvas_link_delete(canvas_link_t *canvas_link)
       canvas_link->dst_item = NULL;
     }
 
+  wheel_timer_cancel(canvas_links_wheel, &canvas_link->fade_timer);
+  node_links_remove(&canvas_link->canvas_link_id.src, 
+                    &canvas_link->canvas_link_id);
+  node_links_remove(&canvas_link->canvas_link_id.dst, 
+                    &canvas_link->canvas_link_id);
   g_free (canvas_link);
+  layout_edges_changed = TRUE;
+}
+
+/* adds link_id to the canvas links of the node */
+static void
+node_links_add(const node_id_t *node_id, const link_id_t *link_id)
+{
+  GArray *link_ids;
+  node_id_t *key;
+
+  link_ids = g_tree_lookup (node_canvas_links, node_id);
+  if (!link_ids)
+    {
+      key = g_malloc (sizeof (node_id_t));
+      *key = *node_id;
+      link_ids = g_array_new (FALSE, FALSE, sizeof (link_id_t));
+      g_tree_insert (node_canvas_links, key, link_ids);
+    }
+  g_array_append_val (link_ids, *link_id);
+}
+
+/* removes link_id from the canvas links of the node, forgetting nodes
+ * left without links */
+static void
+node_links_remove(const node_id_t *node_id, const link_id_t *link_id)
+{
+  GArray *link_ids;
+  guint i;
+
+  link_ids = g_tree_lookup (node_canvas_links, node_id);
+  if (!link_ids)
+    return;
+  for (i = 0; i < link_ids->len; ++i)
+    if (!link_id_compare(&g_array_index(link_ids, link_id_t, i), link_id))
+      {
+        g_array_remove_index_fast (link_ids, i);
+        break;
+      }
+  if (!link_ids->len)
+    g_tree_remove (node_canvas_links, node_id);
+}
+
+static void
+node_links_free(GArray *link_ids)
+{
+  g_array_free (link_ids, TRUE);
 }
 
 void timeout_changed(void)
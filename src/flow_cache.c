@@ -0,0 +1,253 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include "appdata.h"
+#include "util.h"
+#include "flow_cache.h"
+
+#define FLOW_CACHE_SIZE 4096    /* max flows */
+#define FLOW_REVALIDATE_HITS 256 /* hits before a flow is decoded again */
+#define FLOW_LOG_INTERVAL 100000 /* lookups between counter logs */
+
+typedef struct flow_entry_tag
+{
+  flow_key_t key;
+  flow_decode_t decode;
+  guint hits;                   /* since the last full decode */
+  struct flow_entry_tag *prev;  /* LRU list, most recent first */
+  struct flow_entry_tag *next;
+}
+flow_entry_t;
+
+static GHashTable *flows = NULL;        /* flow_entry_t, keyed by its key */
+static flow_entry_t *entries = NULL;    /* FLOW_CACHE_SIZE preallocated */
+static flow_entry_t *free_entries = NULL; /* unused entries, via next */
+static flow_entry_t *lru_head = NULL;   /* most recently used */
+static flow_entry_t *lru_tail = NULL;   /* least recently used */
+
+/* counters */
+static gulong n_hits = 0;
+static gulong n_misses = 0;
+static gulong n_evictions = 0;
+
+static guint flow_key_hash(gconstpointer key)
+{
+  const guint8 *p = key;
+  guint h = 2166136261U;
+  guint i;
+
+  for (i = 0; i < sizeof(flow_key_t); ++i)
+    {
+      h ^= p[i];
+      h *= 16777619U;
+    }
+  return h;
+}
+
+static gboolean flow_key_equal(gconstpointer a, gconstpointer b)
+{
+  return !memcmp(a, b, sizeof(flow_key_t));
+}
+
+static void log_counters(void)
+{
+  g_my_debug("Flow cache: %lu hits, %lu misses, %lu evictions, %u flows",
+             n_hits, n_misses, n_evictions, 
+             flows ? g_hash_table_size(flows) : 0);
+}
+
+/***************************************************************************
+ *
+ * LRU list
+ *
+ **************************************************************************/
+static void lru_unlink(flow_entry_t *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    lru_head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    lru_tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(flow_entry_t *entry)
+{
+  entry->prev = NULL;
+  entry->next = lru_head;
+  if (lru_head)
+    lru_head->prev = entry;
+  else
+    lru_tail = entry;
+  lru_head = entry;
+}
+
+static void flow_entry_remove(flow_entry_t *entry)
+{
+  guint i;
+
+  for (i = 0; i < entry->decode.n_protos; ++i)
+    proto_atom_unref(entry->decode.protos[i]);
+  g_hash_table_remove(flows, &entry->key);
+  lru_unlink(entry);
+  entry->next = free_entries;
+  free_entries = entry;
+}
+
+static void flow_cache_init(void)
+{
+  guint i;
+
+  flows = g_hash_table_new(flow_key_hash, flow_key_equal);
+  entries = g_malloc(FLOW_CACHE_SIZE * sizeof(flow_entry_t));
+  free_entries = NULL;
+  for (i = 0; i < FLOW_CACHE_SIZE; ++i)
+    {
+      entries[i].next = free_entries;
+      free_entries = entries + i;
+    }
+  lru_head = lru_tail = NULL;
+}
+
+/***************************************************************************
+ *
+ * public interface
+ *
+ **************************************************************************/
+const flow_decode_t *flow_cache_find(const flow_key_t *key)
+{
+  flow_entry_t *entry;
+
+  if (flows && (n_hits + n_misses) % FLOW_LOG_INTERVAL == 0 && 
+      n_hits + n_misses)
+    log_counters();
+
+  entry = flows ? g_hash_table_lookup(flows, key) : NULL;
+  if (!entry || ++entry->hits > FLOW_REVALIDATE_HITS)
+    {
+      /* stale flows are decoded again, and replaced */
+      if (entry)
+        flow_entry_remove(entry);
+      n_misses++;
+      return NULL;
+    }
+
+  if (entry != lru_head)
+    {
+      lru_unlink(entry);
+      lru_push_front(entry);
+    }
+  n_hits++;
+  return &entry->decode;
+}
+
+void flow_cache_add(const flow_key_t *key, const flow_decode_t *decode)
+{
+  flow_entry_t *entry;
+  guint i;
+
+  if (!flows)
+    flow_cache_init();
+
+  entry = g_hash_table_lookup(flows, key);
+  if (entry)
+    flow_entry_remove(entry);
+
+  if (!free_entries)
+    {
+      /* full, evicts the least recently used flow */
+      flow_entry_remove(lru_tail);
+      n_evictions++;
+    }
+
+  entry = free_entries;
+  free_entries = entry->next;
+
+  entry->key = *key;
+  entry->decode = *decode;
+  for (i = 0; i < decode->n_protos; ++i)
+    proto_atom_ref(decode->protos[i]);
+  entry->hits = 0;
+  lru_push_front(entry);
+  g_hash_table_insert(flows, &entry->key, entry);
+}
+
+void flow_cache_invalidate(void)
+{
+  while (lru_head)
+    flow_entry_remove(lru_head);
+}
+
+/* true if the flow has an endpoint at addr and port, the other at peer */
+static gboolean flow_has_endpoint(const flow_key_t *key, 
+                                  const address_t *addr, guint16 port,
+                                  const address_t *peer)
+{
+  return (is_addr_eq(&key->src_address, addr) && 
+          (!port || key->src_port == port) &&
+          (!peer || is_addr_eq(&key->dst_address, peer))) ||
+         (is_addr_eq(&key->dst_address, addr) && 
+          (!port || key->dst_port == port) &&
+          (!peer || is_addr_eq(&key->src_address, peer)));
+}
+
+void flow_cache_invalidate_endpoint(const address_t *addr, guint16 port,
+                                    const address_t *peer)
+{
+  flow_entry_t *entry;
+  flow_entry_t *next;
+  guint removed = 0;
+
+  for (entry = lru_head; entry; entry = next)
+    {
+      next = entry->next;
+      if (flow_has_endpoint(&entry->key, addr, port, peer))
+        {
+          flow_entry_remove(entry);
+          removed++;
+        }
+    }
+  if (removed)
+    g_my_debug("Flow cache: %u flows of %s:%u invalidated", removed, 
+               address_to_str(addr), port);
+}
+
+void flow_cache_clear(void)
+{
+  if (!flows)
+    return;
+
+  log_counters();
+  flow_cache_invalidate(); /* releases the atoms */
+  g_hash_table_destroy(flows);
+  g_free(entries);
+  flows = NULL;
+  entries = NULL;
+  free_entries = NULL;
+  lru_head = lru_tail = NULL;
+  n_hits = n_misses = n_evictions = 0;
+}
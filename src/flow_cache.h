@@ -0,0 +1,72 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef FLOW_CACHE_H
+#define FLOW_CACHE_H
+
+#include "pkt_info.h"
+#include "node_id.h"
+
+/* Memoized decode of tcp/udp flows.
+ * Packets of a flow whose protocols depend only on addresses and ports
+ * reuse the protocol stack found for the first packet, instead of being
+ * decoded again above the IP level. The cache is bounded, evicting the 
+ * least recently used flow, and each flow is decoded again from time to 
+ * time, to revalidate it */
+
+/* a flow. Must be cleared with memset before filling, since it is hashed
+ * and compared as raw bytes */
+typedef struct
+{
+  address_t src_address;
+  address_t dst_address;
+  guint16 src_port;
+  guint16 dst_port;
+  guint8 ip_proto;              /* tcp or udp */
+}
+flow_key_t;
+
+/* the result of decoding a flow */
+typedef struct
+{
+  guint start_level;            /* first level of protos */
+  guint n_protos;               /* levels decoded */
+  proto_atom_t protos[STACK_SIZE + 1];
+  apemode_t mode;               /* ape mode of node ids */
+  gboolean group_unk;           /* pref.group_unk, for unknown ports */
+  node_id_t src_node_id;
+  node_id_t dst_node_id;
+}
+flow_decode_t;
+
+/* returns the cached decode of key, NULL if missing or to revalidate */
+const flow_decode_t *flow_cache_find(const flow_key_t *key);
+/* adds or replaces the decode of key */
+void flow_cache_add(const flow_key_t *key, const flow_decode_t *decode);
+/* forgets every flow, e.g. when the rules to decode them change */
+void flow_cache_invalidate(void);
+/* forgets the flows with an endpoint at addr and port (any port if 0), 
+ * and the other at peer (any address if NULL), e.g. when a conversation 
+ * is added on them */
+void flow_cache_invalidate_endpoint(const address_t *addr, guint16 port,
+                                    const address_t *peer);
+/* frees the cache, logging its counters */
+void flow_cache_clear(void);
+
+#endif
@@ -0,0 +1,409 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include "common.h"
+#include "hdr_batch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HDR_BATCH_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* minimum frame captured: ethernet header, ip header without options */
+#define MIN_FRAME_LEN (14 + 20)
+/* the SIMD versions load 16 bytes from the ethertype and 16 from the ip 
+ * source address, so a group of frames is loaded only if all are at 
+ * least this long */
+#define SIMD_FRAME_LEN (14 + 12 + 16)
+
+#define ETHERTYPE_IP_NUM 0x0800
+#define IP_PROTO_TCP_NUM 6
+#define IP_PROTO_UDP_NUM 17
+
+typedef void (*extract_fun)(hdr_batch_t *batch, guint n, 
+                            const guint8 *const *frames, 
+                            const guint *caplens);
+
+static void extract_scalar(hdr_batch_t *batch, guint n, 
+                           const guint8 *const *frames, const guint *caplens);
+
+static extract_fun extractor = extract_scalar;
+static const gchar *extractor_name = "scalar";
+
+/* ports of frame i, if fast and captured */
+static inline void get_ports(hdr_batch_t *batch, guint i, 
+                             const guint8 *f, guint caplen)
+{
+  guint l4 = 14 + batch->ip_hl[i];
+
+  batch->has_ports[i] = batch->fast[i] && caplen >= l4 + 4;
+  if (batch->has_ports[i])
+    {
+      batch->src_port[i] = pntohs (f + l4);
+      batch->dst_port[i] = pntohs (f + l4 + 2);
+    }
+}
+
+static void extract_one(hdr_batch_t *batch, guint i, 
+                        const guint8 *f, guint caplen)
+{
+  guint ip_hl;
+
+  batch->fast[i] = FALSE;
+  batch->has_ports[i] = FALSE;
+  if (caplen < MIN_FRAME_LEN)
+    {
+      batch->ethertype[i] = caplen >= 14 ? pntohs (f + 12) : 0;
+      return;
+    }
+
+  batch->ethertype[i] = pntohs (f + 12);
+  batch->ip_version[i] = f[14] >> 4;
+  ip_hl = (f[14] & 15) << 2;
+  batch->ip_hl[i] = ip_hl;
+  batch->ip_proto[i] = f[14 + 9];
+  memcpy(batch->src_addr + i, f + 14 + 12, sizeof(guint32));
+  memcpy(batch->dst_addr + i, f + 14 + 16, sizeof(guint32));
+
+  batch->fast[i] = batch->ethertype[i] == ETHERTYPE_IP_NUM &&
+    batch->ip_version[i] == 4 && ip_hl >= 20 && caplen >= 14 + ip_hl &&
+    !(pntohs (f + 14 + 6) & 0x0fff) &&          /* fragment offset */
+    (batch->ip_proto[i] == IP_PROTO_TCP_NUM || 
+     batch->ip_proto[i] == IP_PROTO_UDP_NUM);
+  get_ports(batch, i, f, caplen);
+}
+
+static void extract_scalar(hdr_batch_t *batch, guint n, 
+                           const guint8 *const *frames, const guint *caplens)
+{
+  guint i;
+
+  for (i = 0; i < n; ++i)
+    extract_one(batch, i, frames[i], caplens[i]);
+}
+
+#ifdef HDR_BATCH_SIMD
+/* true if all w frames from caplens can be loaded by the SIMD versions */
+static inline gboolean group_loadable(const guint *caplens, guint w)
+{
+  guint k;
+
+  for (k = 0; k < w; ++k)
+    if (caplens[k] < SIMD_FRAME_LEN)
+      return FALSE;
+  return TRUE;
+}
+
+/* sets the fast flags of frames i to i+w-1 from the bits of mask. 
+ * Vector ports were loaded right after a 20 bytes ip header, the frames
+ * with ip options take them again */
+static inline void finish_group(hdr_batch_t *batch, guint i, guint w, 
+                                guint mask, const guint8 *const *frames, 
+                                const guint *caplens)
+{
+  guint k;
+
+  for (k = 0; k < w; ++k, ++i)
+    {
+      batch->fast[i] = (mask >> k) & 1;
+      if (batch->ip_hl[i] == 20)
+        batch->has_ports[i] = batch->fast[i];
+      else
+        get_ports(batch, i, frames[i], caplens[i]);
+    }
+}
+
+/* Four frames at a time. Per 32 bit lane, the first load has ethertype,
+ * ip version and length, tos in word 0 and fragment, ttl, protocol in 
+ * word 2; the second load has source, destination and ports. After the
+ * transpose, each vector holds a word of the four frames */
+__attribute__((target("sse4.1")))
+static void extract_sse41(hdr_batch_t *batch, guint n, 
+                          const guint8 *const *frames, const guint *caplens)
+{
+  const __m128i et_mask = _mm_set1_epi32(0x00f0ffff);
+  const __m128i et_want = _mm_set1_epi32(0x00400008); /* 0x0800, v4 */
+  const __m128i frag_mask = _mm_set1_epi32(0x0000ff0f);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  const __m128i swap_lo = _mm_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12, 
+                                        -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i swap_hi = _mm_setr_epi8(3, 2, 7, 6, 11, 10, 15, 14, 
+                                        -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i byte2 = _mm_setr_epi8(2, 6, 10, 14, -1, -1, -1, -1, 
+                                      -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i byte3 = _mm_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, 
+                                      -1, -1, -1, -1, -1, -1, -1, -1);
+  guint i;
+  guint k;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      const guint8 *const *f = frames + i;
+      __m128i a0, a1, a2, a3, b0, b1, b2, b3, t0, t1, t2, t3;
+      __m128i w_et, w_frag, w_src, w_dst, w_ports;
+      __m128i caplen, ihl, need, proto, ver_hl, fast;
+      guint32 bytes;
+
+      if (!group_loadable(caplens + i, 4))
+        {
+          for (k = i; k < i + 4; ++k)
+            extract_one(batch, k, frames[k], caplens[k]);
+          continue;
+        }
+
+      a0 = _mm_loadu_si128((const __m128i *)(f[0] + 12));
+      a1 = _mm_loadu_si128((const __m128i *)(f[1] + 12));
+      a2 = _mm_loadu_si128((const __m128i *)(f[2] + 12));
+      a3 = _mm_loadu_si128((const __m128i *)(f[3] + 12));
+      b0 = _mm_loadu_si128((const __m128i *)(f[0] + 26));
+      b1 = _mm_loadu_si128((const __m128i *)(f[1] + 26));
+      b2 = _mm_loadu_si128((const __m128i *)(f[2] + 26));
+      b3 = _mm_loadu_si128((const __m128i *)(f[3] + 26));
+
+      t0 = _mm_unpacklo_epi32(a0, a1);
+      t1 = _mm_unpacklo_epi32(a2, a3);
+      t2 = _mm_unpackhi_epi32(a0, a1);
+      t3 = _mm_unpackhi_epi32(a2, a3);
+      w_et = _mm_unpacklo_epi64(t0, t1);
+      w_frag = _mm_unpacklo_epi64(t2, t3);
+      t0 = _mm_unpacklo_epi32(b0, b1);
+      t1 = _mm_unpacklo_epi32(b2, b3);
+      t2 = _mm_unpackhi_epi32(b0, b1);
+      t3 = _mm_unpackhi_epi32(b2, b3);
+      w_src = _mm_unpacklo_epi64(t0, t1);
+      w_dst = _mm_unpackhi_epi64(t0, t1);
+      w_ports = _mm_unpacklo_epi64(t2, t3);
+
+      /* checks */
+      caplen = _mm_loadu_si128((const __m128i *)(caplens + i));
+      ihl = _mm_and_si128(_mm_srli_epi32(w_et, 16), _mm_set1_epi32(0x0f));
+      need = _mm_add_epi32(_mm_slli_epi32(ihl, 2), _mm_set1_epi32(14));
+      proto = _mm_srli_epi32(w_frag, 24);
+      fast = _mm_cmpeq_epi32(_mm_and_si128(w_et, et_mask), et_want);
+      fast = _mm_and_si128(fast, _mm_cmpgt_epi32(ihl, _mm_set1_epi32(4)));
+      fast = _mm_and_si128(fast, _mm_cmpeq_epi32(_mm_max_epu32(caplen, need),
+                                                 caplen));
+      fast = _mm_and_si128(fast, _mm_cmpeq_epi32(_mm_and_si128(w_frag, 
+                                                               frag_mask),
+                                                 _mm_setzero_si128()));
+      fast = _mm_and_si128(fast, 
+               _mm_or_si128(_mm_cmpeq_epi32(proto, 
+                                            _mm_set1_epi32(IP_PROTO_TCP_NUM)),
+                            _mm_cmpeq_epi32(proto, 
+                                            _mm_set1_epi32(IP_PROTO_UDP_NUM))));
+
+      /* stores the fields */
+      _mm_storel_epi64((__m128i *)(batch->ethertype + i), 
+                       _mm_shuffle_epi8(w_et, swap_lo));
+      ver_hl = _mm_shuffle_epi8(w_et, byte2);
+      bytes = _mm_cvtsi128_si32(_mm_and_si128(_mm_srli_epi16(ver_hl, 4), 
+                                              nibble));
+      memcpy(batch->ip_version + i, &bytes, sizeof(bytes));
+      bytes = _mm_cvtsi128_si32(_mm_slli_epi16(_mm_and_si128(ver_hl, nibble),
+                                               2));
+      memcpy(batch->ip_hl + i, &bytes, sizeof(bytes));
+      bytes = _mm_cvtsi128_si32(_mm_shuffle_epi8(w_frag, byte3));
+      memcpy(batch->ip_proto + i, &bytes, sizeof(bytes));
+      _mm_storeu_si128((__m128i *)(batch->src_addr + i), w_src);
+      _mm_storeu_si128((__m128i *)(batch->dst_addr + i), w_dst);
+      _mm_storel_epi64((__m128i *)(batch->src_port + i), 
+                       _mm_shuffle_epi8(w_ports, swap_lo));
+      _mm_storel_epi64((__m128i *)(batch->dst_port + i), 
+                       _mm_shuffle_epi8(w_ports, swap_hi));
+
+      finish_group(batch, i, 4, _mm_movemask_ps(_mm_castsi128_ps(fast)), 
+                   frames, caplens);
+    }
+
+  for ( ; i < n; ++i)
+    extract_one(batch, i, frames[i], caplens[i]);
+}
+
+/* loads 16 bytes from p in the low lane and from q in the high one */
+#define LOAD_LANES(p, q) \
+  _mm256_inserti128_si256(_mm256_castsi128_si256( \
+    _mm_loadu_si128((const __m128i *)(p))), \
+    _mm_loadu_si128((const __m128i *)(q)), 1)
+
+/* As extract_sse41, eight frames at a time: frames 0-3 are in the low 
+ * 128 bit lane and 4-7 in the high one, and each lane is transposed as 
+ * in the SSE4.1 version */
+__attribute__((target("avx2")))
+static void extract_avx2(hdr_batch_t *batch, guint n, 
+                         const guint8 *const *frames, const guint *caplens)
+{
+  const __m256i et_mask = _mm256_set1_epi32(0x00f0ffff);
+  const __m256i et_want = _mm256_set1_epi32(0x00400008); /* 0x0800, v4 */
+  const __m256i frag_mask = _mm256_set1_epi32(0x0000ff0f);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i swap_lo = _mm256_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12, 
+                                           -1, -1, -1, -1, -1, -1, -1, -1,
+                                           1, 0, 5, 4, 9, 8, 13, 12, 
+                                           -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i swap_hi = _mm256_setr_epi8(3, 2, 7, 6, 11, 10, 15, 14, 
+                                           -1, -1, -1, -1, -1, -1, -1, -1,
+                                           3, 2, 7, 6, 11, 10, 15, 14, 
+                                           -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i byte2 = _mm256_setr_epi8(2, 6, 10, 14, -1, -1, -1, -1, 
+                                         -1, -1, -1, -1, -1, -1, -1, -1,
+                                         2, 6, 10, 14, -1, -1, -1, -1, 
+                                         -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i byte3 = _mm256_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, 
+                                         -1, -1, -1, -1, -1, -1, -1, -1,
+                                         3, 7, 11, 15, -1, -1, -1, -1, 
+                                         -1, -1, -1, -1, -1, -1, -1, -1);
+  /* gathers the low dword, or qword, of both lanes */
+  const __m256i dwords = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  guint i;
+  guint k;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    {
+      const guint8 *const *f = frames + i;
+      __m256i a0, a1, a2, a3, b0, b1, b2, b3, t0, t1, t2, t3;
+      __m256i w_et, w_frag, w_src, w_dst, w_ports;
+      __m256i caplen, ihl, need, proto, ver_hl, fast;
+
+      if (!group_loadable(caplens + i, 8))
+        {
+          for (k = i; k < i + 8; ++k)
+            extract_one(batch, k, frames[k], caplens[k]);
+          continue;
+        }
+
+      a0 = LOAD_LANES(f[0] + 12, f[4] + 12);
+      a1 = LOAD_LANES(f[1] + 12, f[5] + 12);
+      a2 = LOAD_LANES(f[2] + 12, f[6] + 12);
+      a3 = LOAD_LANES(f[3] + 12, f[7] + 12);
+      b0 = LOAD_LANES(f[0] + 26, f[4] + 26);
+      b1 = LOAD_LANES(f[1] + 26, f[5] + 26);
+      b2 = LOAD_LANES(f[2] + 26, f[6] + 26);
+      b3 = LOAD_LANES(f[3] + 26, f[7] + 26);
+
+      t0 = _mm256_unpacklo_epi32(a0, a1);
+      t1 = _mm256_unpacklo_epi32(a2, a3);
+      t2 = _mm256_unpackhi_epi32(a0, a1);
+      t3 = _mm256_unpackhi_epi32(a2, a3);
+      w_et = _mm256_unpacklo_epi64(t0, t1);
+      w_frag = _mm256_unpacklo_epi64(t2, t3);
+      t0 = _mm256_unpacklo_epi32(b0, b1);
+      t1 = _mm256_unpacklo_epi32(b2, b3);
+      t2 = _mm256_unpackhi_epi32(b0, b1);
+      t3 = _mm256_unpackhi_epi32(b2, b3);
+      w_src = _mm256_unpacklo_epi64(t0, t1);
+      w_dst = _mm256_unpackhi_epi64(t0, t1);
+      w_ports = _mm256_unpacklo_epi64(t2, t3);
+
+      /* checks */
+      caplen = _mm256_loadu_si256((const __m256i *)(caplens + i));
+      ihl = _mm256_and_si256(_mm256_srli_epi32(w_et, 16), 
+                             _mm256_set1_epi32(0x0f));
+      need = _mm256_add_epi32(_mm256_slli_epi32(ihl, 2), 
+                              _mm256_set1_epi32(14));
+      proto = _mm256_srli_epi32(w_frag, 24);
+      fast = _mm256_cmpeq_epi32(_mm256_and_si256(w_et, et_mask), et_want);
+      fast = _mm256_and_si256(fast, 
+                              _mm256_cmpgt_epi32(ihl, _mm256_set1_epi32(4)));
+      fast = _mm256_and_si256(fast, 
+               _mm256_cmpeq_epi32(_mm256_max_epu32(caplen, need), caplen));
+      fast = _mm256_and_si256(fast, 
+               _mm256_cmpeq_epi32(_mm256_and_si256(w_frag, frag_mask),
+                                  _mm256_setzero_si256()));
+      fast = _mm256_and_si256(fast, 
+               _mm256_or_si256(_mm256_cmpeq_epi32(proto, 
+                                 _mm256_set1_epi32(IP_PROTO_TCP_NUM)),
+                               _mm256_cmpeq_epi32(proto, 
+                                 _mm256_set1_epi32(IP_PROTO_UDP_NUM))));
+
+      /* stores the fields, joining the results of the two lanes */
+      _mm_storeu_si128((__m128i *)(batch->ethertype + i), 
+                       _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+                         _mm256_shuffle_epi8(w_et, swap_lo), 
+                         _MM_SHUFFLE(3, 1, 2, 0))));
+      ver_hl = _mm256_shuffle_epi8(w_et, byte2);
+      _mm_storel_epi64((__m128i *)(batch->ip_version + i),
+                       _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                         _mm256_and_si256(_mm256_srli_epi16(ver_hl, 4), 
+                                          nibble), dwords)));
+      _mm_storel_epi64((__m128i *)(batch->ip_hl + i),
+                       _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                         _mm256_slli_epi16(_mm256_and_si256(ver_hl, nibble), 
+                                           2), dwords)));
+      _mm_storel_epi64((__m128i *)(batch->ip_proto + i),
+                       _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                         _mm256_shuffle_epi8(w_frag, byte3), dwords)));
+      _mm256_storeu_si256((__m256i *)(batch->src_addr + i), w_src);
+      _mm256_storeu_si256((__m256i *)(batch->dst_addr + i), w_dst);
+      _mm_storeu_si128((__m128i *)(batch->src_port + i), 
+                       _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+                         _mm256_shuffle_epi8(w_ports, swap_lo), 
+                         _MM_SHUFFLE(3, 1, 2, 0))));
+      _mm_storeu_si128((__m128i *)(batch->dst_port + i), 
+                       _mm256_castsi256_si128(_mm256_permute4x64_epi64(
+                         _mm256_shuffle_epi8(w_ports, swap_hi), 
+                         _MM_SHUFFLE(3, 1, 2, 0))));
+
+      finish_group(batch, i, 8, 
+                   _mm256_movemask_ps(_mm256_castsi256_ps(fast)), 
+                   frames, caplens);
+    }
+
+  for ( ; i < n; ++i)
+    extract_one(batch, i, frames[i], caplens[i]);
+}
+#endif
+
+void hdr_batch_init(gboolean scalar)
+{
+  extractor = extract_scalar;
+  extractor_name = "scalar";
+#ifdef HDR_BATCH_SIMD
+  __builtin_cpu_init();
+  if (!scalar && __builtin_cpu_supports("avx2"))
+    {
+      extractor = extract_avx2;
+      extractor_name = "avx2";
+    }
+  else if (!scalar && __builtin_cpu_supports("sse4.1"))
+    {
+      extractor = extract_sse41;
+      extractor_name = "sse4.1";
+    }
+#endif
+  g_my_info("Header pre-pass: %s", extractor_name);
+}
+
+const gchar *hdr_batch_impl(void)
+{
+  return extractor_name;
+}
+
+void hdr_batch_extract(hdr_batch_t *batch, guint n, 
+                       const guint8 *const *frames, const guint *caplens)
+{
+  g_assert(n <= HDR_BATCH_MAX);
+  batch->n = n;
+  extractor(batch, n, frames, caplens);
+}
@@ -0,0 +1,64 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef HDR_BATCH_H
+#define HDR_BATCH_H
+
+#include <glib.h>
+
+/* Header pre-pass for packet bursts.
+ * Before decoding a burst of ethernet frames, the Ethernet II and IPv4 
+ * header fields and the tcp/udp ports of the whole burst are extracted at
+ * once, into a structure of arrays. With SSE4.1 or AVX2 available at 
+ * runtime, the headers of 4 or 8 frames at a time are loaded, transposed 
+ * to one vector per field and checked together, otherwise a scalar 
+ * version is used. The straight line decoder then takes its fields from
+ * here, instead of parsing each frame */
+
+#define HDR_BATCH_MAX 32        /* max frames in a burst */
+
+typedef struct
+{
+  guint n;                              /* frames in the burst */
+  guint8 fast[HDR_BATCH_MAX];           /* true if unfragmented tcp or udp
+                                         * over IPv4 over Ethernet II, with
+                                         * the whole ip header captured */
+  guint16 ethertype[HDR_BATCH_MAX];     /* 0 if not captured */
+
+  /* the fields below are meaningful only for fast frames */
+  guint8 ip_version[HDR_BATCH_MAX];
+  guint8 ip_hl[HDR_BATCH_MAX];          /* ip header length, in bytes */
+  guint8 ip_proto[HDR_BATCH_MAX];       /* ip protocol */
+  guint32 src_addr[HDR_BATCH_MAX];      /* ip addresses, network order */
+  guint32 dst_addr[HDR_BATCH_MAX];
+  guint8 has_ports[HDR_BATCH_MAX];      /* true if the ports were captured */
+  guint16 src_port[HDR_BATCH_MAX];      /* tcp/udp ports, host order */
+  guint16 dst_port[HDR_BATCH_MAX];
+}
+hdr_batch_t;
+
+/* selects the implementation. If scalar is true, SIMD is never used */
+void hdr_batch_init(gboolean scalar);
+/* name of the implementation in use */
+const gchar *hdr_batch_impl(void);
+/* fills batch from n frames, n <= HDR_BATCH_MAX */
+void hdr_batch_extract(hdr_batch_t *batch, guint n, 
+                       const guint8 *const *frames, const guint *caplens);
+
+#endif
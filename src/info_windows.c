@@ -469,7 +469,8 @@ static void update_protocols_row(GtkListStore *gs, GtkTreeIter *it,
 static void update_protocols_table(GtkWidget *window, const protostack_t *pstk)
 {
   GtkListStore *gs;
-  GList *item;
+  const protocol_t *stack_proto;
+  guint pos = 0;
   gboolean res;
   GtkTreeIter it;
 
@@ -478,14 +479,13 @@ static void update_protocols_table(GtkWidget *window, const protostack_t *pstk)
     return; /* nothing to do */
 
   if (pstk)
-    item = pstk->protostack[pref.stack_level];
+    stack_proto = protocol_stack_next(pstk, pref.stack_level, &pos);
   else
-    item = NULL;
+    stack_proto = NULL;
   
   res = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (gs), &it);
-  while (res || item)
+  while (res || stack_proto)
     {
-      const protocol_t *stack_proto = NULL;
       protocol_list_item_t *row_proto = NULL;
 
       /* retrieve current row proto (if present) */
@@ -493,7 +493,7 @@ static void update_protocols_table(GtkWidget *window, const protostack_t *pstk)
         gtk_tree_model_get (GTK_TREE_MODEL (gs), &it, PROTO_COLUMN_N, 
                             &row_proto, -1);
 
-      if ( !item )
+      if ( !stack_proto )
         {
           /* no more protos on stack, del current row (remove moves to next) */
           if (res)
@@ -505,9 +505,6 @@ static void update_protocols_table(GtkWidget *window, const protostack_t *pstk)
           continue;
         }
 
-      /* retrieve current stack proto */
-      stack_proto = item->data;
-
       if (!res)
         {
           /* current protocol missing on list, create a new row */
@@ -544,7 +541,7 @@ static void update_protocols_table(GtkWidget *window, const protostack_t *pstk)
       if (res)
         res = gtk_tree_model_iter_next (GTK_TREE_MODEL (gs), &it);
 
-      item = item->next;
+      stack_proto = protocol_stack_next(pstk, pref.stack_level, &pos);
     }
 }
 
@@ -683,7 +680,7 @@ update_info_windows (void)
   if (status != PLAY && status != STOP)
     return TRUE;
 
-  gettimeofday (&appdata.now, NULL);
+  get_capture_time (&appdata.now);
 
   update_protocols_window ();
   update_stats_info_windows ();
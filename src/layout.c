@@ -0,0 +1,825 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
+#include "layout.h"
+
+/* minimum interval between iterations, in ms */
+#define LAYOUT_PERIOD_MS 20
+/* Barnes-Hut opening angle: cells smaller than this, relative to their
+ * distance, are taken as a single body */
+#define LAYOUT_THETA 0.8
+/* quadtree depth limit, bodies closer than this are aggregated */
+#define LAYOUT_MAX_DEPTH 24
+/* ideal edge length, relative to sqrt(area / nodes) */
+#define LAYOUT_K_SCALE 0.6
+/* pull toward the area center, keeping unlinked nodes together */
+#define LAYOUT_GRAVITY 2.0
+/* temperatures are max displacements per iteration, relative to the
+ * ideal edge length. Nodes freeze when they drop below MIN_TEMP pixels */
+#define LAYOUT_PLACED_TEMP 1.0
+#define LAYOUT_RANDOM_TEMP 40.0
+#define LAYOUT_REHEAT_TEMP 0.5
+#define LAYOUT_COOLING 0.97
+#define LAYOUT_MIN_TEMP 0.5
+
+typedef enum
+{
+  LAYOUT_ADD,
+  LAYOUT_REMOVE,
+  LAYOUT_EDGES,
+  LAYOUT_AREA
+} layout_cmd_type_t;
+
+/* a change queued for the worker */
+typedef struct
+{
+  layout_cmd_type_t type;
+  guint slot;                   /* ADD, REMOVE */
+  guint *edges;                 /* EDGES, owned by the command */
+  guint n_edges;
+  gdouble area[4];              /* AREA: xmin, ymin, xmax, ymax */
+} layout_cmd_t;
+
+/* a node, as seen by the worker */
+typedef struct
+{
+  gdouble x;
+  gdouble y;
+  gdouble dx;                   /* displacement of current iteration */
+  gdouble dy;
+  gdouble temp;                 /* max displacement, 0 if frozen */
+  gboolean used;
+  gboolean placed;
+} lnode_t;
+
+/* a quadtree cell */
+typedef struct
+{
+  gdouble x0;                   /* cell square */
+  gdouble y0;
+  gdouble size;
+  gdouble mx;                   /* center of mass - sum of positions */
+  gdouble my;                   /* while building */
+  guint mass;                   /* bodies in the cell */
+  gint child[4];                /* -1 if empty */
+  gint body;                    /* the only body of a leaf, else -1 */
+} lquad_t;
+
+/* shared data, protected by layout_mtx */
+static pthread_t layout_thread;
+static gboolean layout_running = FALSE;
+static pthread_mutex_t layout_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t layout_cond = PTHREAD_COND_INITIALIZER;
+static gboolean stop_request = FALSE;
+static GArray *shared_cmds = NULL;
+static gdouble *snap_xy = NULL;  /* x, y of each slot */
+static guint8 *snap_placed = NULL;
+static guint snap_n = 0;
+static guint snap_gen = 0;       /* incremented at each snapshot */
+static guint shared_seq = 0;     /* commits received */
+static guint snap_seq = 0;       /* commits applied in the snapshot */
+
+/* GUI thread data */
+static GArray *gui_cmds = NULL;
+static GArray *free_slots = NULL;
+static guint next_slot = 0;
+static gdouble *gui_xy = NULL;
+static guint8 *gui_placed = NULL;
+static guint gui_n = 0;
+static guint gui_gen = 0;
+static guint *slot_seq = NULL;   /* commit adding each slot */
+static guint commit_seq = 0;     /* commits done */
+
+/* worker data */
+static lnode_t *nodes = NULL;
+static guint n_nodes = 0;        /* allocated slots */
+static guint *edges = NULL;
+static guint n_edges = 0;
+static GArray *quads = NULL;
+static gdouble area[4] = { 0, 0, 0, 0 };
+static guint worker_seq = 0;     /* commits applied */
+static gboolean new_nodes = FALSE; /* some node is unplaced */
+static GRand *layout_rand = NULL;
+
+static void *layout_thread_routine(void *dt);
+
+/***************************************************************************
+ *
+ * GUI side
+ *
+ **************************************************************************/
+static void free_cmds(GArray *cmds)
+{
+  guint i;
+
+  for (i = 0; i < cmds->len; ++i)
+    g_free(g_array_index(cmds, layout_cmd_t, i).edges);
+  g_array_set_size(cmds, 0);
+}
+
+gboolean layout_open(void)
+{
+  if (layout_running)
+    return TRUE;
+
+  gui_cmds = g_array_new(FALSE, FALSE, sizeof(layout_cmd_t));
+  shared_cmds = g_array_new(FALSE, FALSE, sizeof(layout_cmd_t));
+  free_slots = g_array_new(FALSE, FALSE, sizeof(guint));
+  quads = g_array_new(FALSE, FALSE, sizeof(lquad_t));
+  layout_rand = g_rand_new_with_seed(1);
+  stop_request = FALSE;
+
+  if (pthread_create(&layout_thread, NULL, layout_thread_routine, NULL))
+    {
+      layout_close();
+      return FALSE;
+    }
+  layout_running = TRUE;
+  return TRUE;
+}
+
+void layout_close(void)
+{
+  if (layout_running)
+    {
+      pthread_mutex_lock(&layout_mtx);
+      stop_request = TRUE;
+      pthread_cond_broadcast(&layout_cond);
+      pthread_mutex_unlock(&layout_mtx);
+
+      pthread_join(layout_thread, NULL);
+      layout_running = FALSE;
+    }
+
+  if (gui_cmds)
+    {
+      free_cmds(gui_cmds);
+      g_array_free(gui_cmds, TRUE);
+      gui_cmds = NULL;
+    }
+  if (shared_cmds)
+    {
+      free_cmds(shared_cmds);
+      g_array_free(shared_cmds, TRUE);
+      shared_cmds = NULL;
+    }
+  if (free_slots)
+    {
+      g_array_free(free_slots, TRUE);
+      free_slots = NULL;
+    }
+  if (quads)
+    {
+      g_array_free(quads, TRUE);
+      quads = NULL;
+    }
+  if (layout_rand)
+    {
+      g_rand_free(layout_rand);
+      layout_rand = NULL;
+    }
+  g_free(snap_xy);
+  g_free(snap_placed);
+  g_free(gui_xy);
+  g_free(gui_placed);
+  g_free(slot_seq);
+  g_free(nodes);
+  g_free(edges);
+  slot_seq = NULL;
+  snap_xy = gui_xy = NULL;
+  snap_placed = gui_placed = NULL;
+  nodes = NULL;
+  edges = NULL;
+  snap_n = gui_n = n_nodes = n_edges = 0;
+  snap_gen = gui_gen = 0;
+  shared_seq = snap_seq = commit_seq = worker_seq = 0;
+  next_slot = 0;
+  new_nodes = FALSE;
+}
+
+guint layout_node_add(void)
+{
+  layout_cmd_t cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = LAYOUT_ADD;
+  if (free_slots->len)
+    {
+      cmd.slot = g_array_index(free_slots, guint, free_slots->len - 1);
+      g_array_set_size(free_slots, free_slots->len - 1);
+    }
+  else
+    {
+      cmd.slot = next_slot++;
+      slot_seq = g_renew(guint, slot_seq, next_slot);
+    }
+  g_array_append_val(gui_cmds, cmd);
+
+  /* snapshots older than the next commit don't know the node */
+  slot_seq[cmd.slot] = commit_seq + 1;
+  if (cmd.slot < gui_n)
+    gui_placed[cmd.slot] = FALSE;
+  return cmd.slot;
+}
+
+void layout_node_remove(guint slot)
+{
+  layout_cmd_t cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = LAYOUT_REMOVE;
+  cmd.slot = slot;
+  g_array_append_val(gui_cmds, cmd);
+  g_array_append_val(free_slots, slot);
+}
+
+void layout_set_edges(const guint *new_edges, guint n_new_edges)
+{
+  layout_cmd_t cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = LAYOUT_EDGES;
+  cmd.n_edges = n_new_edges;
+  cmd.edges = g_memdup(new_edges, 2 * n_new_edges * sizeof(guint));
+  g_array_append_val(gui_cmds, cmd);
+}
+
+void layout_set_area(gdouble xmin, gdouble ymin, gdouble xmax, gdouble ymax)
+{
+  layout_cmd_t cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = LAYOUT_AREA;
+  cmd.area[0] = xmin;
+  cmd.area[1] = ymin;
+  cmd.area[2] = xmax;
+  cmd.area[3] = ymax;
+  g_array_append_val(gui_cmds, cmd);
+}
+
+/* the changes reach the worker all together, so nodes added with their
+ * edges can be placed near their peers */
+void layout_commit(void)
+{
+  if (!layout_running || !gui_cmds->len)
+    return;
+
+  pthread_mutex_lock(&layout_mtx);
+  g_array_append_vals(shared_cmds, gui_cmds->data, gui_cmds->len);
+  shared_seq = ++commit_seq;
+  pthread_cond_broadcast(&layout_cond);
+  pthread_mutex_unlock(&layout_mtx);
+
+  /* edges are now owned by the shared commands */
+  g_array_set_size(gui_cmds, 0);
+}
+
+gboolean layout_fetch(void)
+{
+  guint i;
+  guint seq;
+
+  if (!layout_running)
+    return FALSE;
+
+  pthread_mutex_lock(&layout_mtx);
+  if (snap_gen == gui_gen)
+    {
+      pthread_mutex_unlock(&layout_mtx);
+      return FALSE;
+    }
+  if (gui_n < snap_n)
+    {
+      gui_xy = g_renew(gdouble, gui_xy, 2 * snap_n);
+      gui_placed = g_renew(guint8, gui_placed, snap_n);
+      gui_n = snap_n;
+    }
+  memcpy(gui_xy, snap_xy, 2 * snap_n * sizeof(gdouble));
+  memcpy(gui_placed, snap_placed, snap_n);
+  gui_gen = snap_gen;
+  seq = snap_seq;
+  pthread_mutex_unlock(&layout_mtx);
+
+  /* slots reused after the snapshot was taken hold an old node */
+  for (i = 0; i < gui_n && i < next_slot; ++i)
+    if (slot_seq[i] > seq)
+      gui_placed[i] = FALSE;
+  return TRUE;
+}
+
+gboolean layout_get_position(guint slot, gdouble *x, gdouble *y)
+{
+  if (slot >= gui_n || !gui_placed[slot])
+    return FALSE;
+  *x = gui_xy[2 * slot];
+  *y = gui_xy[2 * slot + 1];
+  return TRUE;
+}
+
+/***************************************************************************
+ *
+ * worker
+ *
+ **************************************************************************/
+
+/* ideal edge length */
+static gdouble ideal_length(guint n)
+{
+  gdouble a = (area[2] - area[0]) * (area[3] - area[1]);
+
+  if (a <= 0)
+    a = 1;
+  return LAYOUT_K_SCALE * sqrt(a / MAX(n, 1));
+}
+
+static void clamp_to_area(lnode_t *node)
+{
+  node->x = CLAMP(node->x, area[0], area[2]);
+  node->y = CLAMP(node->y, area[1], area[3]);
+}
+
+static void apply_cmd(layout_cmd_t *cmd)
+{
+  lnode_t *node;
+  guint i;
+
+  switch (cmd->type)
+    {
+    case LAYOUT_ADD:
+      if (cmd->slot >= n_nodes)
+        {
+          guint n = MAX(cmd->slot + 1, 2 * n_nodes);
+          nodes = g_renew(lnode_t, nodes, n);
+          memset(nodes + n_nodes, 0, (n - n_nodes) * sizeof(lnode_t));
+          n_nodes = n;
+        }
+      node = nodes + cmd->slot;
+      memset(node, 0, sizeof(lnode_t));
+      node->used = TRUE;
+      new_nodes = TRUE;
+      break;
+    case LAYOUT_REMOVE:
+      if (cmd->slot < n_nodes)
+        memset(nodes + cmd->slot, 0, sizeof(lnode_t));
+      break;
+    case LAYOUT_EDGES:
+      g_free(edges);
+      edges = cmd->edges;
+      n_edges = cmd->n_edges;
+      cmd->edges = NULL;
+      break;
+    case LAYOUT_AREA:
+      if (area[2] > area[0] && area[3] > area[1])
+        {
+          /* scales the placed nodes to the new area */
+          gdouble sx = (cmd->area[2] - cmd->area[0]) / (area[2] - area[0]);
+          gdouble sy = (cmd->area[3] - cmd->area[1]) / (area[3] - area[1]);
+          for (i = 0; i < n_nodes; ++i)
+            if (nodes[i].placed)
+              {
+                nodes[i].x = cmd->area[0] + (nodes[i].x - area[0]) * sx;
+                nodes[i].y = cmd->area[1] + (nodes[i].y - area[1]) * sy;
+              }
+        }
+      memcpy(area, cmd->area, sizeof(area));
+      break;
+    }
+}
+
+/* true if the edge links two nodes present */
+static gboolean edge_valid(guint a, guint b)
+{
+  return a < n_nodes && b < n_nodes && a != b && 
+    nodes[a].used && nodes[b].used;
+}
+
+/* places the new nodes at the center of their placed peers. Nodes 
+ * linked only to other new nodes are placed as their peers are, 
+ * unlinked ones at random. Their peers are heated to make room */
+static void place_new_nodes(void)
+{
+  gdouble *sum;
+  guint *count;
+  guint i;
+  guint a;
+  guint b;
+  gboolean progress = TRUE;
+  gdouble k;
+  guint n = 0;
+
+  if (!new_nodes)
+    return;
+  new_nodes = FALSE;
+
+  for (i = 0; i < n_nodes; ++i)
+    if (nodes[i].used)
+      n++;
+  k = ideal_length(n);
+
+  sum = g_malloc0(2 * n_nodes * sizeof(gdouble));
+  count = g_malloc0(n_nodes * sizeof(guint));
+  while (progress)
+    {
+      progress = FALSE;
+      memset(count, 0, n_nodes * sizeof(guint));
+      memset(sum, 0, 2 * n_nodes * sizeof(gdouble));
+      for (i = 0; i < n_edges; ++i)
+        {
+          a = edges[2 * i];
+          b = edges[2 * i + 1];
+          if (!edge_valid(a, b) || nodes[a].placed == nodes[b].placed)
+            continue;
+          if (nodes[a].placed)
+            {
+              guint t = a;
+              a = b;
+              b = t;
+            }
+          /* a is new, b placed */
+          sum[2 * a] += nodes[b].x;
+          sum[2 * a + 1] += nodes[b].y;
+          count[a]++;
+        }
+
+      for (i = 0; i < n_nodes; ++i)
+        if (count[i])
+          {
+            nodes[i].x = sum[2 * i] / count[i] + 
+              g_rand_double_range(layout_rand, -k / 2, k / 2);
+            nodes[i].y = sum[2 * i + 1] / count[i] + 
+              g_rand_double_range(layout_rand, -k / 2, k / 2);
+            nodes[i].temp = LAYOUT_PLACED_TEMP * k;
+            nodes[i].placed = TRUE;
+            clamp_to_area(nodes + i);
+            progress = TRUE;
+          }
+    }
+
+  for (i = 0; i < n_nodes; ++i)
+    if (nodes[i].used && !nodes[i].placed)
+      {
+        nodes[i].x = g_rand_double_range(layout_rand, area[0], area[2]);
+        nodes[i].y = g_rand_double_range(layout_rand, area[1], area[3]);
+        nodes[i].temp = LAYOUT_RANDOM_TEMP * k;
+        nodes[i].placed = TRUE;
+        clamp_to_area(nodes + i);
+      }
+
+  /* peers of new nodes, the ones still at placement temperature, are 
+   * heated */
+  for (i = 0; i < n_edges; ++i)
+    {
+      a = edges[2 * i];
+      b = edges[2 * i + 1];
+      if (!edge_valid(a, b))
+        continue;
+      if (nodes[a].temp >= LAYOUT_PLACED_TEMP * k)
+        nodes[b].temp = MAX(nodes[b].temp, LAYOUT_REHEAT_TEMP * k);
+      if (nodes[b].temp >= LAYOUT_PLACED_TEMP * k)
+        nodes[a].temp = MAX(nodes[a].temp, LAYOUT_REHEAT_TEMP * k);
+    }
+
+  g_free(count);
+  g_free(sum);
+}
+
+static gint quad_new(gdouble x0, gdouble y0, gdouble size)
+{
+  lquad_t q;
+
+  q.x0 = x0;
+  q.y0 = y0;
+  q.size = size;
+  q.mx = q.my = 0;
+  q.mass = 0;
+  q.child[0] = q.child[1] = q.child[2] = q.child[3] = -1;
+  q.body = -1;
+  g_array_append_val(quads, q);
+  return quads->len - 1;
+}
+
+#define QUAD(i) (&g_array_index(quads, lquad_t, (i)))
+
+/* child of cell q holding point x, y, created if needed */
+static gint quad_child(gint q, gdouble x, gdouble y)
+{
+  gdouble half = QUAD(q)->size / 2;
+  guint c = 0;
+  gdouble x0 = QUAD(q)->x0;
+  gdouble y0 = QUAD(q)->y0;
+  gint child;
+
+  if (x >= x0 + half)
+    {
+      c |= 1;
+      x0 += half;
+    }
+  if (y >= y0 + half)
+    {
+      c |= 2;
+      y0 += half;
+    }
+  if (QUAD(q)->child[c] < 0)
+    {
+      child = quad_new(x0, y0, half); /* can move the array */
+      QUAD(q)->child[c] = child;
+    }
+  return QUAD(q)->child[c];
+}
+
+/* builds the quadtree of the placed nodes, returning the root */
+static gint quad_build(void)
+{
+  gdouble xmin = G_MAXDOUBLE;
+  gdouble ymin = G_MAXDOUBLE;
+  gdouble xmax = -G_MAXDOUBLE;
+  gdouble ymax = -G_MAXDOUBLE;
+  guint i;
+  guint depth;
+  gint q;
+  gint old;
+
+  for (i = 0; i < n_nodes; ++i)
+    if (nodes[i].placed)
+      {
+        xmin = MIN(xmin, nodes[i].x);
+        ymin = MIN(ymin, nodes[i].y);
+        xmax = MAX(xmax, nodes[i].x);
+        ymax = MAX(ymax, nodes[i].y);
+      }
+
+  g_array_set_size(quads, 0);
+  quad_new(xmin, ymin, MAX(xmax - xmin, ymax - ymin) + 1);
+
+  for (i = 0; i < n_nodes; ++i)
+    {
+      if (!nodes[i].placed)
+        continue;
+      for (q = 0, depth = 0; ; ++depth)
+        {
+          QUAD(q)->mass++;
+          QUAD(q)->mx += nodes[i].x;
+          QUAD(q)->my += nodes[i].y;
+          if (QUAD(q)->mass == 1)
+            {
+              /* empty leaf */
+              QUAD(q)->body = i;
+              break;
+            }
+          if (depth >= LAYOUT_MAX_DEPTH)
+            {
+              /* too near, the leaf keeps more bodies */
+              QUAD(q)->body = -1;
+              break;
+            }
+          old = QUAD(q)->body;
+          if (old >= 0)
+            {
+              /* leaf splits, moving its body down */
+              gint c = quad_child(q, nodes[old].x, nodes[old].y);
+              QUAD(c)->mass = 1;
+              QUAD(c)->mx = nodes[old].x;
+              QUAD(c)->my = nodes[old].y;
+              QUAD(c)->body = old;
+              QUAD(q)->body = -1;
+            }
+          q = quad_child(q, nodes[i].x, nodes[i].y);
+        }
+    }
+
+  for (i = 0; i < quads->len; ++i)
+    {
+      QUAD(i)->mx /= QUAD(i)->mass;
+      QUAD(i)->my /= QUAD(i)->mass;
+    }
+  return 0;
+}
+
+/* adds to node i the repulsion of all other nodes */
+static void repulse(guint i, gdouble k2)
+{
+  gint stack[4 * (LAYOUT_MAX_DEPTH + 2)];
+  guint top = 0;
+  lnode_t *node = nodes + i;
+  const lquad_t *q;
+  gdouble dx;
+  gdouble dy;
+  gdouble d2;
+  gdouble f;
+  guint c;
+  gboolean leaf;
+
+  stack[top++] = 0;
+  while (top)
+    {
+      q = QUAD(stack[--top]);
+      if (q->body == (gint)i)
+        continue;
+      dx = node->x - q->mx;
+      dy = node->y - q->my;
+      d2 = dx * dx + dy * dy;
+      leaf = q->child[0] < 0 && q->child[1] < 0 && 
+        q->child[2] < 0 && q->child[3] < 0;
+      if (leaf || q->size * q->size < LAYOUT_THETA * LAYOUT_THETA * d2)
+        {
+          if (d2 < 0.01)
+            {
+              /* overlapping nodes, pushed apart in some direction */
+              gdouble angle = i * 2.399963;
+              dx = cos(angle);
+              dy = sin(angle);
+              d2 = 1;
+            }
+          f = q->mass * k2 / d2;
+          node->dx += dx * f;
+          node->dy += dy * f;
+          continue;
+        }
+      for (c = 0; c < 4; ++c)
+        if (q->child[c] >= 0)
+          stack[top++] = q->child[c];
+    }
+}
+
+/* a Fruchterman-Reingold iteration, moving only hot nodes. Returns
+ * FALSE when all nodes are frozen */
+static gboolean layout_iterate(void)
+{
+  guint i;
+  guint a;
+  guint b;
+  guint n = 0;
+  guint hot = 0;
+  gdouble k;
+  gdouble dx;
+  gdouble dy;
+  gdouble d;
+  gdouble cx;
+  gdouble cy;
+
+  for (i = 0; i < n_nodes; ++i)
+    if (nodes[i].placed)
+      {
+        n++;
+        if (nodes[i].temp > 0)
+          hot++;
+      }
+  if (!hot)
+    return FALSE;
+
+  k = ideal_length(n);
+  cx = (area[0] + area[2]) / 2;
+  cy = (area[1] + area[3]) / 2;
+  quad_build();
+
+  for (i = 0; i < n_nodes; ++i)
+    if (nodes[i].temp > 0)
+      {
+        nodes[i].dx = -LAYOUT_GRAVITY * (nodes[i].x - cx);
+        nodes[i].dy = -LAYOUT_GRAVITY * (nodes[i].y - cy);
+        repulse(i, k * k);
+      }
+
+  for (i = 0; i < n_edges; ++i)
+    {
+      a = edges[2 * i];
+      b = edges[2 * i + 1];
+      if (!edge_valid(a, b) || !(nodes[a].temp > 0 || nodes[b].temp > 0))
+        continue;
+      dx = nodes[a].x - nodes[b].x;
+      dy = nodes[a].y - nodes[b].y;
+      d = sqrt(dx * dx + dy * dy) / k;
+      nodes[a].dx -= dx * d;
+      nodes[a].dy -= dy * d;
+      nodes[b].dx += dx * d;
+      nodes[b].dy += dy * d;
+    }
+
+  for (i = 0; i < n_nodes; ++i)
+    {
+      lnode_t *node = nodes + i;
+      if (!(node->temp > 0))
+        continue;
+      d = sqrt(node->dx * node->dx + node->dy * node->dy);
+      if (d > 0)
+        {
+          node->x += node->dx / d * MIN(d, node->temp);
+          node->y += node->dy / d * MIN(d, node->temp);
+          clamp_to_area(node);
+        }
+      node->temp *= LAYOUT_COOLING;
+      if (node->temp < LAYOUT_MIN_TEMP)
+        node->temp = 0;
+    }
+  return TRUE;
+}
+
+static void publish_snapshot(void)
+{
+  guint i;
+
+  pthread_mutex_lock(&layout_mtx);
+  if (snap_n < n_nodes)
+    {
+      snap_xy = g_renew(gdouble, snap_xy, 2 * n_nodes);
+      snap_placed = g_renew(guint8, snap_placed, n_nodes);
+      snap_n = n_nodes;
+    }
+  for (i = 0; i < n_nodes; ++i)
+    {
+      snap_xy[2 * i] = nodes[i].x;
+      snap_xy[2 * i + 1] = nodes[i].y;
+      snap_placed[i] = nodes[i].placed;
+    }
+  snap_gen++;
+  snap_seq = worker_seq;
+  pthread_mutex_unlock(&layout_mtx);
+}
+
+/* runs iterations while some node is hot, at most one per period. 
+ * Sleeps while the layout is settled and no change arrives */
+static void *layout_thread_routine(void *dt)
+{
+  GArray *cmds;
+  GArray *tmp;
+  gboolean hot = FALSE;
+  struct timeval now;
+  struct timespec deadline = { 0, 0 };
+  guint i;
+
+  cmds = g_array_new(FALSE, FALSE, sizeof(layout_cmd_t));
+  for (;;)
+    {
+      pthread_mutex_lock(&layout_mtx);
+      if (hot)
+        {
+          while (!stop_request && !shared_cmds->len &&
+                 pthread_cond_timedwait(&layout_cond, &layout_mtx, 
+                                        &deadline) == 0)
+            ;
+        }
+      else
+        {
+          while (!stop_request && !shared_cmds->len)
+            pthread_cond_wait(&layout_cond, &layout_mtx);
+        }
+      if (stop_request)
+        {
+          pthread_mutex_unlock(&layout_mtx);
+          break;
+        }
+      tmp = shared_cmds;
+      shared_cmds = cmds;
+      cmds = tmp;
+      worker_seq = shared_seq;
+      pthread_mutex_unlock(&layout_mtx);
+
+      for (i = 0; i < cmds->len; ++i)
+        apply_cmd(&g_array_index(cmds, layout_cmd_t, i));
+      free_cmds(cmds);
+
+      place_new_nodes();
+
+      /* the period starts with the iteration */
+      gettimeofday(&now, NULL);
+      deadline.tv_sec = now.tv_sec;
+      deadline.tv_nsec = (now.tv_usec + LAYOUT_PERIOD_MS * 1000) * 1000;
+      if (deadline.tv_nsec >= 1000000000)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000;
+        }
+      hot = layout_iterate();
+      publish_snapshot();
+    }
+
+  free_cmds(cmds);
+  g_array_free(cmds, TRUE);
+  return NULL;
+}
@@ -0,0 +1,53 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <glib.h>
+
+/* Force directed layout.
+ * A worker thread moves the nodes with spring forces along edges and
+ * repulsion between every pair of nodes, approximated with a Barnes-Hut
+ * quadtree. New nodes start near their peers, and only nodes recently
+ * added or linked are hot enough to move, so the layout changes 
+ * incrementally and the worker sleeps when it has settled.
+ *
+ * Nodes are identified by slots. The GUI queues changes with the
+ * functions below and hands them to the worker with layout_commit. 
+ * Positions are read from the last snapshot taken with layout_fetch.
+ * All functions must be called from the GUI thread */
+
+gboolean layout_open(void); /* starts the worker */
+void layout_close(void); /* stops the worker, releasing all data */
+
+guint layout_node_add(void); /* returns the slot of a new, unplaced node */
+void layout_node_remove(guint slot);
+/* replaces all edges with the n_edges slot pairs in edges */
+void layout_set_edges(const guint *edges, guint n_edges);
+void layout_set_area(gdouble xmin, gdouble ymin, gdouble xmax, gdouble ymax);
+void layout_commit(void); /* passes the queued changes to the worker */
+
+/* takes a snapshot of the positions. Returns FALSE if unchanged */
+gboolean layout_fetch(void);
+/* position of slot in the snapshot. FALSE if the node isn't placed yet */
+gboolean layout_get_position(guint slot, gdouble *x, gdouble *y);
+
+#endif
@@ -27,7 +27,23 @@
 #include "preferences.h"
 #include "conversations.h"
 
-static GTree *all_links = NULL;			/* Has all links heard on the net */
+/* Has all links heard on the net.
+ * Open addressing hash table with linear probing, keyed on the node pair */
+#define CATALOG_MIN_SLOTS 1024
+typedef struct
+{
+  link_t **slots;               /* NULL if empty */
+  guint n_slots;                /* power of two */
+  guint n_links;
+  timer_wheel_t *wheel;         /* schedules link updates */
+  gdouble link_timeout;         /* timeouts used for the scheduled updates */
+  gdouble proto_timeout;
+  gdouble node_timeout;
+} link_catalog_t;
+static link_catalog_t *all_links = NULL;
+
+/* hash of a node pair. Order matters, since links are directed */
+#define NODE_PAIR_HASH(src, dst) ((src)->hash ^ ((dst)->hash * 0x9E3779B1U))
 
 /***************************************************************************
  *
@@ -77,26 +93,35 @@ link_id_node_names(const link_id_t *link_id)
  * link_t implementation
  *
  **************************************************************************/
-static gint update_link(link_id_t * link_id, link_t * link, gpointer delete_list_ptr);
+static gboolean update_link(link_t * link);
 
 /* creates a new link object */
-link_t *link_create(const link_id_t *link_id)
+link_t *link_create(node_t *src_node, node_t *dst_node)
 {
   link_t *link;
   guint i = STACK_SIZE;
 
+  g_assert(src_node && dst_node);
+
   link = g_malloc (sizeof (link_t));
   g_assert(link);
 
-  link->link_id = *link_id;
+  link->link_id.src = src_node->node_id;
+  link->link_id.dst = dst_node->node_id;
+  link->src_node = src_node;
+  link->dst_node = dst_node;
+  link->hash = NODE_PAIR_HASH(src_node, dst_node);
+  src_node->n_links++;
+  dst_node->n_links++;
 
   while (i + 1)
     {
-      link->main_prot[i] = NULL;
+      link->main_prot[i] = PROTO_ATOM_NONE;
       i--;
     }
 
   traffic_stats_init(&link->link_stats);
+  wheel_timer_init(&link->update_timer);
 
   return link;
 }
@@ -113,14 +138,20 @@ void link_delete(link_t *link)
                             &link->link_id.dst.addr.ip);
   
   for (i = STACK_SIZE; i + 1; i--)
-    if (link->main_prot[i])
-      {
-        g_free (link->main_prot[i]);
-        link->main_prot[i] = NULL;
-      }
+    {
+      proto_atom_unref(link->main_prot[i]);
+      link->main_prot[i] = PROTO_ATOM_NONE;
+    }
 
   traffic_stats_reset(&link->link_stats);
 
+  /* nodes can expire only without links, and links expire with their 
+   * nodes */
+  if (!--link->src_node->n_links)
+    nodes_catalog_touch(link->src_node);
+  if (!--link->dst_node->n_links)
+    nodes_catalog_touch(link->dst_node);
+
   g_free (link);
 }
 
@@ -142,14 +173,14 @@ gchar *link_dump(const link_t *link)
 
   msg_mprot=g_strdup_printf("top: [%s], stack:", 
                             (link->main_prot[0]) ? 
-                            link->main_prot[0] : "-none-");
+                            proto_atom_name(link->main_prot[0]) : "-none-");
   
   for (i = 1; i <= STACK_SIZE; i++)
     {
       gchar *tmp = msg_mprot;
       msg_mprot = g_strdup_printf("%s %d:>%s<", msg_mprot, i, 
                            (link->main_prot[i]) ? 
-                           link->main_prot[i] : "-none-");
+                           proto_atom_name(link->main_prot[i]) : "-none-");
       g_free(tmp);
     }
 
@@ -164,34 +195,31 @@ gchar *link_dump(const link_t *link)
 }
 
 
-/* gfunc called by g_list_foreach to remove a link */
-static void
-gfunc_remove_link(gpointer data, gpointer user_data)
+static void catalog_remove_link(link_t *link);
+
+/* true if node reached its expiration time. Its links are removed, so 
+ * that it can expire too */
+static gboolean node_expired(const node_t *node)
 {
-  links_catalog_remove( (const link_id_t *) data);
+  return pref.node_timeout_time &&
+    substract_times_ms(&appdata.now, &node->node_stats.stats.last_time) >= 
+    pref.node_timeout_time;
 }
 
-static gint
-update_link(link_id_t* link_id, link_t * link, gpointer delete_list_ptr)
+/* updates the link stats. Returns TRUE if the link expired and must be
+ * removed */
+static gboolean
+update_link(link_t * link)
 {
   double diffms;
 
-  g_assert(delete_list_ptr);
-
   /* update stats - returns true if there are active packets */
   if (traffic_stats_update(&link->link_stats, pref.averaging_time, 
                             pref.proto_link_timeout_time))
     {
       /* packet(s) active, update the most used protocols for this link */
-      guint i = STACK_SIZE;
-      while (i + 1)
-        {
-          if (link->main_prot[i])
-            g_free (link->main_prot[i]);
-          link->main_prot[i]
-            = protocol_stack_sort_most_used(&link->link_stats.stats_protos, i);
-          i--;
-        }
+      protocol_stack_main_prots(&link->link_stats.stats_protos, 
+                                link->main_prot);
 
     }
   else
@@ -204,14 +232,16 @@ update_link(link_id_t* link_id, link_t * link, gpointer delete_list_ptr)
           if (diffms >= pref.link_timeout_time)
             {
               /* link expired, remove */
-              GList **delete_list = (GList **)delete_list_ptr;
-        
-              /* adds current to list of links to delete */
-              *delete_list = g_list_prepend( *delete_list, link_id);
-    
               g_log (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG,_("Queuing link for remove"));
+              return TRUE;
             }
         }
+      if (node_expired(link->src_node) || node_expired(link->dst_node))
+        {
+          g_log (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG,
+                 _("Queuing link of expired node for remove"));
+          return TRUE;
+        }
     }
 
   return FALSE;
@@ -219,41 +249,94 @@ update_link(link_id_t* link_id, link_t * link, gpointer delete_list_ptr)
 
 /***************************************************************************
  *
- * links catalog implementation
+ * dirty links methods
  *
  **************************************************************************/
 
-/* links catalog compare function */
-static gint links_catalog_compare(gconstpointer a, gconstpointer b, gpointer dummy)
+static GArray *dirty_links = NULL; /* ids of the links updated or removed
+                                    * since the last dirty_links_clear */
+
+void dirty_links_add(const link_id_t *link_id)
 {
-  return link_id_compare( (const link_id_t *)a,  (const link_id_t *)b);
+  if (!dirty_links)
+    dirty_links = g_array_new(FALSE, FALSE, sizeof(link_id_t));
+  g_array_append_val(dirty_links, *link_id);
 }
 
-/* initializes the catalog */
-void links_catalog_open(void)
+void dirty_links_clear(void)
 {
-  g_assert(!all_links);
-  all_links = g_tree_new_full(links_catalog_compare, NULL, NULL, 
-                              (GDestroyNotify)link_delete);
+  if (dirty_links)
+    g_array_set_size(dirty_links, 0);
 }
 
-/* closes the catalog, releasing all links */
-void links_catalog_close(void)
+/* copies to link_id the last dirty link, removing it from the set. 
+ * A link can be returned more than once */
+gboolean dirty_links_pop(link_id_t *link_id)
 {
-  if (all_links)
-  {
-    g_tree_destroy(all_links);
-    all_links = NULL;
-  }
+  if (!dirty_links || !dirty_links->len)
+    return FALSE;
+
+  *link_id = g_array_index(dirty_links, link_id_t, dirty_links->len - 1);
+  g_array_set_size(dirty_links, dirty_links->len - 1);
+  return TRUE;
 }
 
-/* insert a new link */
-void links_catalog_insert(link_t *new_link)
+/***************************************************************************
+ *
+ * links catalog implementation
+ *
+ **************************************************************************/
+
+/* slot holding the link between src and dst, or the empty slot where it 
+ * would go */
+static guint catalog_probe(const link_catalog_t *cat, const node_t *src_node,
+                           const node_t *dst_node, guint hash)
 {
-  g_assert(all_links);
-  g_assert(new_link);
- 
-  g_tree_insert (all_links, &new_link->link_id, new_link);
+  guint mask = cat->n_slots - 1;
+  guint i = hash & mask;
+  const link_t *link;
+
+  while ((link = cat->slots[i]) != NULL)
+    {
+      if (link->src_node == src_node && link->dst_node == dst_node)
+        break;
+      i = (i + 1) & mask;
+    }
+  return i;
+}
+
+static void catalog_resize(link_catalog_t *cat, guint n_slots)
+{
+  link_t **old_slots = cat->slots;
+  guint old_n = cat->n_slots;
+  guint i;
+
+  cat->slots = g_malloc0(n_slots * sizeof(link_t *));
+  cat->n_slots = n_slots;
+  for (i = 0; i < old_n; ++i)
+    {
+      link_t *link = old_slots[i];
+      if (link)
+        cat->slots[catalog_probe(cat, link->src_node, link->dst_node, 
+                                 link->hash)] = link;
+    }
+  g_free(old_slots);
+}
+
+/* inserts a new link */
+static void catalog_insert_link(link_t *new_link)
+{
+  guint i;
+
+  /* keeps load under 70% */
+  if ((all_links->n_links + 1) * 10 > all_links->n_slots * 7)
+    catalog_resize(all_links, all_links->n_slots * 2);
+
+  i = catalog_probe(all_links, new_link->src_node, new_link->dst_node, 
+                    new_link->hash);
+  g_assert(!all_links->slots[i]);
+  all_links->slots[i] = new_link;
+  all_links->n_links++;
 
   if (DEBUG_ENABLED)
   {
@@ -266,39 +349,104 @@ void links_catalog_insert(link_t *new_link)
   }
 }
 
+/* removes AND DESTROYS a link */
+static void catalog_remove_link(link_t *link)
+{
+  guint mask;
+  guint i;
+  guint j;
+  guint home;
+
+  mask = all_links->n_slots - 1;
+  i = catalog_probe(all_links, link->src_node, link->dst_node, link->hash);
+  if (all_links->slots[i] != link)
+    return;
+  all_links->slots[i] = NULL;
+  all_links->n_links--;
+  wheel_timer_cancel(all_links->wheel, &link->update_timer);
+  dirty_links_add(&link->link_id);
+
+  /* no tombstones: moves back the following links of the cluster that 
+   * would be unreachable across the new hole */
+  for (j = (i + 1) & mask; all_links->slots[j]; j = (j + 1) & mask)
+    {
+      home = all_links->slots[j]->hash & mask;
+      if (((j - home) & mask) >= ((j - i) & mask))
+        {
+          all_links->slots[i] = all_links->slots[j];
+          all_links->slots[j] = NULL;
+          i = j;
+        }
+    }
+
+  link_delete(link);
+}
+
+/* initializes the catalog */
+void links_catalog_open(void)
+{
+  g_assert(!all_links);
+  all_links = g_malloc(sizeof(link_catalog_t));
+  all_links->slots = g_malloc0(CATALOG_MIN_SLOTS * sizeof(link_t *));
+  all_links->n_slots = CATALOG_MIN_SLOTS;
+  all_links->n_links = 0;
+  all_links->wheel = timer_wheel_new();
+  all_links->link_timeout = pref.link_timeout_time;
+  all_links->proto_timeout = pref.proto_link_timeout_time;
+  all_links->node_timeout = pref.node_timeout_time;
+}
+
+/* closes the catalog, releasing all links */
+void links_catalog_close(void)
+{
+  guint i;
+
+  if (all_links)
+  {
+    for (i = 0; i < all_links->n_slots; ++i)
+      if (all_links->slots[i])
+        link_delete(all_links->slots[i]);
+    g_free(all_links->slots);
+    timer_wheel_delete(all_links->wheel);
+    g_free(all_links);
+    all_links = NULL;
+  }
+  dirty_links_clear();
+}
+
 /* removes AND DESTROYS the named link from catalog */
 void links_catalog_remove(const link_id_t *key)
 {
+  link_t *link;
+
   g_assert(all_links);
   g_assert(key);
 
-  g_tree_remove (all_links, key);
+  link = links_catalog_find(key);
+  if (link)
+    catalog_remove_link(link);
 }
 
-/* finds a link */
-link_t *links_catalog_find(const link_id_t *key)
+/* finds a link by its nodes */
+link_t *links_catalog_find_nodes(const node_t *src_node, const node_t *dst_node)
 {
-  g_assert(key);
-  if (!all_links)
+  if (!all_links || !src_node || !dst_node)
     return NULL;
 
-  return g_tree_lookup (all_links, key);
+  return all_links->slots[catalog_probe(all_links, src_node, dst_node,
+                                        NODE_PAIR_HASH(src_node, dst_node))];
 }
 
-/* finds a link, creating one if necessary */
-link_t *links_catalog_find_create(const link_id_t *key)
+/* finds a link */
+link_t *links_catalog_find(const link_id_t *key)
 {
-  link_t *link;
-  g_assert(all_links);
   g_assert(key);
+  if (!all_links)
+    return NULL;
 
-  link = links_catalog_find(key);
-  if (!link)
-  {
-    link = link_create(key);
-    links_catalog_insert(link);
-  }
-  return link;
+  /* links exist only between nodes in the catalog */
+  return links_catalog_find_nodes(nodes_catalog_find(&key->src), 
+                                  nodes_catalog_find(&key->dst));
 }
 
 /* returns the current number of links in catalog */
@@ -307,55 +455,129 @@ gint links_catalog_size(void)
   if (!all_links)
     return 0;
 
-  return g_tree_nnodes (all_links);
+  return all_links->n_links;
 }
 
- /* calls the func for every link */
+/* calls the func for every link, in no particular order. Stops if func 
+ * returns TRUE. The catalog must not be modified by func */
 void links_catalog_foreach(GTraverseFunc func, gpointer data)
 {
+  guint i;
+
   if (!all_links)
     return;
 
-  return g_tree_foreach(all_links, func, data);
+  for (i = 0; i < all_links->n_slots; ++i)
+    {
+      link_t *link = all_links->slots[i];
+      if (link && func(&link->link_id, link, data))
+        break;
+    }
+}
+
+/* schedules the next update of link, as for nodes */
+static void link_schedule(link_t *link)
+{
+  struct timeval oldest;
+
+  if (traffic_stats_active_packets(&link->link_stats))
+    {
+      wheel_timer_set(all_links->wheel, &link->update_timer, &appdata.now, 0);
+      return;
+    }
+
+  wheel_timer_cancel(all_links->wheel, &link->update_timer);
+  if (pref.link_timeout_time)
+    wheel_timer_expedite(all_links->wheel, &link->update_timer, 
+                         &link->link_stats.stats.last_time, 
+                         pref.link_timeout_time);
+  if (pref.node_timeout_time)
+    {
+      /* nodes can receive packets from other links, so this could fire 
+       * early. update_link checks again */
+      wheel_timer_expedite(all_links->wheel, &link->update_timer, 
+                           &link->src_node->node_stats.stats.last_time, 
+                           pref.node_timeout_time);
+      wheel_timer_expedite(all_links->wheel, &link->update_timer, 
+                           &link->dst_node->node_stats.stats.last_time, 
+                           pref.node_timeout_time);
+    }
+  if (pref.proto_link_timeout_time && 
+      protocol_stack_oldest_time(&link->link_stats.stats_protos, &oldest))
+    wheel_timer_expedite(all_links->wheel, &link->update_timer, &oldest,
+                         pref.proto_link_timeout_time);
+}
+
+static void link_timer_fired(wheel_timer_t *timer)
+{
+  link_t *link;
+
+  link = (link_t *)((gchar *)timer - G_STRUCT_OFFSET(link_t, update_timer));
+  if (update_link(link))
+    catalog_remove_link(link);
+  else
+    {
+      dirty_links_add(&link->link_id);
+      link_schedule(link);
+    }
 }
 
-/* Calls update_link for every link. This is actually a function that
- shouldn't be called often, because it might take a very long time 
- to complete */
+/* Updates the links that received packets, that are still active or
+ * whose expiration time is reached. Idle links aren't visited */
 void
 links_catalog_update_all(void)
 {
-  GList *delete_list = NULL;
+  guint i;
 
   if (!all_links)
     return;
 
-  /* we can't delete links while traversing the catalog, so while updating links
-   * we fill a list with the expired link_id's */
-  links_catalog_foreach((GTraverseFunc) update_link, &delete_list);
+  if (all_links->link_timeout != pref.link_timeout_time ||
+      all_links->proto_timeout != pref.proto_link_timeout_time ||
+      all_links->node_timeout != pref.node_timeout_time)
+    {
+      /* timeouts changed, every link must be scheduled again */
+      all_links->link_timeout = pref.link_timeout_time;
+      all_links->proto_timeout = pref.proto_link_timeout_time;
+      all_links->node_timeout = pref.node_timeout_time;
+      for (i = 0; i < all_links->n_slots; ++i)
+        if (all_links->slots[i])
+          wheel_timer_expedite(all_links->wheel, 
+                               &all_links->slots[i]->update_timer, 
+                               &appdata.now, 0);
+    }
 
-  /* after, remove all links on the list from catalog 
-   * WARNING: after this call, the list items are also destroyed */
-  g_list_foreach(delete_list, gfunc_remove_link, NULL);
-  
-  /* free the list - list items are already destroyed */
-  g_list_free(delete_list);
+  timer_wheel_advance(all_links->wheel, &appdata.now, link_timer_fired);
 
   g_log (G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG,
          _("Updated links. Active links %d"), links_catalog_size());
 }
 
-/* adds a new packet to the link, creating it if necessary */
+/* adds a new packet to the link between src_node and dst_node, creating 
+ * it if necessary */
 void
-links_catalog_add_packet(const link_id_t *link_id, packet_info_t * packet, 
-                         packet_direction direction)
+links_catalog_add_packet(node_t *src_node, node_t *dst_node, 
+                         packet_info_t * packet, packet_direction direction)
 {
   link_t *link;
+  guint hash;
+  guint i;
+
+  g_assert(all_links);
 
   /* retrieves link from catalog, creating a new one if necessary */
-  link = links_catalog_find_create(link_id);
+  hash = NODE_PAIR_HASH(src_node, dst_node);
+  i = catalog_probe(all_links, src_node, dst_node, hash);
+  link = all_links->slots[i];
+  if (!link)
+    {
+      link = link_create(src_node, dst_node);
+      catalog_insert_link(link);
+    }
 
   traffic_stats_add_packet(&link->link_stats, packet, direction);
+  wheel_timer_expedite(all_links->wheel, &link->update_timer, 
+                       &appdata.now, 0);
 }
 
 static gboolean link_dump_tvs(gpointer key, gpointer value, gpointer data)
@@ -37,28 +37,41 @@ gchar * link_id_node_names(const link_id_t *link_id);
 typedef struct
 {
   link_id_t link_id;		/* src and dest addresses of link */
+  node_t *src_node;             /* endpoint nodes. They are kept alive */
+  node_t *dst_node;             /* by the link */
+  guint hash;                   /* hash of the node pair, cached for the 
+                                 * catalog */
 
-  gchar *main_prot[STACK_SIZE + 1];	/* Most common protocol for the link */
+  proto_atom_t main_prot[STACK_SIZE + 1]; /* Most common protocol for the link
+                                         * - referenced */
   traffic_stats_t link_stats;
+  wheel_timer_t update_timer;   /* next update - handled by the catalog */
 }
 link_t;
-link_t *link_create(const link_id_t *link_id); /* creates a new link object */
+link_t *link_create(node_t *src_node, node_t *dst_node); /* creates a new link object */
 void link_delete(link_t *link); /* destroys a link, releasing memory */
 gchar *link_dump(const link_t *link); /* dumps link to newly allocated string */
 
 /* link catalog methods */
 void links_catalog_open(void);
 void links_catalog_close(void); /* closes the catalog, releasing all links */
-void links_catalog_insert(link_t *new_link); /* insert a new link */
 void links_catalog_remove(const link_id_t *key); /* removes AND DESTROYS the named link from catalog */
 link_t *links_catalog_find(const link_id_t *key); /* finds a link */
-link_t *links_catalog_find_create(const link_id_t *key); /* finds a link, creating one if necessary */
+link_t *links_catalog_find_nodes(const node_t *src_node, const node_t *dst_node); /* finds a link by its nodes */
 gint links_catalog_size(void); /* returns the current number of links in catalog */
-void links_catalog_foreach(GTraverseFunc func, gpointer data);  /* calls the func for every link */
+void links_catalog_foreach(GTraverseFunc func, gpointer data);  /* calls the func for every link, in no particular order */
 void links_catalog_update_all(void);
-/* adds a new packet to the link, creating it if necessary */
-void links_catalog_add_packet(const link_id_t *link_id, packet_info_t * packet,
+/* adds a new packet to the link between src_node and dst_node, creating 
+ * it if necessary. src_node id must not be greater than dst_node id */
+void links_catalog_add_packet(node_t *src_node, node_t *dst_node, 
+                              packet_info_t * packet,
                               packet_direction direction);
 gchar *links_catalog_dump(void); /* dumps all links to a newly allocated string */
 
+/* methods to handle the links updated or removed by the catalog since
+ * the main app last looked at them */
+void dirty_links_clear(void);
+void dirty_links_add(const link_id_t *link_id); /* marks a link as changed */
+gboolean dirty_links_pop(link_id_t *link_id); /* FALSE if no link is left */
+
 #endif
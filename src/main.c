@@ -37,6 +37,10 @@
 #include "menus.h"
 #include "capture.h"
 #include "datastructs.h"
+#include "replay.h"
+#include "layout.h"
+#include "proto_atoms.h"
+#include "hdr_batch.h"
 
 /***************************************************************************
  *
@@ -44,6 +48,7 @@
  *
  **************************************************************************/
 static gboolean quiet = FALSE;
+static gboolean batch_mode = FALSE; /* headless file analysis */
 static void (*old_sighup_handler) (int);
 
 /***************************************************************************
@@ -52,6 +57,7 @@ static void (*old_sighup_handler) (int);
  *
  **************************************************************************/
 static void free_static_data(void);
+static int run_batch(void);
 static void set_debug_level (void);
 static void session_die (GnomeClient * client, gpointer client_data);
 static gint save_session (GnomeClient * client, gint phase, 
@@ -82,11 +88,13 @@ main (int argc, char *argv[])
   gchar *export_file_final = NULL;
   gchar *export_file_signal = NULL;
   gboolean cl_numeric = FALSE;
+  gint cl_capture_batch = CAPTURE_BATCH_DEFAULT;
   glong midelay = 0;
   glong madelay = G_MAXLONG;
   gchar *version;
   gchar *cl_glade_file = NULL;
   poptContext poptcon;
+  int i;
 
   struct poptOption optionsTable[] = {
     {"diagram-only", 'd', POPT_ARG_NONE, &(pref.diagram_only), 0,
@@ -117,6 +125,29 @@ main (int argc, char *argv[])
     {"max-delay", 0, POPT_ARG_LONG, &madelay,  0,
      N_("maximum packet delay in ms for reading capture files [cli only]"),
       N_("<delay>")},
+    {"packet-mmap", 0, POPT_ARG_NONE, &(appdata.packet_mmap), 0,
+     N_("capture through a memory mapped ring (linux only) [cli only]"), NULL},
+    {"bucket-stats", 0, POPT_ARG_NONE, &(appdata.bucket_stats), 0,
+     N_("keep traffic averages in fixed time slots, using constant memory [cli only]"), 
+      NULL},
+    {"scalar-headers", 0, POPT_ARG_NONE, &(appdata.scalar_headers), 0,
+     N_("don't use SIMD instructions to extract packet headers [cli only]"), 
+      NULL},
+    {"generic-decode", 0, POPT_ARG_NONE, &(appdata.generic_decode), 0,
+     N_("decode every packet with the generic decoders, without fast paths or caches [cli only]"), 
+      NULL},
+    {"accumulate-stats", 0, POPT_ARG_NONE, &(appdata.accumulate_stats), 0,
+     N_("sum packets per flow, updating stats only at refresh. Implies --bucket-stats [cli only]"), 
+      NULL},
+    {"batch", 0, POPT_ARG_NONE, &batch_mode, 0,
+     N_("analyze the replay file at full speed, without GUI [cli only]"), NULL},
+    {"capture-batch", 0, POPT_ARG_INT, &cl_capture_batch, 0,
+     N_("max packets read and decoded at once"), N_("<number of packets>")},
+    {"replay-speed", 0, POPT_ARG_DOUBLE, &(appdata.replay_speed), 0,
+     N_("replay speed multiplier, from 0.1 to 100 [cli only]"), 
+      N_("<speed>")},
+    {"force-layout", 0, POPT_ARG_NONE, &(appdata.force_layout), 0,
+     N_("places nodes with a force directed layout [cli only]"), NULL},
     {"glade-file", 0, POPT_ARG_STRING, &(cl_glade_file), 0,
      N_("uses the named libglade file for widgets"), N_("<glade file>")},
 
@@ -141,8 +172,15 @@ main (int argc, char *argv[])
 #else
   version = g_strdup(VERSION);
 #endif
+  /* batch mode must be known before initializing gnome, since it must work 
+   * without a display */
+  for (i = 1; i < argc; ++i)
+    if (!strcmp (argv[i], "--batch"))
+      batch_mode = TRUE;
+
   gnome_program_init ("EtherApe", version, 
-                      LIBGNOMEUI_MODULE, argc, argv,
+                      batch_mode ? LIBGNOME_MODULE : LIBGNOMEUI_MODULE, 
+                      argc, argv,
 		      GNOME_PARAM_POPT_TABLE, optionsTable, GNOME_PARAM_NONE);
   g_free(version);
 
@@ -161,6 +199,7 @@ main (int argc, char *argv[])
 
   /* Command line */
   cl_numeric = !pref.name_res;
+  cl_capture_batch = (gint)pref.capture_batch;
   poptcon =
     poptGetContext ("Etherape", argc, (const char **) argv, optionsTable, 0);
   while (poptGetNextOpt (poptcon) > 0);
@@ -241,6 +280,32 @@ main (int argc, char *argv[])
   else
       g_message("Invalid maximum delay %ld, ignored", madelay);
   
+  if (appdata.replay_speed < REPLAY_MIN_SPEED || 
+      appdata.replay_speed > REPLAY_MAX_SPEED)
+    {
+      g_message("Invalid replay speed %g, ignored", appdata.replay_speed);
+      appdata.replay_speed = 1.0;
+    }
+  else if (appdata.replay_speed != 1.0)
+    g_message("Replay speed set to %g", appdata.replay_speed);
+
+  if (appdata.accumulate_stats)
+    appdata.bucket_stats = TRUE; /* packets are not kept */
+
+  hdr_batch_init(appdata.scalar_headers);
+
+  /* the value could come from the config file, too */
+  if (cl_capture_batch <= 0 || cl_capture_batch > CAPTURE_BATCH_MAX)
+    {
+      g_message("Invalid capture batch %d, must be from 1 to %d. Using %d", 
+                cl_capture_batch, CAPTURE_BATCH_MAX, CAPTURE_BATCH_DEFAULT);
+      cl_capture_batch = CAPTURE_BATCH_DEFAULT;
+    }
+  pref.capture_batch = cl_capture_batch;
+
+  if (batch_mode)
+    return run_batch();
+
   /* Glade */
   glade_gnome_init ();
   glade_require("gnome");
@@ -289,6 +354,35 @@ main (int argc, char *argv[])
   return 0;
 }				/* main */
 
+/* headless analysis of a capture file: no glade, no gtk main loop */
+static int run_batch(void)
+{
+  gchar *err;
+  gboolean ok;
+
+  if (!appdata.input_file)
+    {
+      g_critical (_("Batch mode needs a file to analyze (--replay-file)"));
+      return 1;
+    }
+
+  services_init();
+  install_handlers();
+
+  err = init_capture ();
+  if (err)
+    {
+      g_critical ("%s", err);
+      free_static_data();
+      return 1;
+    }
+
+  ok = batch_capture ();
+  cleanup_capture ();
+  free_static_data();
+  return ok ? 0 : 1;
+}
+
 /* releases all static and cached data. Called just before exiting. Obviously 
  * it's not stricly needed, since the memory will be returned to the OS anyway,
  * but makes finding memory leaks much easier. */
@@ -297,6 +391,8 @@ static void free_static_data(void)
   protohash_clear();
   ipcache_clear();
   services_clear();
+  proto_atoms_clear();
+  layout_close();
 }
 
 static void
@@ -0,0 +1,250 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include "common.h"
+#include "mem_pool.h"
+
+/* free objects are linked through their first word */
+#define NEXT_FREE(obj) (*(gpointer *)(obj))
+
+/* trims skipped after one releasing nothing */
+#define TRIM_SKIPS 32
+
+/***************************************************************************
+ *
+ * mem_pool_t implementation
+ *
+ **************************************************************************/
+void mem_pool_init(mem_pool_t *pool, const gchar *name, gsize obj_size, 
+                   guint chunk_objs)
+{
+  g_assert(pool);
+  pool->name = name;
+  /* each object must hold at least the free list link, and be aligned */
+  if (obj_size < sizeof(gpointer))
+    obj_size = sizeof(gpointer);
+  pool->obj_size = (obj_size + sizeof(gdouble) - 1) & ~(sizeof(gdouble) - 1);
+  pool->chunk_objs = chunk_objs ? chunk_objs : 1;
+  pool->free_list = NULL;
+  pool->chunks = g_ptr_array_new();
+  pool->n_chunks = 0;
+  pool->in_use = 0;
+  pool->n_free = 0;
+  pool->n_allocs = 0;
+  pool->trim_n_free = 0;
+  pool->trim_skips = 0;
+}
+
+void mem_pool_destroy(mem_pool_t *pool)
+{
+  g_assert(pool);
+  if (pool->in_use)
+    g_warning("pool %s destroyed with %lu objects still in use", 
+              pool->name, pool->in_use);
+  if (pool->chunks)
+    {
+      g_ptr_array_foreach(pool->chunks, (GFunc)g_free, NULL);
+      g_ptr_array_free(pool->chunks, TRUE);
+      pool->chunks = NULL;
+    }
+  pool->free_list = NULL;
+  pool->n_chunks = 0;
+  pool->in_use = 0;
+  pool->n_free = 0;
+}
+
+/* allocates a new chunk, putting all its objects on the free list */
+static void pool_grow(mem_pool_t *pool)
+{
+  guint8 *chunk;
+  guint i;
+
+  chunk = g_malloc((gsize)pool->chunk_objs * pool->obj_size);
+  g_ptr_array_add(pool->chunks, chunk);
+  pool->n_chunks++;
+
+  /* in reverse, so objects are handed out in address order */
+  for (i = pool->chunk_objs; i > 0; --i)
+    {
+      gpointer obj = chunk + (gsize)(i - 1) * pool->obj_size;
+      NEXT_FREE(obj) = pool->free_list;
+      pool->free_list = obj;
+    }
+  pool->n_free += pool->chunk_objs;
+}
+
+gpointer mem_pool_alloc(mem_pool_t *pool)
+{
+  gpointer obj;
+
+  if (!pool->free_list)
+    pool_grow(pool);
+
+  obj = pool->free_list;
+  pool->free_list = NEXT_FREE(obj);
+  pool->n_free--;
+  pool->in_use++;
+  pool->n_allocs++;
+  return obj;
+}
+
+void mem_pool_free(mem_pool_t *pool, gpointer obj)
+{
+  if (!obj)
+    return;
+  NEXT_FREE(obj) = pool->free_list;
+  pool->free_list = obj;
+  pool->n_free++;
+  pool->in_use--;
+}
+
+/* chunk bookkeeping used by trim */
+typedef struct
+{
+  guint8 *start;
+  guint n_free;
+} chunk_use_t;
+
+static gint chunk_compare(gconstpointer a, gconstpointer b)
+{
+  const guint8 *sa = *(const guint8 * const *)a;
+  const guint8 *sb = *(const guint8 * const *)b;
+
+  if (sa < sb)
+    return -1;
+  return sa > sb;
+}
+
+/* returns the chunk containing obj. Chunks are sorted by address */
+static chunk_use_t *find_chunk(chunk_use_t *uses, gulong n, gsize chunk_size,
+                               const guint8 *obj)
+{
+  gulong lo = 0;
+  gulong hi = n;
+
+  while (lo < hi)
+    {
+      gulong mid = (lo + hi) / 2;
+      if (obj < uses[mid].start)
+        hi = mid;
+      else if (obj >= uses[mid].start + chunk_size)
+        lo = mid + 1;
+      else
+        return uses + mid;
+    }
+  return NULL;
+}
+
+/* releases the chunks whose objects are all free. Walks the whole free 
+ * list, so it is meant to be called periodically, not per packet */
+void mem_pool_trim(mem_pool_t *pool)
+{
+  chunk_use_t *uses;
+  chunk_use_t *cu;
+  gsize chunk_size;
+  gulong i;
+  gulong released;
+  gulong kept;
+  gpointer obj;
+  gpointer *link;
+
+  /* nothing to gain if the free objects can't fill a chunk, and in steady
+   * state, with fewer free objects than used, it's not worth the walk */
+  if (pool->n_free < pool->chunk_objs || pool->n_free < pool->in_use)
+    return;
+
+  /* the last pass found only fragmented chunks. Until enough time passed
+   * and something changed, another pass would find the same */
+  if (pool->trim_skips)
+    {
+      pool->trim_skips--;
+      return;
+    }
+  if (pool->n_free == pool->trim_n_free)
+    return;
+
+  chunk_size = (gsize)pool->chunk_objs * pool->obj_size;
+  g_ptr_array_sort(pool->chunks, chunk_compare);
+  uses = g_malloc(pool->n_chunks * sizeof(chunk_use_t));
+  for (i = 0; i < pool->n_chunks; ++i)
+    {
+      uses[i].start = g_ptr_array_index(pool->chunks, i);
+      uses[i].n_free = 0;
+    }
+
+  for (obj = pool->free_list; obj; obj = NEXT_FREE(obj))
+    {
+      cu = find_chunk(uses, pool->n_chunks, chunk_size, obj);
+      g_assert(cu);
+      cu->n_free++;
+    }
+
+  /* unlinks from the free list the objects of unused chunks */
+  link = &pool->free_list;
+  while (*link)
+    {
+      cu = find_chunk(uses, pool->n_chunks, chunk_size, *link);
+      if (cu->n_free == pool->chunk_objs)
+        {
+          *link = NEXT_FREE(*link);
+          pool->n_free--;
+        }
+      else
+        link = (gpointer *)*link;
+    }
+
+  /* frees unused chunks, compacting the others in the array */
+  released = 0;
+  kept = 0;
+  for (i = 0; i < pool->n_chunks; ++i)
+    {
+      if (uses[i].n_free == pool->chunk_objs)
+        {
+          g_free(uses[i].start);
+          released++;
+        }
+      else
+        g_ptr_array_index(pool->chunks, kept++) = uses[i].start;
+    }
+  g_ptr_array_set_size(pool->chunks, kept);
+  pool->n_chunks = kept;
+  g_free(uses);
+
+  if (released)
+    g_my_debug("pool %s: released %lu chunks, %lu remaining", 
+               pool->name, released, pool->n_chunks);
+  else
+    {
+      pool->trim_n_free = pool->n_free;
+      pool->trim_skips = TRIM_SKIPS;
+    }
+}
+
+/* returns a newly allocated string with a dump of pool counters */
+gchar *mem_pool_dump(const mem_pool_t *pool)
+{
+  return g_strdup_printf("%s: %lu used, %lu free, %lu chunks, %lu allocs",
+                         pool->name, pool->in_use, pool->n_free,
+                         pool->n_chunks, pool->n_allocs);
+}
@@ -0,0 +1,55 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <glib.h>
+
+/* Fixed size object pool.
+ * Objects are carved from chunks holding many of them and recycled through
+ * a free list, so the hot per-packet structures don't hit malloc. 
+ * Chunks left completely unused are released by mem_pool_trim() */
+typedef struct
+{
+  const gchar *name;            /* pool name, for debug */
+  gsize obj_size;               /* object size, rounded to pointer alignment */
+  guint chunk_objs;             /* objects per chunk */
+  gpointer free_list;           /* free objects, linked through first word */
+  GPtrArray *chunks;            /* allocated chunks */
+  gulong n_chunks;              /* number of allocated chunks */
+  gulong trim_n_free;           /* n_free left by the last fruitless trim */
+  guint trim_skips;             /* trims to skip before trying again */
+  gulong in_use;                /* objects currently allocated */
+  gulong n_free;                /* objects on free list */
+  gulong n_allocs;              /* total allocations served */
+} mem_pool_t;
+
+void mem_pool_init(mem_pool_t *pool, const gchar *name, gsize obj_size, 
+                   guint chunk_objs);
+void mem_pool_destroy(mem_pool_t *pool); /* frees all chunks */
+gpointer mem_pool_alloc(mem_pool_t *pool);
+void mem_pool_free(mem_pool_t *pool, gpointer obj);
+/* releases unused chunks. After a pass releasing nothing, further passes 
+ * are skipped for a while, and until n_free changes */
+void mem_pool_trim(mem_pool_t *pool);
+/* returns a newly allocated string with a dump of pool counters */
+gchar *mem_pool_dump(const mem_pool_t *pool);
+
+#endif
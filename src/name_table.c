@@ -0,0 +1,233 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "name_table.h"
+
+/* below this size names are searched linearly */
+#define NAME_TABLE_LINEAR 8
+
+struct name_table_s
+{
+  guint n;              /* names in heap */
+  guint size;           /* allocated heap slots */
+  name_t **heap;        /* min-heap on accumulated traffic */
+  GHashTable *index;    /* node_id -> name, NULL while small */
+  name_t *top;          /* busiest name */
+};
+
+static void heap_up(name_table_t *tbl, guint pos);
+static void heap_down(name_table_t *tbl, guint pos);
+static void index_add(name_table_t *tbl, name_t *name);
+
+/***************************************************************************
+ *
+ * name_table_t implementation
+ *
+ **************************************************************************/
+
+name_table_t *name_table_new(void)
+{
+  name_table_t *tbl;
+
+  tbl = g_malloc(sizeof(name_table_t));
+  tbl->n = 0;
+  tbl->size = 0;
+  tbl->heap = NULL;
+  tbl->index = NULL;
+  tbl->top = NULL;
+  return tbl;
+}
+
+void name_table_delete(name_table_t *tbl)
+{
+  guint i;
+
+  if (!tbl)
+    return;
+  if (tbl->index)
+    g_hash_table_destroy(tbl->index);
+  for (i = 0; i < tbl->n; ++i)
+    node_name_delete(tbl->heap[i]);
+  g_free(tbl->heap);
+  g_free(tbl);
+}
+
+static gboolean node_id_equal(gconstpointer a, gconstpointer b)
+{
+  return !node_id_compare(a, b);
+}
+
+/* returns the name with node_id, adding it if missing */
+name_t *name_table_get(name_table_t *tbl, const node_id_t *node_id)
+{
+  name_t *name;
+  name_t *least;
+  guint i;
+
+  g_assert(tbl);
+
+  if (tbl->index)
+    {
+      name = g_hash_table_lookup(tbl->index, node_id);
+      if (name)
+        return name;
+    }
+  else
+    {
+      for (i = 0; i < tbl->n; ++i)
+        if (!node_id_compare(&tbl->heap[i]->node_id, node_id))
+          return tbl->heap[i];
+    }
+
+  name = node_name_create(node_id);
+
+  if (tbl->n == NAME_TABLE_MAX)
+    {
+      /* full, the least used name is replaced. The new one inherits its
+       * traffic, so it can't be evicted at once */
+      least = tbl->heap[0];
+      name->accumulated = least->accumulated;
+      name->table_pos = 0;
+      tbl->heap[0] = name;
+      if (tbl->index)
+        g_hash_table_remove(tbl->index, &least->node_id);
+      if (tbl->top == least)
+        tbl->top = name;
+      node_name_delete(least);
+      index_add(tbl, name);
+      return name;
+    }
+
+  if (tbl->n == tbl->size)
+    {
+      tbl->size = tbl->size ? MIN(2 * tbl->size, NAME_TABLE_MAX) : 2;
+      tbl->heap = g_renew(name_t *, tbl->heap, tbl->size);
+    }
+  name->table_pos = tbl->n;
+  tbl->heap[tbl->n++] = name;
+  heap_up(tbl, name->table_pos);
+  index_add(tbl, name);
+  if (!tbl->top)
+    tbl->top = name;
+  return name;
+}
+
+/* to be called after the traffic of a name of tbl increased */
+void name_table_update(name_table_t *tbl, name_t *name)
+{
+  g_assert(tbl && name);
+  g_assert(name->table_pos < tbl->n && tbl->heap[name->table_pos] == name);
+
+  /* traffic only increases, so in a min-heap the name can only go down */
+  heap_down(tbl, name->table_pos);
+  if (name->accumulated > tbl->top->accumulated)
+    tbl->top = name;
+}
+
+/* busiest name, NULL if empty */
+const name_t *name_table_top(const name_table_t *tbl)
+{
+  if (!tbl)
+    return NULL;
+  return tbl->top;
+}
+
+static gint name_ptr_freq_compare(gconstpointer a, gconstpointer b)
+{
+  return node_name_freq_compare(*(const name_t * const *)a, 
+                                *(const name_t * const *)b);
+}
+
+/* returns a newly allocated array of the names, busiest first */
+const name_t **name_table_sorted(const name_table_t *tbl, guint *n)
+{
+  const name_t **names;
+
+  g_assert(n);
+  if (!tbl || !tbl->n)
+    {
+      *n = 0;
+      return NULL;
+    }
+  names = g_memdup(tbl->heap, tbl->n * sizeof(name_t *));
+  qsort(names, tbl->n, sizeof(name_t *), name_ptr_freq_compare);
+  *n = tbl->n;
+  return names;
+}
+
+/* adds name to the hash index, creating it when the table grows large */
+static void index_add(name_table_t *tbl, name_t *name)
+{
+  guint i;
+
+  if (!tbl->index)
+    {
+      if (tbl->n <= NAME_TABLE_LINEAR)
+        return;
+      tbl->index = g_hash_table_new((GHashFunc)node_id_hash, node_id_equal);
+      for (i = 0; i < tbl->n; ++i)
+        g_hash_table_insert(tbl->index, &tbl->heap[i]->node_id, tbl->heap[i]);
+      return;
+    }
+  g_hash_table_insert(tbl->index, &name->node_id, name);
+}
+
+static void heap_set(name_table_t *tbl, guint pos, name_t *name)
+{
+  tbl->heap[pos] = name;
+  name->table_pos = pos;
+}
+
+static void heap_up(name_table_t *tbl, guint pos)
+{
+  name_t *name = tbl->heap[pos];
+  guint parent;
+
+  while (pos)
+    {
+      parent = (pos - 1) / 2;
+      if (tbl->heap[parent]->accumulated <= name->accumulated)
+        break;
+      heap_set(tbl, pos, tbl->heap[parent]);
+      pos = parent;
+    }
+  heap_set(tbl, pos, name);
+}
+
+static void heap_down(name_table_t *tbl, guint pos)
+{
+  name_t *name = tbl->heap[pos];
+  guint child;
+
+  while ((child = 2 * pos + 1) < tbl->n)
+    {
+      if (child + 1 < tbl->n && 
+          tbl->heap[child + 1]->accumulated < tbl->heap[child]->accumulated)
+        child++;
+      if (name->accumulated <= tbl->heap[child]->accumulated)
+        break;
+      heap_set(tbl, pos, tbl->heap[child]);
+      pos = child;
+    }
+  heap_set(tbl, pos, name);
+}
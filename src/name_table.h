@@ -0,0 +1,47 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include "common.h"
+#include "node_id.h"
+
+/* Names seen with a protocol on a node, ranked by traffic.
+ * At most NAME_TABLE_MAX names are kept. When full, a new name replaces 
+ * the least used one and starts from its traffic (the Space-Saving 
+ * algorithm), so heavy hitters are never lost while the table stays bounded.
+ * Names are kept in a min-heap on accumulated traffic, and the busiest
+ * one is tracked while traffic is added, so no sorting is needed */
+#define NAME_TABLE_MAX 128
+
+typedef struct name_table_s name_table_t;
+
+name_table_t *name_table_new(void);
+void name_table_delete(name_table_t *tbl); /* deletes the names too */
+/* returns the name with node_id, adding it if missing */
+name_t *name_table_get(name_table_t *tbl, const node_id_t *node_id);
+/* to be called after the traffic of a name of tbl increased */
+void name_table_update(name_table_t *tbl, name_t *name);
+/* busiest name, NULL if empty */
+const name_t *name_table_top(const name_table_t *tbl);
+/* returns a newly allocated array of the names, busiest first */
+const name_t **name_table_sorted(const name_table_t *tbl, guint *n);
+
+#endif
@@ -20,10 +20,82 @@
 #include "appdata.h"
 #include "node.h"
 
-void get_packet_names (protostack_t *pstk,
+/* at most one name per direction for each protocol level */
+#define MAX_PACKET_NAMES (2 * (STACK_SIZE + 1))
+
+/* what the protocol decoder found at a level, to be named */
+typedef enum
+{
+  PACKET_ADDR_NODES,            /* addresses of both nodes */
+  PACKET_ADDR_ARP,              /* address of the asking node only */
+  PACKET_ADDR_IPXSAP,           /* names in the ipx-sap payload */
+  PACKET_ADDR_NBSS,             /* names in the netbios session payload */
+  PACKET_ADDR_NBDGM             /* names in the netbios datagram payload */
+}
+packet_addr_type_t;
+
+typedef struct
+{
+  packet_addr_type_t type;
+  guint8 level;                 /* protocol level */
+  node_id_t node_id[2];         /* addresses, indexed by direction */
+  guint offset;                 /* payload offset, for payload names */
+}
+packet_addr_t;
+
+/* all the addresses found decoding a packet, from the lowest level */
+typedef struct
+{
+  guint n_addrs;
+  packet_addr_t addrs[STACK_SIZE + 1];
+}
+packet_addrs_t;
+
+/* what a name found while decoding a packet is taken from */
+typedef enum
+{
+  PACKET_NAME_ADDR,             /* the node id, as an address */
+  PACKET_NAME_IPXSAP,           /* server name of a sap response */
+  PACKET_NAME_NETBIOS           /* encoded netbios name */
+}
+packet_name_type_t;
+
+/* a name found while decoding a packet. The name strings are formatted 
+ * only when given to a node */
+typedef struct
+{
+  guint8 level;                 /* protocol level of the name */
+  proto_atom_t protocol;        /* protocol at that level */
+  packet_direction dir;         /* INBOUND for the destination node, 
+                                 * OUTBOUND for the source */
+  packet_name_type_t type;
+  node_id_t node_id;
+  guint offset;                 /* of the name in the packet, if not an 
+                                 * address */
+}
+packet_name_t;
+
+/* all names found in a packet, for both nodes */
+typedef struct
+{
+  guint n_names;
+  gdouble packet_size;          /* bytes credited to each name */
+  const guint8 *packet;         /* captured data, for the payload names */
+  guint caplen;
+  guint8 *packet_copy;          /* copy made by packet_names_keep */
+  packet_name_t names[MAX_PACKET_NAMES];
+}
+packet_names_t;
+
+/* finds the names of a packet. Until packet_names_keep is called, the
+ * packet data must be valid while names are used */
+void get_packet_names (packet_names_t *names,
 		       const guint8 * packet,
 		       guint16 size,
 		       const packet_protos_t * prot_stack, 
-                       packet_direction direction,
-                       int link_type);
-
+                       const packet_addrs_t *addrs);
+/* copies the packet data needed by names, so they can outlive it */
+void packet_names_keep (packet_names_t *names);
+void packet_names_add (protostack_t *pstk, const packet_names_t *names,
+                       packet_direction dir);
+void packet_names_clear (packet_names_t *names);
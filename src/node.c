@@ -21,6 +21,7 @@
 #include <config.h>
 #endif
 
+#include <stdlib.h>
 #include "appdata.h"
 #include "node.h"
 #include "capture.h"
@@ -67,7 +68,19 @@ static name_decode_t tcp_sequence[] = {
     {NULL, FALSE}
 };
 
-static GTree *all_nodes = NULL;	/* Has all the nodes heard on the network */
+/* Has all the nodes heard on the network. 
+ * Open addressing hash table with linear probing, keyed on node_id */
+#define CATALOG_MIN_SLOTS 1024
+typedef struct
+{
+  node_t **slots;               /* NULL if empty */
+  guint n_slots;                /* power of two */
+  guint n_nodes;
+  timer_wheel_t *wheel;         /* schedules node updates */
+  gdouble node_timeout;         /* timeouts used for the scheduled updates */
+  gdouble proto_timeout;
+} node_catalog_t;
+static node_catalog_t *all_nodes = NULL;
 static gint nodes_num = 0;      /* nodes counter */
 
 /***************************************************************************
@@ -92,6 +105,8 @@ node_create(const node_id_t * node_id)
   g_assert(node);
 
   node->node_id = *node_id;
+  node->hash = node_id_hash(node_id);
+  node->n_links = 0;
 
   name = node_id_str(node_id);
   node->name = g_string_new(name);
@@ -99,9 +114,10 @@ node_create(const node_id_t * node_id)
   g_free(name);
 
   for (i = 0 ; i <= STACK_SIZE; ++i)
-      node->main_prot[i] = NULL;
+      node->main_prot[i] = PROTO_ATOM_NONE;
 
   traffic_stats_init(&node->node_stats);
+  wheel_timer_init(&node->update_timer);
 
   ++nodes_num;
 
@@ -131,11 +147,10 @@ void node_delete(node_t *node)
   node->numeric_name = NULL;
 
   for (i = 0; i <= STACK_SIZE; ++i)
-    if (node->main_prot[i])
-      {
-        g_free (node->main_prot[i]);
-        node->main_prot[i] = NULL;
-      }
+    {
+      proto_atom_unref(node->main_prot[i]);
+      node->main_prot[i] = PROTO_ATOM_NONE;
+    }
 
   traffic_stats_reset(&node->node_stats);
 
@@ -171,14 +186,14 @@ gchar *node_dump(const node_t * node)
 
   msg_mprot=g_strdup_printf("top: [%s], stack:", 
                             (node->main_prot[0]) ? 
-                            node->main_prot[0] : "-none-");
+                            proto_atom_name(node->main_prot[0]) : "-none-");
   
   for (i = 1; i <= STACK_SIZE; i++)
     {
       gchar *tmp = msg_mprot;
       msg_mprot = g_strdup_printf("%s %d:>%s<", msg_mprot, i, 
                            (node->main_prot[i]) ? 
-                           node->main_prot[i] : "-none-");
+                           proto_atom_name(node->main_prot[i]) : "-none-");
       g_free(tmp);
     }
 
@@ -226,40 +241,31 @@ gchar *node_xml(const node_t * node)
 
 /* This function is called to discard packets from the list 
  * of packets beloging to a node or a link, and to calculate
- * the average traffic for that node or link */
+ * the average traffic for that node or link. 
+ * Returns TRUE if the node expired and must be removed */
 gboolean
-node_update(node_id_t * node_id, node_t *node, gpointer delete_list_ptr)
+node_update(node_t *node)
 {
   double diffms;
 
-  g_assert(delete_list_ptr);
-
   if (traffic_stats_update(&node->node_stats, pref.averaging_time, 
                             pref.proto_node_timeout_time))
     {
       /* packet(s) active, update the most used protocols for this link */
-      guint i = STACK_SIZE;
-      while (i + 1)
-        {
-          if (node->main_prot[i])
-            g_free (node->main_prot[i]);
-          node->main_prot[i] = protocol_stack_sort_most_used(&node->node_stats.stats_protos, i);
-          i--;
-        }
+      protocol_stack_main_prots(&node->node_stats.stats_protos, 
+                                node->main_prot);
       node_name_update (node);
     }
   else
     {
       /* no packets remaining on node - if node expiration active, see if the
        * node is expired */
-      if (pref.node_timeout_time)
+      if (pref.node_timeout_time && !node->n_links)
         {
           diffms = substract_times_ms(&appdata.now, &node->node_stats.stats.last_time);
           if (diffms >= pref.node_timeout_time)
             {
               /* node expired, remove */
-              GList **delete_list = (GList **)delete_list_ptr;
-
               if (DEBUG_ENABLED)
                 {
                   gchar *msg = node_id_dump(&node->node_id);
@@ -270,9 +276,7 @@ node_update(node_id_t * node_id, node_t *node, gpointer delete_list_ptr)
               /* First thing we do is delete the node from the list of new_nodes,
                * if it's there */
               new_nodes_remove(node);
-    
-              /* adds current to list of nodes to be delete */
-              *delete_list = g_list_prepend( *delete_list, node_id);
+              return TRUE;
             }
         }
     }
@@ -285,24 +289,8 @@ node_update(node_id_t * node_id, node_t *node, gpointer delete_list_ptr)
 static void
 node_name_update(node_t * node)
 {
-  GList *protocol_item;
-  protocol_t *protocol;
-  guint i = STACK_SIZE;
-
-  /* for each level and each protocol at that level, sort names by traffic,
-   * placing the busiest at front */
-  for (i = 0 ; i <= STACK_SIZE ; ++i)
-    {
-      for ( protocol_item = node->node_stats.stats_protos.protostack[i]; 
-            protocol_item; 
-            protocol_item = protocol_item->next)
-        {
-          protocol = (protocol_t *) (protocol_item->data);
-          protocol->node_names
-            = g_list_sort (protocol->node_names, node_name_freq_compare);
-        }
-    }
-
+  /* the busiest name of each protocol is kept by its name table, 
+   * so there's nothing to sort */
   switch (appdata.mode)
     {
     case LINK6:
@@ -337,7 +325,6 @@ set_node_name (node_t * node, const name_decode_t *sequence)
   
   for (iter = sequence; iter->protocol && cont; ++iter)
     {
-      const GList *name_item;
       const name_t *name;
       const protocol_t *protocol;
       guint j;
@@ -351,15 +338,14 @@ set_node_name (node_t * node, const name_decode_t *sequence)
 	  if (!protocol || strcmp (protocol->name, iter->protocol))
             continue;
 
-          /* protocol found, we take the first name (i.e. the most used one) */
-          name_item = protocol->node_names;
-          if (!name_item)
+          /* protocol found, we take the most used name */
+          name = name_table_top(protocol->node_names);
+          if (!name)
             {
               g_my_debug("  found protocol without names, ignore");
               continue;
             }
 
-          name = (const name_t *) (name_item->data);
           if (DEBUG_ENABLED)
             {
               gchar *msgname = node_name_dump(name);
@@ -471,40 +457,117 @@ new_nodes_pop(void)
   return node;
 }
 
+/***************************************************************************
+ *
+ * dirty nodes methods
+ *
+ **************************************************************************/
+
+static GArray *dirty_nodes = NULL; /* ids of the nodes updated or removed
+                                    * since the last dirty_nodes_clear. 
+                                    * Removed nodes are gone, so ids are 
+                                    * kept instead of pointers */
+
+static void dirty_nodes_add(const node_id_t *node_id)
+{
+  if (!dirty_nodes)
+    dirty_nodes = g_array_new(FALSE, FALSE, sizeof(node_id_t));
+  g_array_append_val(dirty_nodes, *node_id);
+}
+
+void dirty_nodes_clear(void)
+{
+  if (dirty_nodes)
+    g_array_set_size(dirty_nodes, 0);
+}
+
+/* copies to node_id the last dirty node, removing it from the set. 
+ * A node can be returned more than once */
+gboolean dirty_nodes_pop(node_id_t *node_id)
+{
+  if (!dirty_nodes || !dirty_nodes->len)
+    return FALSE;
+
+  *node_id = g_array_index(dirty_nodes, node_id_t, dirty_nodes->len - 1);
+  g_array_set_size(dirty_nodes, dirty_nodes->len - 1);
+  return TRUE;
+}
+
 /***************************************************************************
  *
  * nodes catalog implementation
  *
  **************************************************************************/
 
-/* nodes catalog compare function */
-static gint nodes_catalog_compare(gconstpointer a, gconstpointer b, gpointer dummy)
+/* slot holding key, or the empty slot where it would go */
+static guint catalog_probe(const node_catalog_t *cat, const node_id_t *key,
+                           guint hash)
+{
+  guint mask = cat->n_slots - 1;
+  guint i = hash & mask;
+  const node_t *node;
+
+  while ((node = cat->slots[i]) != NULL)
+    {
+      if (node->hash == hash && !node_id_compare(&node->node_id, key))
+        break;
+      i = (i + 1) & mask;
+    }
+  return i;
+}
+
+static void catalog_resize(node_catalog_t *cat, guint n_slots)
 {
-  return node_id_compare( (const node_id_t *)a,  (const node_id_t *)b);
+  node_t **old_slots = cat->slots;
+  guint old_n = cat->n_slots;
+  guint i;
+
+  cat->slots = g_malloc0(n_slots * sizeof(node_t *));
+  cat->n_slots = n_slots;
+  for (i = 0; i < old_n; ++i)
+    {
+      node_t *node = old_slots[i];
+      if (node)
+        cat->slots[catalog_probe(cat, &node->node_id, node->hash)] = node;
+    }
+  g_free(old_slots);
 }
 
 /* initializes the catalog */
 void nodes_catalog_open(void)
 {
   g_assert(!all_nodes);
-  all_nodes = g_tree_new_full(nodes_catalog_compare, NULL, NULL, 
-                              (GDestroyNotify)node_delete);
+  all_nodes = g_malloc(sizeof(node_catalog_t));
+  all_nodes->slots = g_malloc0(CATALOG_MIN_SLOTS * sizeof(node_t *));
+  all_nodes->n_slots = CATALOG_MIN_SLOTS;
+  all_nodes->n_nodes = 0;
+  all_nodes->wheel = timer_wheel_new();
+  all_nodes->node_timeout = pref.node_timeout_time;
+  all_nodes->proto_timeout = pref.proto_node_timeout_time;
 }
 
 /* closes the catalog, releasing all nodes */
 void nodes_catalog_close(void)
 {
+  guint i;
+
   if (all_nodes)
   {
-    g_tree_destroy(all_nodes);
+    for (i = 0; i < all_nodes->n_slots; ++i)
+      node_delete(all_nodes->slots[i]);
+    g_free(all_nodes->slots);
+    timer_wheel_delete(all_nodes->wheel);
+    g_free(all_nodes);
     all_nodes = NULL;
   }
+  dirty_nodes_clear();
 }
 
 /* insert a new node */
 node_t *nodes_catalog_new(const node_id_t *node_id)
 {
   node_t *new_node;
+  guint i;
   
   g_assert(all_nodes);
   g_assert(node_id);
@@ -512,17 +575,70 @@ node_t *nodes_catalog_new(const node_id_t *node_id)
   new_node = node_create(node_id);
   if (!new_node)
     return NULL;
+
+  /* keeps load under 70% */
+  if ((all_nodes->n_nodes + 1) * 10 > all_nodes->n_slots * 7)
+    catalog_resize(all_nodes, all_nodes->n_slots * 2);
   
-  g_tree_insert (all_nodes, &new_node->node_id, new_node);
+  i = catalog_probe(all_nodes, &new_node->node_id, new_node->hash);
+  if (all_nodes->slots[i])
+    {
+      /* replaces the old node */
+      wheel_timer_cancel(all_nodes->wheel, &all_nodes->slots[i]->update_timer);
+      node_delete(all_nodes->slots[i]);
+    }
+  else
+    all_nodes->n_nodes++;
+  all_nodes->slots[i] = new_node;
+  nodes_catalog_touch(new_node);
   return new_node;
 }
 
 /* removes AND DESTROYS the named node from catalog */
 void nodes_catalog_remove(const node_id_t *key)
 {
+  guint mask;
+  guint i;
+  guint j;
+  guint home;
+  node_t *node;
+
   g_assert(all_nodes);
   g_assert(key);
-  g_tree_remove (all_nodes, key);
+
+  mask = all_nodes->n_slots - 1;
+  i = catalog_probe(all_nodes, key, node_id_hash(key));
+  node = all_nodes->slots[i];
+  if (!node)
+    return;
+  all_nodes->slots[i] = NULL;
+  all_nodes->n_nodes--;
+  dirty_nodes_add(&node->node_id);
+
+  /* no tombstones: moves back the following nodes of the cluster that 
+   * would be unreachable across the new hole */
+  for (j = (i + 1) & mask; all_nodes->slots[j]; j = (j + 1) & mask)
+    {
+      home = all_nodes->slots[j]->hash & mask;
+      if (((j - home) & mask) >= ((j - i) & mask))
+        {
+          all_nodes->slots[i] = all_nodes->slots[j];
+          all_nodes->slots[j] = NULL;
+          i = j;
+        }
+    }
+
+  /* key could point inside the node, so it's deleted last */
+  wheel_timer_cancel(all_nodes->wheel, &node->update_timer);
+  node_delete(node);
+}
+
+/* updates node at next nodes_catalog_update_all */
+void nodes_catalog_touch(node_t *node)
+{
+  if (all_nodes)
+    wheel_timer_expedite(all_nodes->wheel, &node->update_timer, 
+                         &appdata.now, 0);
 }
 
 /* finds a node */
@@ -532,7 +648,7 @@ node_t *nodes_catalog_find(const node_id_t *key)
   if (!all_nodes)
     return NULL;
 
-  return g_tree_lookup (all_nodes, key);
+  return all_nodes->slots[catalog_probe(all_nodes, key, node_id_hash(key))];
 }
 
 /* returns the current number of nodes in catalog */
@@ -541,46 +657,100 @@ gint nodes_catalog_size(void)
   if (!all_nodes)
     return 0;
 
-  return g_tree_nnodes (all_nodes);
+  return all_nodes->n_nodes;
+}
+
+static int node_ptr_compare(const void *a, const void *b)
+{
+  return node_id_compare(&(*(const node_t **)a)->node_id, 
+                         &(*(const node_t **)b)->node_id);
 }
 
- /* calls the func for every node */
+/* calls the func for every node, in node_id order. Stops if func 
+ * returns TRUE */
 void nodes_catalog_foreach(GTraverseFunc func, gpointer data)
 {
-  if (!all_nodes)
+  node_t **sorted;
+  guint i;
+  guint n;
+
+  if (!all_nodes || !all_nodes->n_nodes)
     return;
 
-  return g_tree_foreach(all_nodes, func, data);
+  sorted = g_malloc(all_nodes->n_nodes * sizeof(node_t *));
+  for (i = 0, n = 0; i < all_nodes->n_slots; ++i)
+    if (all_nodes->slots[i])
+      sorted[n++] = all_nodes->slots[i];
+  qsort(sorted, n, sizeof(node_t *), node_ptr_compare);
+
+  for (i = 0; i < n; ++i)
+    if (func(&sorted[i]->node_id, sorted[i], data))
+      break;
+  g_free(sorted);
 }
 
-/* gfunc called by g_list_foreach to remove the node */
-static void
-gfunc_remove_node(gpointer data, gpointer user_data)
+/* schedules the next update of node. Nodes with active packets are
+ * updated at every refresh; idle nodes only when a protocol or the node
+ * itself can expire */
+static void node_schedule(node_t *node)
+{
+  struct timeval oldest;
+
+  if (traffic_stats_active_packets(&node->node_stats))
+    {
+      wheel_timer_set(all_nodes->wheel, &node->update_timer, &appdata.now, 0);
+      return;
+    }
+
+  wheel_timer_cancel(all_nodes->wheel, &node->update_timer);
+  if (pref.node_timeout_time && !node->n_links)
+    wheel_timer_expedite(all_nodes->wheel, &node->update_timer, 
+                         &node->node_stats.stats.last_time, 
+                         pref.node_timeout_time);
+  if (pref.proto_node_timeout_time && 
+      protocol_stack_oldest_time(&node->node_stats.stats_protos, &oldest))
+    wheel_timer_expedite(all_nodes->wheel, &node->update_timer, &oldest,
+                         pref.proto_node_timeout_time);
+}
+
+static void node_timer_fired(wheel_timer_t *timer)
 {
-  nodes_catalog_remove( (const node_id_t *) data);
+  node_t *node;
+
+  node = (node_t *)((gchar *)timer - G_STRUCT_OFFSET(node_t, update_timer));
+  if (node_update(node))
+    nodes_catalog_remove(&node->node_id);
+  else
+    {
+      dirty_nodes_add(&node->node_id);
+      node_schedule(node);
+    }
 }
 
-/* Calls update_node for every node. This is actually a function that
- shouldn't be called often, because it might take a very long time 
- to complete */
+/* Updates the nodes that received packets, that are still active or
+ * whose expiration time is reached. Idle nodes aren't visited */
 void
 nodes_catalog_update_all(void)
 {
-  GList *delete_list = NULL;
+  guint i;
 
   if (!all_nodes)
     return;
 
-  /* we can't delete nodes while traversing the catalog, so while updating we 
-   * fill a list with the node_id's to remove */
-  nodes_catalog_foreach((GTraverseFunc) node_update, &delete_list);
+  if (all_nodes->node_timeout != pref.node_timeout_time ||
+      all_nodes->proto_timeout != pref.proto_node_timeout_time)
+    {
+      /* timeouts changed, every node must be scheduled again */
+      all_nodes->node_timeout = pref.node_timeout_time;
+      all_nodes->proto_timeout = pref.proto_node_timeout_time;
+      for (i = 0; i < all_nodes->n_slots; ++i)
+        if (all_nodes->slots[i])
+          nodes_catalog_touch(all_nodes->slots[i]);
+    }
 
-  /* after, remove all nodes on the list from catalog 
-   * WARNING: after this call, the list items are also destroyed */
-  g_list_foreach(delete_list, gfunc_remove_node, NULL);
-  
-  /* free the list - list items are already destroyed */
-  g_list_free(delete_list);
+  /* the nodes are removed as they expire, the fired timer is already 
+   * detached from the wheel */
+  timer_wheel_advance(all_nodes->wheel, &appdata.now, node_timer_fired);
 
   g_my_debug(_("Updated nodes. Active nodes %d"), nodes_catalog_size());
 }				/* update_nodes */
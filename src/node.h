@@ -21,15 +21,22 @@
 #define ETHERAPE_NODE_H
 
 #include "traffic_stats.h"
+#include "timer_wheel.h"
 
 typedef struct
 {
   node_id_t node_id;		/* node identification */
+  guint hash;                   /* hash of node_id, cached for the catalog */
+  guint n_links;                /* links referencing this node. The node
+                                 * can't expire while in use by a link, 
+                                 * its links expire first */
   GString *name;		/* String with a readable default name of the node */
   GString *numeric_name;	/* String with a numeric representation of the id */
 
-  gchar *main_prot[STACK_SIZE + 1];	/* Most common protocol for the node */
+  proto_atom_t main_prot[STACK_SIZE + 1]; /* Most common protocol for the node
+                                         * - referenced */
   traffic_stats_t node_stats;
+  wheel_timer_t update_timer;   /* next update - handled by the catalog */
 }
 node_t;
 
@@ -38,7 +45,7 @@ void node_delete(node_t *node); /* destroys a node, releasing memory */
 gchar *node_dump(const node_t * node);
 gchar *node_xml(const node_t * node);
 gint node_count(void); /* total number of nodes in memory */
-gboolean node_update(node_id_t * node_id, node_t *node, gpointer delete_list_ptr);
+gboolean node_update(node_t *node); /* TRUE if the node expired */
 
 /* methods to handle every new node not yet handled in the main app */
 void new_nodes_clear(void);
@@ -46,14 +53,20 @@ void new_nodes_add(node_t *node);
 void new_nodes_remove(node_t *node);
 node_t *new_nodes_pop(void);	/* Returns a new node that hasn't been heard of */
 
+/* methods to handle the nodes updated or removed by the catalog since
+ * the main app last looked at them */
+void dirty_nodes_clear(void);
+gboolean dirty_nodes_pop(node_id_t *node_id); /* FALSE if no node is left */
+
 /* nodes catalog methods */
 void nodes_catalog_open(void); /* initializes the catalog */
 void nodes_catalog_close(void); /* closes the catalog, releasing all nodes */
 node_t *nodes_catalog_find(const node_id_t *key); /* finds a node */
 node_t *nodes_catalog_new(const node_id_t *node_id); /* creates and inserts a new node */
 void nodes_catalog_remove(const node_id_t *key); /* removes AND DESTROYS the named node from catalog */
+void nodes_catalog_touch(node_t *node); /* updates node at next nodes_catalog_update_all */
 gint nodes_catalog_size(void); /* returns the current number of nodes in catalog */
-void nodes_catalog_foreach(GTraverseFunc func, gpointer data); /* calls the func for every node */
+void nodes_catalog_foreach(GTraverseFunc func, gpointer data); /* calls the func for every node, in node_id order */
 void nodes_catalog_update_all(void);
 
 /* returns a newly allocated str with a dump of all nodes */
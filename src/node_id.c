@@ -89,6 +89,42 @@ node_id_compare (const node_id_t * na, const node_id_t * nb)
   return i;
 }				/* node_id_compare */
 
+/* hash function for node ids, covering the same bytes compared by
+ * node_id_compare (FNV-1a) */
+guint
+node_id_hash (const node_id_t * id)
+{
+  const guint8 *p;
+  gsize len;
+  guint32 h = 2166136261U;
+
+  g_assert (id != NULL);
+  switch (id->node_type)
+    {
+    case LINK6:
+      p = id->addr.eth;
+      len = sizeof(id->addr.eth);
+      break;
+    case IP:
+      p = id->addr.ip.all8;
+      len = sizeof(id->addr.ip.all8);
+      break;
+    case TCP:
+      p = id->addr.tcp4.host.all8;
+      len = sizeof(id->addr.tcp4.host.all8)+sizeof(id->addr.tcp4.port);
+      break;
+    default:
+      p = NULL;
+      len = 0;
+      break;
+    }
+
+  h = (h ^ (guint32)id->node_type) * 16777619U;
+  while (len--)
+    h = (h ^ *p++) * 16777619U;
+  return h;
+}				/* node_id_hash */
+
 /* returns a newly allocated string with a human-readable id */
 gchar *node_id_str(const node_id_t *id)
 {
@@ -209,6 +245,7 @@ name_t * node_name_create(const node_id_t *node_id)
   name->accumulated = 0;
   name->numeric_name = NULL;
   name->res_name = NULL;
+  name->table_pos = 0;
   ++node_name_count;
     {
       gchar *gg = node_id_dump(node_id);
@@ -41,6 +41,7 @@ typedef struct
 } node_id_t;
 void node_id_clear(node_id_t *a);
 gint node_id_compare (const node_id_t *a, const node_id_t *b);
+guint node_id_hash (const node_id_t *id);
 /* returns a newly allocated string with a human-readable id */
 gchar *node_id_str(const node_id_t *id); 
 /* returns a newly allocated string with a dump of id */
@@ -55,6 +56,7 @@ typedef struct
   GString *numeric_name; /* readable version of node_id */
   GString *res_name; /* resolved name - NULL if not resolved */
   gdouble accumulated; /* total accumulated traffic */
+  guint table_pos; /* position in the owning name table */
 }
 name_t;
 
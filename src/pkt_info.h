@@ -21,6 +21,7 @@
 #define PKT_INFO_H
 
 #include "common.h"
+#include "proto_atoms.h"
 
 #define STACK_SIZE 5		/* How many protocol levels to keep
 				 * track of (+1 for the topmost one) */
@@ -34,15 +35,18 @@ typedef enum
 }
 packet_direction;
 
-/* stack of protocol names, one protocol per level */
+/* stack of protocols, one protocol atom per level. 
+ * Unused levels are PROTO_ATOM_NONE */
 typedef struct
 {
-  gchar *protonames[STACK_SIZE + 1];
+  proto_atom_t protos[STACK_SIZE + 1];
 } 
 packet_protos_t;
-/* init/delete of a packet_protos_t */
-packet_protos_t *packet_protos_init(void);
-void packet_protos_delete(packet_protos_t *pt);
+/* clears all levels of a packet_protos_t */
+void packet_protos_clear(packet_protos_t *pt);
+/* adds or releases a reference to the atoms of all levels */
+void packet_protos_ref(const packet_protos_t *pt);
+void packet_protos_unref(const packet_protos_t *pt);
 /* returns a newly allocated string with a dump of pt */
 gchar *packet_protos_dump(const packet_protos_t *pt);
 
@@ -50,14 +54,24 @@ gchar *packet_protos_dump(const packet_protos_t *pt);
 typedef struct
 {
   guint size;			/* Size in bytes of the packet */
+  guint n_packets;              /* packets summed in this one. Always 1, 
+                                 * except for accumulated stats */
   struct timeval timestamp;	/* Time at which the packet was heard */
-  packet_protos_t *prot_desc;	/* Packet protocol tree */
+  packet_protos_t prot_desc;	/* Packet protocol tree */
   guint ref_count;		/* How many structures are referencing this 
 				 * packet. When the count reaches zero the packet
 				 * is deleted */
 }
 packet_info_t;
 
+/* packet_info_t and packet_list_item_t are allocated from pools. 
+ * A packet holds references to the atoms of its prot_desc, taken by the 
+ * creator and released on delete */
+packet_info_t *packet_info_create(void);
+void packet_info_delete(packet_info_t *pkt);
+void packet_pools_trim(void); /* releases unused pool memory */
+gchar *packet_pools_dump(void); /* returns a new string with pool counters */
+
 /* items of a packet list. The "direction" item is used to update in/out 
  * stats */
 typedef struct
@@ -106,6 +106,9 @@ initialize_pref_controls(void)
   gtk_spin_button_set_value (spin, pref.averaging_time);
   spin = GTK_SPIN_BUTTON (glade_xml_get_widget (appdata.xml, "refresh_spin"));
   gtk_spin_button_set_value (spin, pref.refresh_period);
+  spin = GTK_SPIN_BUTTON (glade_xml_get_widget (appdata.xml, "capture_batch_spin"));
+  gtk_spin_button_set_range (spin, 1, CAPTURE_BATCH_MAX);
+  gtk_spin_button_set_value (spin, pref.capture_batch);
   spin = GTK_SPIN_BUTTON (glade_xml_get_widget (appdata.xml, "node_to_spin"));
   gtk_spin_button_set_value (spin, pref.node_timeout_time/MILLI);
   spin = GTK_SPIN_BUTTON (glade_xml_get_widget (appdata.xml, "gui_node_to_spin"));
@@ -190,6 +193,11 @@ initialize_pref_controls(void)
 		    GTK_SIGNAL_FUNC
 		    (on_refresh_spin_adjustment_changed),
 		    glade_xml_get_widget (appdata.xml, "canvas1"));
+  widget = glade_xml_get_widget (appdata.xml, "capture_batch_spin");
+  g_signal_connect (G_OBJECT (GTK_SPIN_BUTTON (widget)->adjustment),
+		    "value_changed",
+		    GTK_SIGNAL_FUNC
+		    (on_capture_batch_spin_adjustment_changed), NULL);
   widget = glade_xml_get_widget (appdata.xml, "node_to_spin");
   g_signal_connect (G_OBJECT (GTK_SPIN_BUTTON (widget)->adjustment),
 		    "value_changed",
@@ -301,6 +309,14 @@ on_refresh_spin_adjustment_changed (GtkAdjustment * adj, GtkWidget * canvas)
   change_refresh_period(adj->value);
 }
 
+void
+on_capture_batch_spin_adjustment_changed (GtkAdjustment * adj)
+{
+  /* same range accepted from the command line */
+  if (adj->value >= 1 && adj->value <= CAPTURE_BATCH_MAX)
+    pref.capture_batch = adj->value;
+}
+
 void
 on_node_to_spin_adjustment_changed (GtkAdjustment * adj)
 {
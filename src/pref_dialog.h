@@ -31,6 +31,7 @@ void change_refresh_period(guint32 newperiod);
 /* callbacks */
 void on_preferences1_activate (GtkMenuItem * menuitem, gpointer user_data);
 void on_averaging_spin_adjustment_changed (GtkAdjustment * adj);
+void on_capture_batch_spin_adjustment_changed (GtkAdjustment * adj);
 void on_refresh_spin_adjustment_changed (GtkAdjustment * adj,
 					 GtkWidget * canvas);
 void on_node_radius_slider_adjustment_changed (GtkAdjustment * adj);
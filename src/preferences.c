@@ -125,6 +125,7 @@ void init_config(struct pref_struct *p)
   p->center_node = NULL;
 
   p->averaging_time=3000;
+  p->capture_batch=0;
 }
 
 void set_default_config(struct pref_struct *p)
@@ -144,6 +145,7 @@ void set_default_config(struct pref_struct *p)
   p->node_radius_multiplier = 0.0005;
   p->link_node_ratio = 1.0;
   p->refresh_period = 100;
+  p->capture_batch = CAPTURE_BATCH_DEFAULT;
   p->size_mode = LINEAR;
   p->node_size_variable = INST_OUTBOUND;
   p->stack_level = 0;
@@ -207,6 +209,7 @@ void load_config(void)
   read_boolean_config(&pref.stationary, gkey, "stationary");
   read_boolean_config(&pref.name_res, gkey, "name_res");
   read_int_config((gint *)&pref.refresh_period, gkey, "refresh_period");
+  read_int_config((gint *)&pref.capture_batch, gkey, "capture_batch");
   read_int_config((gint *)&pref.size_mode, gkey, "size_mode");
   read_int_config((gint *)&pref.node_size_variable, gkey, "node_size_variable");
   read_int_config((gint *)&pref.stack_level, gkey, "stack_level");
@@ -280,6 +283,7 @@ void save_config(void)
   g_key_file_set_double(gkey, pref_group, "link_node_ratio",
 			  pref.link_node_ratio);
   g_key_file_set_integer(gkey, pref_group, "refresh_period", pref.refresh_period);
+  g_key_file_set_integer(gkey, pref_group, "capture_batch", pref.capture_batch);
   g_key_file_set_integer(gkey, pref_group, "size_mode", pref.size_mode);
   g_key_file_set_integer(gkey, pref_group, "node_size_variable",
 			pref.node_size_variable);
@@ -389,6 +393,7 @@ void copy_config(struct pref_struct *tgt, const struct pref_struct *src)
 
   tgt->refresh_period = src->refresh_period;
   tgt->averaging_time = src->averaging_time;
+  tgt->capture_batch = src->capture_batch;
 }
 
 static gint
@@ -25,6 +25,10 @@
 #endif
 #include "common.h"
 
+/* default and max packets read and decoded at once */
+#define CAPTURE_BATCH_DEFAULT 1000
+#define CAPTURE_BATCH_MAX 100000
+
 /* preferences data */
 struct pref_struct
 {
@@ -84,6 +88,8 @@ struct pref_struct
   guint32 refresh_period;	/* Time between diagram refreshes */
   gdouble averaging_time;	/* Microseconds of time we consider to
 				 * calculate traffic averages */
+  guint32 capture_batch;	/* Max number of packets read and decoded
+				 * at each capture wakeup */
 
 }
 pref;
@@ -0,0 +1,143 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "proto_atoms.h"
+
+static GHashTable *atoms_by_name = NULL; /* interned name -> atom */
+static GPtrArray *atom_names = NULL;     /* atom -> interned name, NULL if
+                                          * released */
+static GArray *atom_refs = NULL;         /* atom -> reference count */
+static GArray *free_atoms = NULL;        /* released atoms, to reuse */
+
+/***************************************************************************
+ *
+ * proto_atom_t implementation
+ *
+ **************************************************************************/
+proto_atom_t proto_atom_intern(const gchar *name)
+{
+  gpointer atom;
+  proto_atom_t new_atom;
+  guint zero = 0;
+
+  if (!name)
+    return PROTO_ATOM_NONE;
+
+  if (!atoms_by_name)
+    {
+      atoms_by_name = g_hash_table_new(g_str_hash, g_str_equal);
+      atom_names = g_ptr_array_new();
+      g_ptr_array_add(atom_names, NULL); /* PROTO_ATOM_NONE has no name */
+      atom_refs = g_array_new(FALSE, TRUE, sizeof(guint));
+      g_array_append_val(atom_refs, zero);
+      free_atoms = g_array_new(FALSE, FALSE, sizeof(proto_atom_t));
+    }
+  else
+    {
+      atom = g_hash_table_lookup(atoms_by_name, name);
+      if (atom)
+        return GPOINTER_TO_UINT(atom);
+    }
+
+  /* new name: atoms are simply the index in the names array. Released
+   * indexes are reused, keeping the arrays as small as the live atoms */
+  if (free_atoms->len)
+    {
+      new_atom = g_array_index(free_atoms, proto_atom_t, free_atoms->len - 1);
+      g_array_set_size(free_atoms, free_atoms->len - 1);
+      g_ptr_array_index(atom_names, new_atom) = g_strdup(name);
+    }
+  else
+    {
+      new_atom = atom_names->len;
+      g_ptr_array_add(atom_names, g_strdup(name));
+      g_array_append_val(atom_refs, zero);
+    }
+  g_hash_table_insert(atoms_by_name, g_ptr_array_index(atom_names, new_atom),
+                      GUINT_TO_POINTER(new_atom));
+  return new_atom;
+}
+
+void proto_atom_ref(proto_atom_t atom)
+{
+  if (atom == PROTO_ATOM_NONE)
+    return;
+  g_assert(atom_refs && atom < atom_refs->len && 
+           g_ptr_array_index(atom_names, atom));
+  g_array_index(atom_refs, guint, atom)++;
+}
+
+void proto_atom_unref(proto_atom_t atom)
+{
+  gchar *name;
+
+  if (atom == PROTO_ATOM_NONE)
+    return;
+  g_assert(atom_refs && atom < atom_refs->len && 
+           g_array_index(atom_refs, guint, atom) > 0);
+  if (--g_array_index(atom_refs, guint, atom))
+    return;
+
+  /* last reference, release */
+  name = g_ptr_array_index(atom_names, atom);
+  g_hash_table_remove(atoms_by_name, name);
+  g_free(name);
+  g_ptr_array_index(atom_names, atom) = NULL;
+  g_array_append_val(free_atoms, atom);
+}
+
+proto_atom_t proto_atom_find(const gchar *name)
+{
+  if (!name || !atoms_by_name)
+    return PROTO_ATOM_NONE;
+  return GPOINTER_TO_UINT(g_hash_table_lookup(atoms_by_name, name));
+}
+
+const gchar *proto_atom_name(proto_atom_t atom)
+{
+  if (!atom_names || atom >= atom_names->len)
+    return NULL;
+  return g_ptr_array_index(atom_names, atom);
+}
+
+guint proto_atoms_count(void)
+{
+  if (!atom_names)
+    return 0;
+  return atom_names->len - 1 - free_atoms->len;
+}
+
+void proto_atoms_clear(void)
+{
+  if (!atoms_by_name)
+    return;
+  g_hash_table_destroy(atoms_by_name);
+  atoms_by_name = NULL;
+  g_ptr_array_foreach(atom_names, (GFunc)g_free, NULL);
+  g_ptr_array_free(atom_names, TRUE);
+  atom_names = NULL;
+  g_array_free(atom_refs, TRUE);
+  atom_refs = NULL;
+  g_array_free(free_atoms, TRUE);
+  free_atoms = NULL;
+}
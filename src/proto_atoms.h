@@ -0,0 +1,50 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef PROTO_ATOMS_H
+#define PROTO_ATOMS_H
+
+#include <glib.h>
+
+/* Protocol names are interned into small integer atoms, so that the
+ * per-packet code can store and compare integers instead of strings.
+ * Atoms are reference counted. Whoever keeps an atom past the decode of
+ * the current packet (packets, protocols, caches, static tables) takes a
+ * reference, and the atom with its name is released with the last one, 
+ * so that names made from port numbers don't pile up. A new atom has no
+ * references, and lives until referenced and released */
+typedef guint32 proto_atom_t;
+
+#define PROTO_ATOM_NONE 0       /* no protocol */
+
+/* returns the atom of name, creating it if needed */
+proto_atom_t proto_atom_intern(const gchar *name);
+/* adds and releases references, PROTO_ATOM_NONE is ignored */
+void proto_atom_ref(proto_atom_t atom);
+void proto_atom_unref(proto_atom_t atom);
+/* returns the atom of name, or PROTO_ATOM_NONE if never interned */
+proto_atom_t proto_atom_find(const gchar *name);
+/* returns the interned name of atom, NULL for PROTO_ATOM_NONE */
+const gchar *proto_atom_name(proto_atom_t atom);
+/* number of atoms alive */
+guint proto_atoms_count(void);
+/* frees all atoms */
+void proto_atoms_clear(void);
+
+#endif
@@ -29,8 +29,14 @@
 #include "preferences.h"
 #include "util.h"
 
-static gint 
-protocol_compare (gconstpointer a, gconstpointer b);
+/* table size when a level outgrows its inline storage */
+#define PROTOLEVEL_MIN_SLOTS 8
+
+static protocol_t *level_next(const protolevel_t *lvl, guint *pos);
+static protocol_t *level_find(const protolevel_t *lvl, proto_atom_t atom);
+static void level_add(protolevel_t *lvl, protocol_t *prot);
+static void level_remove_prev(protolevel_t *lvl, guint *pos);
+static void level_clear(protolevel_t *lvl);
 
 
 /***************************************************************************
@@ -44,32 +50,27 @@ void protocol_stack_open(protostack_t *pstk)
   g_assert(pstk);
   guint i;
   for (i = 0 ; i <= STACK_SIZE ; ++i)
-    pstk->protostack[i] = NULL;
+    {
+      pstk->protostack[i].n = 0;
+      pstk->protostack[i].mask = 0;
+      pstk->protostack[i].top = NULL;
+    }
 }
 
 void protocol_stack_reset(protostack_t *pstk)
 {
   guint i;
-  protocol_t *protocol_info;
 
   g_assert(pstk);
   for (i = 0 ; i <= STACK_SIZE ; ++i)
-    {
-      while (pstk->protostack[i])
-        {
-          protocol_info = pstk->protostack[i]->data;
-
-          protocol_t_delete(protocol_info);
-          pstk->protostack[i] = g_list_delete_link (pstk->protostack[i], pstk->protostack[i]);
-        }
-    }
+    level_clear(&pstk->protostack[i]);
 }
 
 /* adds the given packet to the stack */
 void
 protocol_stack_add_pkt(protostack_t *pstk, const packet_info_t * packet)
 {
-  GList *protocol_item;
+  protolevel_t *lvl;
   protocol_t *protocol_info;
   guint i;
 
@@ -78,23 +79,28 @@ protocol_stack_add_pkt(protostack_t *pstk, const packet_info_t * packet)
 
   for (i = 0; i <= STACK_SIZE; i++)
     {
-      if (!(packet->prot_desc->protonames[i]))
+      proto_atom_t atom = packet->prot_desc.protos[i];
+      if (!atom)
         continue;
       
-      protocol_item = g_list_find_custom (pstk->protostack[i],
-                                          packet->prot_desc->protonames[i],
-                                          protocol_compare);
-      if (protocol_item)
-        protocol_info = protocol_item->data;
-      else
+      lvl = &pstk->protostack[i];
+      protocol_info = level_find(lvl, atom);
+      if (!protocol_info)
 	{
           /* If there is yet not such protocol, create it */
-	  protocol_info = protocol_t_create(packet->prot_desc->protonames[i]);
-	  pstk->protostack[i] = g_list_prepend (pstk->protostack[i], protocol_info);
+	  protocol_info = protocol_t_create(atom);
+	  level_add(lvl, protocol_info);
 	}
 
-      g_assert( !strcmp(protocol_info->name, packet->prot_desc->protonames[i]));
-      basic_stats_add(&protocol_info->stats, packet->size);
+      basic_stats_add_packets(&protocol_info->stats, packet->size, 
+                              packet->n_packets);
+
+      /* accumulated traffic never decreases, so the leader changes only
+       * when another protocol overtakes it, or when it's purged */
+      if (lvl->top ? 
+          protocol_info->stats.accumulated > lvl->top->stats.accumulated :
+          lvl->n == 1)
+        lvl->top = protocol_info;
     }
 }				/* add_protocol */
 
@@ -102,7 +108,6 @@ protocol_stack_add_pkt(protostack_t *pstk, const packet_info_t * packet)
 void protocol_stack_sub_pkt(protostack_t *pstk, const packet_info_t * packet)
 {
   guint i = 0;
-  GList *item = NULL;
   protocol_t *protocol = NULL;
 
   g_assert(pstk);
@@ -111,20 +116,16 @@ void protocol_stack_sub_pkt(protostack_t *pstk, const packet_info_t * packet)
     return;
 
   /* We remove protocol aggregate information */
-  while ((i <= STACK_SIZE) && packet->prot_desc->protonames[i])
+  while ((i <= STACK_SIZE) && packet->prot_desc.protos[i])
     {
-      item = g_list_find_custom (pstk->protostack[i],
-                                 packet->prot_desc->protonames[i],
-                                 protocol_compare);
-      if (!item)
+      protocol = level_find(&pstk->protostack[i], packet->prot_desc.protos[i]);
+      if (!protocol)
         {
           g_my_critical
             ("Protocol not found while subtracting packet in protocol_stack_sub_pkt");
           break;
         }
-      protocol = item->data;
 
-      g_assert( !strcmp(protocol->name, packet->prot_desc->protonames[i]));
       basic_stats_sub(&protocol->stats, packet->size);
       i++;
     }
@@ -134,21 +135,35 @@ void protocol_stack_sub_pkt(protostack_t *pstk, const packet_info_t * packet)
 void
 protocol_stack_avg(protostack_t *pstk, gdouble avgtime)
 {
-  GList *item;
   protocol_t *protocol;
+  guint pos;
   guint i;
 
   g_assert(pstk);
 
   for (i = 0; i <= STACK_SIZE; i++)
     {
-      item = pstk->protostack[i];
-      while (item)
-        {
-          protocol = (protocol_t *)item->data;
-          basic_stats_avg(&protocol->stats, avgtime);
-          item = item->next;
-        }
+      pos = 0;
+      while ((protocol = level_next(&pstk->protostack[i], &pos)))
+        basic_stats_avg(&protocol->stats, avgtime);
+    }
+}
+
+/* removes expired traffic from protocols with bucketed stats */
+void
+protocol_stack_expire(protostack_t *pstk, gdouble avgtime)
+{
+  protocol_t *protocol;
+  guint pos;
+  guint i;
+
+  g_assert(pstk);
+
+  for (i = 0; i <= STACK_SIZE; i++)
+    {
+      pos = 0;
+      while ((protocol = level_next(&pstk->protostack[i], &pos)))
+        basic_stats_expire(&protocol->stats, avgtime);
     }
 }
 
@@ -160,87 +175,138 @@ protocol_stack_purge_expired(protostack_t *pstk, double expire_time)
 
   if (expire_time>0)
     {
-      GList *item;
-      GList *next_item;
       protocol_t *protocol;
       double diffms;
+      guint pos;
       guint i;
       for (i = 0; i <= STACK_SIZE; i++)
         {
-          item = pstk->protostack[i];
-          while (item)
+          pos = 0;
+          while ((protocol = level_next(&pstk->protostack[i], &pos)))
             {
-              protocol = (protocol_t *)item->data;
-              next_item = item->next;
               if (protocol->stats.aver_accu<=0)
                 {
                   /* no traffic active on this proto, check purging */
                   diffms = substract_times_ms(&appdata.now, &protocol->stats.last_time);
                   if (diffms >= expire_time)
                     {
+                      level_remove_prev(&pstk->protostack[i], &pos);
                       protocol_t_delete(protocol);
-                      pstk->protostack[i] = g_list_delete_link(pstk->protostack[i], item);
                     }
                 }
-              item = next_item;
             }
         }
     }
 }
 
-
-/* finds named protocol in the level protocols of protostack*/
-const protocol_t *protocol_stack_find(const protostack_t *pstk, size_t level, const gchar *protoname)
+/* oldest last packet time of the protocols in stack. FALSE if empty */
+gboolean protocol_stack_oldest_time(const protostack_t *pstk, 
+                                    struct timeval *oldest)
 {
-  GList *item;
+  const protocol_t *protocol;
+  gboolean found = FALSE;
+  guint pos;
+  guint i;
+
+  g_assert(pstk && oldest);
+
+  for (i = 0; i <= STACK_SIZE; i++)
+    {
+      pos = 0;
+      while ((protocol = level_next(&pstk->protostack[i], &pos)))
+        {
+          if (!found || timercmp(&protocol->stats.last_time, oldest, <))
+            *oldest = protocol->stats.last_time;
+          found = TRUE;
+        }
+    }
+  return found;
+}
 
+/* iterates on protocols of the requested level */
+const protocol_t *protocol_stack_next(const protostack_t *pstk, size_t level,
+                                      guint *pos)
+{
   g_assert(pstk);
 
-  if (level>STACK_SIZE || !protoname)
+  if (level>STACK_SIZE)
     return NULL;
-  
-  item = g_list_find_custom (pstk->protostack[level], protoname, protocol_compare);
-  if (item && item->data)
-    return item->data;
-
-  return NULL;
+  return level_next(&pstk->protostack[level], pos);
 }
 
-/* Comparison function to sort protocols by their accumulated traffic */
-static gint
-prot_freq_compare (gconstpointer a, gconstpointer b)
+/* number of protocols in the requested level */
+guint protocol_stack_level_size(const protostack_t *pstk, size_t level)
 {
-  const protocol_t *prot_a, *prot_b;
+  g_assert(pstk);
 
-  g_assert (a != NULL);
-  g_assert (b != NULL);
+  if (level>STACK_SIZE)
+    return 0;
+  return pstk->protostack[level].n;
+}
 
-  prot_a = (const protocol_t *) a;
-  prot_b = (const protocol_t *) b;
+/* finds named protocol in the level protocols of protostack*/
+const protocol_t *protocol_stack_find(const protostack_t *pstk, size_t level, const gchar *protoname)
+{
+  return protocol_stack_find_atom(pstk, level, proto_atom_find(protoname));
+}
 
-  if (prot_a->stats.accumulated > prot_b->stats.accumulated)
-    return -1;
-  if (prot_a->stats.accumulated < prot_b->stats.accumulated)
-    return 1;
-  return 0;
-}				/* prot_freq_compare */
+/* finds protocol atom in the level protocols of protostack*/
+const protocol_t *protocol_stack_find_atom(const protostack_t *pstk, size_t level, proto_atom_t atom)
+{
+  g_assert(pstk);
 
+  if (level>STACK_SIZE || !atom)
+    return NULL;
+  
+  return level_find(&pstk->protostack[level], atom);
+}
 
-/* sorts on the most used protocol in the requested level and returns it */
-gchar *
-protocol_stack_sort_most_used(protostack_t *pstk, size_t level)
+/* returns the most used protocol in the requested level. The leader is kept
+ * while adding packets, the level is scanned only after it was purged */
+proto_atom_t
+protocol_stack_most_used(protostack_t *pstk, size_t level)
 {
+  protolevel_t *lvl;
   protocol_t *protocol;
+  guint pos = 0;
 
   /* If we haven't recognized any protocol at that level,
    * we say it's unknown */
-  if (level>STACK_SIZE || !pstk || !pstk->protostack[level])
-    return NULL;
-  pstk->protostack[level] = g_list_sort (pstk->protostack[level], prot_freq_compare);
-  protocol = (protocol_t *) pstk->protostack[level]->data;
-  return g_strdup (protocol->name);
+  if (level>STACK_SIZE || !pstk)
+    return PROTO_ATOM_NONE;
+
+  lvl = &pstk->protostack[level];
+  if (!lvl->top)
+    {
+      while ((protocol = level_next(lvl, &pos)))
+        {
+          if (!lvl->top || 
+              protocol->stats.accumulated > lvl->top->stats.accumulated)
+            lvl->top = protocol;
+        }
+      if (!lvl->top)
+        return PROTO_ATOM_NONE;
+    }
+  return lvl->top->atom;
 }				/* get_main_prot */
 
+void protocol_stack_main_prots(protostack_t *pstk, proto_atom_t *main_prot)
+{
+  proto_atom_t atom;
+  guint i;
+
+  for (i = 0; i <= STACK_SIZE; ++i)
+    {
+      atom = protocol_stack_most_used(pstk, i);
+      if (atom != main_prot[i])
+        {
+          proto_atom_ref(atom);
+          proto_atom_unref(main_prot[i]);
+          main_prot[i] = atom;
+        }
+    }
+}
+
 /* returns a newly allocated string with a dump of pstk */
 gchar *protocol_stack_dump(const protostack_t *pstk)
 {
@@ -255,17 +321,16 @@ gchar *protocol_stack_dump(const protostack_t *pstk)
     {
       gchar *msg_level;
       gchar *tmp;
-      if (!pstk->protostack[i])
+      if (!pstk->protostack[i].n)
         msg_level = g_strdup("-none-");
       else
         {
-          const GList *cur_el = pstk->protostack[i];
+          const protocol_t *p;
+          guint pos = 0;
           msg_level = NULL;
-          while (cur_el)
+          while ((p = level_next(&pstk->protostack[i], &pos)))
             {
               gchar *msg_proto;
-              const protocol_t *p = (const protocol_t *)(cur_el->data);
-              g_assert(p);
 
               msg_proto = protocol_t_dump(p);
               if (!msg_level)
@@ -277,7 +342,6 @@ gchar *protocol_stack_dump(const protostack_t *pstk)
                   g_free(tmp);
                   g_free(msg_proto);
                 }
-              cur_el = cur_el->next;
             }
         }
       tmp = msg;
@@ -303,16 +367,15 @@ gchar *protocol_stack_xml(const protostack_t *pstk)
     {
       gchar *msg_level;
       gchar *tmp;
-      if (!pstk->protostack[i])
+      const protocol_t *p;
+      guint pos = 0;
+      if (!pstk->protostack[i].n)
         continue;
 
-      const GList *cur_el = pstk->protostack[i];
       msg_level = NULL;
-      while (cur_el)
+      while ((p = level_next(&pstk->protostack[i], &pos)))
         {
           gchar *msg_proto;
-          const protocol_t *p = (const protocol_t *)(cur_el->data);
-          g_assert(p);
 
           msg_proto = protocol_t_xml(p, i);
           if (!msg_level)
@@ -324,7 +387,6 @@ gchar *protocol_stack_xml(const protostack_t *pstk)
               g_free(tmp);
               g_free(msg_proto);
             }
-          cur_el = cur_el->next;
         }
       tmp = msg;
       msg = g_strdup_printf("%s%s", tmp, msg_level);
@@ -336,19 +398,172 @@ gchar *protocol_stack_xml(const protostack_t *pstk)
   return xml;
 }
 
+/***************************************************************************
+ *
+ * protolevel_t implementation
+ *
+ **************************************************************************/
+
+/* atoms are small sequential integers, so the low bits are already
+ * well distributed */
+#define LEVEL_HOME(atom, mask) ((atom) & (mask))
+
+/* returns the protocol at *pos or after, advancing *pos past it. 
+ * NULL at the end */
+static protocol_t *level_next(const protolevel_t *lvl, guint *pos)
+{
+  protocol_t *prot;
+
+  if (!lvl->mask)
+    return (*pos < lvl->n) ? lvl->u.inl[(*pos)++] : NULL;
+
+  while (*pos <= lvl->mask)
+    {
+      prot = lvl->u.slots[(*pos)++];
+      if (prot)
+        return prot;
+    }
+  return NULL;
+}
+
+static protocol_t *level_find(const protolevel_t *lvl, proto_atom_t atom)
+{
+  protocol_t *prot;
+  guint i;
+
+  if (!lvl->mask)
+    {
+      for (i = 0; i < lvl->n; ++i)
+        if (lvl->u.inl[i]->atom == atom)
+          return lvl->u.inl[i];
+      return NULL;
+    }
+
+  for (i = LEVEL_HOME(atom, lvl->mask); (prot = lvl->u.slots[i]); 
+       i = (i + 1) & lvl->mask)
+    if (prot->atom == atom)
+      return prot;
+  return NULL;
+}
+
+/* puts prot in the first free slot from its home. The table must have 
+ * at least one free slot */
+static void table_insert(protocol_t **slots, guint mask, protocol_t *prot)
+{
+  guint i;
+
+  for (i = LEVEL_HOME(prot->atom, mask); slots[i]; i = (i + 1) & mask)
+    ;
+  slots[i] = prot;
+}
+
+/* adds a protocol not yet present */
+static void level_add(protolevel_t *lvl, protocol_t *prot)
+{
+  protocol_t **slots;
+  protocol_t *cur;
+  guint mask;
+  guint pos;
+
+  if (!lvl->mask && lvl->n < PROTOLEVEL_INLINE)
+    {
+      lvl->u.inl[lvl->n++] = prot;
+      return;
+    }
+
+  /* tables are kept at most half full, to keep probe sequences short */
+  if (!lvl->mask || 2 * (lvl->n + 1) > lvl->mask + 1)
+    {
+      mask = lvl->mask ? 2 * lvl->mask + 1 : PROTOLEVEL_MIN_SLOTS - 1;
+      slots = g_malloc0((mask + 1) * sizeof(protocol_t *));
+      pos = 0;
+      while ((cur = level_next(lvl, &pos)))
+        table_insert(slots, mask, cur);
+      if (lvl->mask)
+        g_free(lvl->u.slots);
+      lvl->u.slots = slots;
+      lvl->mask = mask;
+    }
+
+  table_insert(lvl->u.slots, lvl->mask, prot);
+  lvl->n++;
+}
+
+/* removes the protocol just returned by level_next, moving *pos back so
+ * that the protocol taking its place isn't skipped */
+static void level_remove_prev(protolevel_t *lvl, guint *pos)
+{
+  protocol_t *prot;
+  guint hole;
+  guint home;
+  guint i;
+
+  g_assert(*pos > 0);
+  hole = --(*pos);
+
+  prot = lvl->mask ? lvl->u.slots[hole] : lvl->u.inl[hole];
+  if (prot == lvl->top)
+    lvl->top = NULL; /* found again at next request */
+
+  if (!lvl->mask)
+    {
+      lvl->u.inl[hole] = lvl->u.inl[--lvl->n];
+      return;
+    }
+
+  /* backward shift deletion: following entries of the same probe run
+   * are moved into the hole, so no tombstones are needed */
+  lvl->u.slots[hole] = NULL;
+  for (i = (hole + 1) & lvl->mask; (prot = lvl->u.slots[i]); 
+       i = (i + 1) & lvl->mask)
+    {
+      home = LEVEL_HOME(prot->atom, lvl->mask);
+      /* prot can fill the hole only if its home isn't in (hole, i] */
+      if (hole <= i ? (home <= hole || home > i) : (home <= hole && home > i))
+        {
+          lvl->u.slots[hole] = prot;
+          lvl->u.slots[i] = NULL;
+          hole = i;
+        }
+    }
+
+  if (!--lvl->n)
+    {
+      g_free(lvl->u.slots);
+      lvl->mask = 0;
+    }
+}
+
+/* deletes all protocols */
+static void level_clear(protolevel_t *lvl)
+{
+  protocol_t *prot;
+  guint pos = 0;
+
+  while ((prot = level_next(lvl, &pos)))
+    protocol_t_delete(prot);
+  if (lvl->mask)
+    g_free(lvl->u.slots);
+  lvl->n = 0;
+  lvl->mask = 0;
+  lvl->top = NULL;
+}
+
 /***************************************************************************
  *
  * protocol_t implementation
  *
  **************************************************************************/
-protocol_t *protocol_t_create(const gchar *protocol_name)
+protocol_t *protocol_t_create(proto_atom_t atom)
 {
   protocol_t *pr = NULL;
 
   pr = g_malloc (sizeof (protocol_t));
   g_assert(pr);
-  pr->name = g_strdup (protocol_name);
-  basic_stats_reset(&pr->stats);
+  pr->atom = atom;
+  proto_atom_ref(atom);
+  pr->name = proto_atom_name(atom);
+  basic_stats_open(&pr->stats);
   pr->node_names = NULL;
 
   return pr;
@@ -358,16 +573,12 @@ void protocol_t_delete(protocol_t *prot)
 {
   g_assert(prot);
 
-  g_free (prot->name);
   prot->name = NULL;
+  proto_atom_unref(prot->atom);
+  basic_stats_close(&prot->stats);
 
-  while (prot->node_names)
-    {
-      GList *name_item = prot->node_names;
-      name_t *name = name_item->data;
-      node_name_delete(name);
-      prot->node_names = g_list_delete_link (prot->node_names, name_item);
-    }
+  name_table_delete(prot->node_names);
+  prot->node_names = NULL;
 
   g_free (prot);
 }
@@ -378,26 +589,26 @@ gchar *protocol_t_dump(const protocol_t *prot)
   gchar *msg;
   gchar *msg_stats;
   gchar *msg_names;
+  const name_t **names;
+  guint n_names;
+  guint i;
 
   if (!prot)
     return g_strdup("protocol_t NULL");
 
   msg_stats = basic_stats_dump(&prot->stats);
 
-  if (!prot->node_names)
+  names = name_table_sorted(prot->node_names, &n_names);
+  if (!n_names)
     msg_names = g_strdup("-- no names --");
   else
     {
-      const GList *cur_el;
       msg_names = NULL;
-      cur_el = prot->node_names;
-      while (cur_el)
+      for (i = 0; i < n_names; ++i)
         {
           gchar *str_name;
-          const name_t *cur_name;
 
-          cur_name = (const name_t *)(cur_el->data);
-          str_name = node_name_dump(cur_name);
+          str_name = node_name_dump(names[i]);
           if (!msg_names)
             msg_names = str_name;
           else
@@ -407,9 +618,9 @@ gchar *protocol_t_dump(const protocol_t *prot)
               g_free(tmp);
               g_free(str_name);
             }
-          cur_el = cur_el->next;
         }
     }
+  g_free(names);
   
   msg = g_strdup_printf("protocol name: %s, stats [%s], "
                          "node_names [%s]",
@@ -426,26 +637,26 @@ gchar *protocol_t_xml(const protocol_t *prot, guint level)
   gchar *msg;
   gchar *msg_stats;
   gchar *msg_names;
+  const name_t **names;
+  guint n_names;
+  guint i;
 
   if (!prot)
     return xmltag("protocol","");
 
   msg_stats = basic_stats_xml(&prot->stats);
 
-  if (!prot->node_names)
+  names = name_table_sorted(prot->node_names, &n_names);
+  if (!n_names)
     msg_names = g_strdup("");
   else
     {
-      const GList *cur_el;
       msg_names = NULL;
-      cur_el = prot->node_names;
-      while (cur_el)
+      for (i = 0; i < n_names; ++i)
         {
           gchar *str_name;
-          const name_t *cur_name;
 
-          cur_name = (const name_t *)(cur_el->data);
-          str_name = node_name_xml(cur_name);
+          str_name = node_name_xml(names[i]);
           if (!msg_names)
             msg_names = str_name;
           else
@@ -455,9 +666,9 @@ gchar *protocol_t_xml(const protocol_t *prot, guint level)
               g_free(tmp);
               g_free(str_name);
             }
-          cur_el = cur_el->next;
         }
     }
+  g_free(names);
   
   msg = xmltag("protocol", 
                "\n<level>%u</level>\n<key>%s</key>\n%s%s",
@@ -471,16 +682,6 @@ gchar *protocol_t_xml(const protocol_t *prot, guint level)
 }
 
 
-/* Comparison function used to compare two link protocols */
-static gint
-protocol_compare (gconstpointer a, gconstpointer b)
-{
-  g_assert (a != NULL);
-  g_assert (b != NULL);
-
-  return strcmp (((const protocol_t *) a)->name, b);
-}
-
 /***************************************************************************
  *
  * protocol_summary_t implementation
@@ -535,13 +736,7 @@ long protocol_summary_size(void)
   if (!protosummary_stats)
     return 0;
   for (i = 0; i <= STACK_SIZE ; ++i)
-    {
-      if (protosummary_stats->stats_protos.protostack[i])
-        {
-          totproto += 
-              g_list_length(protosummary_stats->stats_protos.protostack[i]);
-        }
-    }
+    totproto += protosummary_stats->stats_protos.protostack[i].n;
   return totproto;
 }
 
@@ -549,9 +744,13 @@ long protocol_summary_size(void)
 /* calls func for every protocol at the specified level */
 void protocol_summary_foreach(size_t level, GFunc func, gpointer data)
 {
+  const protocol_t *protocol;
+  guint pos = 0;
+
   if (!protosummary_stats || level > STACK_SIZE)
     return;
-  g_list_foreach (protosummary_stats->stats_protos.protostack[level], func, data);
+  while ((protocol = level_next(&protosummary_stats->stats_protos.protostack[level], &pos)))
+    func((gpointer)protocol, data);
 }
 
 
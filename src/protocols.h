@@ -23,27 +23,45 @@
 
 #include "basic_stats.h"
 #include "node_id.h"
+#include "name_table.h"
 
 /* Information about each protocol heard on a link */
 typedef struct
 {
-  gchar *name;			/* Name of the protocol */
+  proto_atom_t atom;		/* protocol atom */
+  const gchar *name;		/* Name of the protocol - interned, not owned */
   basic_stats_t stats;
-  GList *node_names;		/* A list of all node names (name_t) used with
-				 * this protocol (used in node protocols) */
+  name_table_t *node_names;	/* node names (name_t) used with this protocol,
+				 * NULL if none (used in node protocols) */
 } protocol_t;
 
-protocol_t *protocol_t_create(const gchar *protocol_name);
+protocol_t *protocol_t_create(proto_atom_t atom);
 void protocol_t_delete(protocol_t *prot);
 /* returns a new string with a dump of prot */
 gchar *protocol_t_dump(const protocol_t *prot);
 /* returns a new string with an xml dump of prot */
 gchar *protocol_t_xml(const protocol_t *prot, guint level);
 
+/* protocols heard at a single stack level, keyed by atom.
+ * Most levels carry only a few protocols, stored inline. Past that, they
+ * move to an open addressed table with linear probing */
+#define PROTOLEVEL_INLINE 3
 typedef struct
 {
-  GList *protostack[STACK_SIZE + 1];	/* It's a stack. Each level is a list of 
-                                         * all protocol_t heard at that level */
+  guint n;              /* protocols at this level */
+  guint mask;           /* table slots - 1, zero while inline */
+  protocol_t *top;      /* most used protocol, NULL if it must be found again */
+  union
+  {
+    protocol_t *inl[PROTOLEVEL_INLINE];
+    protocol_t **slots;
+  } u;
+} protolevel_t;
+
+typedef struct
+{
+  protolevel_t protostack[STACK_SIZE + 1];  /* It's a stack. Each level holds
+                                             * all protocol_t heard there */
 } protostack_t;
 
 /* protocol stack methods */
@@ -55,12 +73,29 @@ void protocol_stack_add_pkt(protostack_t *pstk, const packet_info_t * packet);
 void protocol_stack_sub_pkt(protostack_t *pstk, const packet_info_t * packet);
 /* calculates averages */
 void protocol_stack_avg(protostack_t *pstk, gdouble avg_usecs);
+/* removes expired traffic from protocols with bucketed stats */
+void protocol_stack_expire(protostack_t *pstk, gdouble avg_msecs);
 /* checks for protocol expiration ... */
 void protocol_stack_purge_expired(protostack_t *pstk, double expire_time);
+/* oldest last packet time of the protocols in stack. FALSE if empty */
+gboolean protocol_stack_oldest_time(const protostack_t *pstk, 
+                                    struct timeval *oldest);
+/* iterates on protocols of the requested level. *pos must start at zero.
+ * Returns NULL at the end. The stack must not change while iterating */
+const protocol_t *protocol_stack_next(const protostack_t *pstk, size_t level,
+                                      guint *pos);
+/* number of protocols in the requested level */
+guint protocol_stack_level_size(const protostack_t *pstk, size_t level);
 /* finds named protocol in the requested level of protostack*/
 const protocol_t *protocol_stack_find(const protostack_t *pstk, size_t level, const gchar *protoname);
-/* sorts on the most used protocol in the requested level and returns it */
-gchar *protocol_stack_sort_most_used(protostack_t *pstk, size_t level);
+/* finds protocol atom in the requested level of protostack*/
+const protocol_t *protocol_stack_find_atom(const protostack_t *pstk, size_t level, proto_atom_t atom);
+/* returns the atom of the most used protocol in the requested level,
+ * PROTO_ATOM_NONE if none */
+proto_atom_t protocol_stack_most_used(protostack_t *pstk, size_t level);
+/* sets each level of main_prot to its most used protocol, moving the 
+ * atom references */
+void protocol_stack_main_prots(protostack_t *pstk, proto_atom_t *main_prot);
 /* returns a newly allocated string with a dump of pstk */
 gchar *protocol_stack_dump(const protostack_t *pstk);
 /* returns a newly allocated string with am xml dump of pstk */
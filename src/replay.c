@@ -0,0 +1,360 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/time.h>
+#include <time.h>
+#include "replay.h"
+
+/* skip requests are ignored if the next packet is nearer than this */
+#define SKIP_MIN_USECS 20000
+
+/* times are kept in microseconds */
+typedef gint64 usecs_t;
+
+static pthread_t replay_thread;
+static gboolean replay_running = FALSE;
+
+static pthread_mutex_t replay_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replay_cond = PTHREAD_COND_INITIALIZER;
+
+/* all following fields are protected by replay_mtx */
+static gboolean stop_request = FALSE;
+static gboolean paused = FALSE;
+static gboolean eof_reached = FALSE;
+static gchar *read_error = NULL; /* pcap error that ended the replay */
+static gboolean space_wanted = FALSE; /* waiting for room in the ring */
+static gdouble replay_speed = 1.0;
+static usecs_t base_wall = 0;   /* wall clock at base_replay */
+static usecs_t base_replay = 0; /* replay clock at base_wall */
+static usecs_t paused_replay = 0; /* replay clock when paused */
+static usecs_t next_replay = -1; /* replay time of the packet being waited
+                                  * for, -1 if none */
+
+/* thread parameters, constant while running */
+static pcap_t *replay_pch = NULL;
+static pthread_mutex_t *replay_pcap_mtx = NULL;
+static capture_ring_t *replay_ring = NULL;
+static gulong replay_min_delay = 0;
+static gulong replay_max_delay = G_MAXULONG;
+
+static void *replay_thread_routine(void *dt);
+
+/***************************************************************************
+ *
+ * clock handling
+ *
+ **************************************************************************/
+static usecs_t wall_now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (usecs_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* replay clock now. Mutex must be locked */
+static usecs_t replay_now(void)
+{
+  if (paused)
+    return paused_replay;
+  return base_replay + (usecs_t)((wall_now() - base_wall) * replay_speed);
+}
+
+/* wall clock time at which the replay clock will reach t. Mutex locked */
+static usecs_t wall_deadline(usecs_t t)
+{
+  return base_wall + (usecs_t)((t - base_replay) / replay_speed);
+}
+
+/***************************************************************************
+ *
+ * public interface
+ *
+ **************************************************************************/
+gboolean replay_start(pcap_t *pch, pthread_mutex_t *pcap_mtx,
+                      capture_ring_t *ring, gdouble speed,
+                      gulong min_delay, gulong max_delay)
+{
+  if (replay_running)
+    return TRUE;
+
+  replay_pch = pch;
+  replay_pcap_mtx = pcap_mtx;
+  replay_ring = ring;
+  replay_min_delay = min_delay;
+  replay_max_delay = max_delay;
+
+  stop_request = FALSE;
+  paused = FALSE;
+  eof_reached = FALSE;
+  g_free(read_error);
+  read_error = NULL;
+  space_wanted = FALSE;
+  next_replay = -1;
+  replay_speed = CLAMP(speed, REPLAY_MIN_SPEED, REPLAY_MAX_SPEED);
+  base_wall = wall_now();
+  base_replay = -1; /* set by the first packet */
+
+  if (pthread_create(&replay_thread, NULL, replay_thread_routine, NULL))
+    return FALSE;
+  replay_running = TRUE;
+  return TRUE;
+}
+
+void replay_stop(void)
+{
+  if (!replay_running)
+    return;
+
+  pthread_mutex_lock(&replay_mtx);
+  stop_request = TRUE;
+  pthread_cond_broadcast(&replay_cond);
+  pthread_mutex_unlock(&replay_mtx);
+
+  pthread_join(replay_thread, NULL);
+  replay_running = FALSE;
+  g_free(read_error);
+  read_error = NULL;
+}
+
+void replay_pause(void)
+{
+  pthread_mutex_lock(&replay_mtx);
+  if (!paused)
+    {
+      paused_replay = replay_now();
+      paused = TRUE;
+    }
+  pthread_mutex_unlock(&replay_mtx);
+}
+
+/* the replay clock restarts from where it was paused */
+void replay_resume(void)
+{
+  pthread_mutex_lock(&replay_mtx);
+  if (paused)
+    {
+      base_wall = wall_now();
+      base_replay = paused_replay;
+      paused = FALSE;
+      pthread_cond_broadcast(&replay_cond);
+    }
+  pthread_mutex_unlock(&replay_mtx);
+}
+
+/* moves the replay clock forward to the next packet */
+void replay_skip(void)
+{
+  pthread_mutex_lock(&replay_mtx);
+  if (!paused && next_replay >= 0 && next_replay - replay_now() > SKIP_MIN_USECS)
+    {
+      base_wall = wall_now();
+      base_replay = next_replay;
+      pthread_cond_broadcast(&replay_cond);
+    }
+  pthread_mutex_unlock(&replay_mtx);
+}
+
+gboolean replay_eof(void)
+{
+  gboolean eof;
+
+  pthread_mutex_lock(&replay_mtx);
+  eof = eof_reached;
+  pthread_mutex_unlock(&replay_mtx);
+  return eof;
+}
+
+/* returns a newly allocated copy of the read error that ended the replay,
+ * or NULL if none */
+gchar *replay_error(void)
+{
+  gchar *msg;
+
+  pthread_mutex_lock(&replay_mtx);
+  msg = g_strdup(read_error);
+  pthread_mutex_unlock(&replay_mtx);
+  return msg;
+}
+
+/* called by the consumer after taking packets from the ring */
+void replay_ring_released(void)
+{
+  if (!replay_running)
+    return;
+
+  pthread_mutex_lock(&replay_mtx);
+  if (space_wanted)
+    pthread_cond_broadcast(&replay_cond);
+  pthread_mutex_unlock(&replay_mtx);
+}
+
+gboolean replay_get_time(struct timeval *now)
+{
+  usecs_t t;
+
+  if (!replay_running)
+    return FALSE;
+
+  pthread_mutex_lock(&replay_mtx);
+  if (base_replay < 0)
+    {
+      /* no packet read yet */
+      pthread_mutex_unlock(&replay_mtx);
+      return FALSE;
+    }
+  t = replay_now();
+  pthread_mutex_unlock(&replay_mtx);
+
+  now->tv_sec = t / 1000000;
+  now->tv_usec = t % 1000000;
+  return TRUE;
+}
+
+/***************************************************************************
+ *
+ * pacing thread
+ *
+ **************************************************************************/
+
+/* waits until the replay clock reaches t, sleeping to an absolute deadline.
+ * Pause, skip and stop wake the thread and the deadline is recomputed.
+ * Mutex must be locked. Returns FALSE if stop was requested */
+static gboolean wait_replay_time(usecs_t t)
+{
+  struct timespec ts;
+  usecs_t deadline;
+
+  next_replay = t;
+  while (!stop_request)
+    {
+      if (paused)
+        {
+          pthread_cond_wait(&replay_cond, &replay_mtx);
+          continue;
+        }
+      deadline = wall_deadline(t);
+      if (deadline <= wall_now())
+        break;
+      ts.tv_sec = deadline / 1000000;
+      ts.tv_nsec = (deadline % 1000000) * 1000;
+      pthread_cond_timedwait(&replay_cond, &replay_mtx, &ts);
+    }
+  next_replay = -1;
+  return !stop_request;
+}
+
+/* reads the file, releasing packets into the ring when due. Packets
+ * sharing the same deadline are released together, without sleeping */
+static void *replay_thread_routine(void *dt)
+{
+  struct pcap_pkthdr *pkt_header;
+  const u_char *pkt_data;
+  struct timeval ts;
+  usecs_t pkt_time;
+  usecs_t last_pkt_time = -1;
+  usecs_t replay_time = 0;
+  usecs_t gap;
+  int result;
+
+  for (;;)
+    {
+      pthread_mutex_lock(replay_pcap_mtx);
+      result = pcap_next_ex(replay_pch, &pkt_header, &pkt_data);
+      pthread_mutex_unlock(replay_pcap_mtx);
+      if (result == 0 || (result == 1 && !pkt_data))
+        continue;
+      if (result == -1)
+        {
+          pthread_mutex_lock(replay_pcap_mtx);
+          pthread_mutex_lock(&replay_mtx);
+          read_error = g_strdup(pcap_geterr(replay_pch));
+          pthread_mutex_unlock(&replay_mtx);
+          pthread_mutex_unlock(replay_pcap_mtx);
+          break;
+        }
+      if (result < 0)
+        break; /* end of file */
+
+      /* the gap between packets is clamped to the min/max delays */
+      pkt_time = (usecs_t)pkt_header->ts.tv_sec * 1000000 +
+        pkt_header->ts.tv_usec;
+      if (last_pkt_time < 0)
+        {
+          replay_time = pkt_time;
+          pthread_mutex_lock(&replay_mtx);
+          base_wall = wall_now();
+          base_replay = pkt_time;
+          pthread_mutex_unlock(&replay_mtx);
+        }
+      else
+        {
+          /* gap can be negative when listening to multiple interfaces.
+           * In that case the delay is zeroed */
+          gap = pkt_time - last_pkt_time;
+          if (gap < 0)
+            gap = 0;
+          if (gap / 1000 < replay_min_delay)
+            gap = (usecs_t)replay_min_delay * 1000;
+          else if (gap / 1000 > replay_max_delay)
+            gap = (usecs_t)replay_max_delay * 1000;
+          replay_time += gap;
+        }
+      last_pkt_time = pkt_time;
+
+      pthread_mutex_lock(&replay_mtx);
+      if (!wait_replay_time(replay_time))
+        {
+          pthread_mutex_unlock(&replay_mtx);
+          return NULL;
+        }
+      pthread_mutex_unlock(&replay_mtx);
+
+      /* released packets carry replay time.
+       * pkt_data is still valid, since only this thread reads the file */
+      ts.tv_sec = replay_time / 1000000;
+      ts.tv_usec = replay_time % 1000000;
+      pthread_mutex_lock(&replay_mtx);
+      while (!stop_request && capture_ring_is_full(replay_ring))
+        {
+          /* main loop is late. Never drop packets while replaying, wait 
+           * for it to take some, see replay_ring_released */
+          space_wanted = TRUE;
+          pthread_cond_wait(&replay_cond, &replay_mtx);
+        }
+      space_wanted = FALSE;
+      if (stop_request)
+        {
+          pthread_mutex_unlock(&replay_mtx);
+          return NULL;
+        }
+      pthread_mutex_unlock(&replay_mtx);
+      capture_ring_push(replay_ring, &ts, pkt_data,
+                        pkt_header->caplen, pkt_header->len);
+    }
+
+  pthread_mutex_lock(&replay_mtx);
+  eof_reached = TRUE;
+  pthread_mutex_unlock(&replay_mtx);
+  return NULL;
+}
@@ -0,0 +1,49 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <pthread.h>
+#include <pcap.h>
+#include "capture_ring.h"
+
+/* Replay of capture files.
+ * A pacing thread reads the file and releases each packet into the ring at
+ * the time it should arrive, following the original timing scaled by the
+ * replay speed. The timestamps of released packets, and the clock returned
+ * by replay_get_time, are in "replay time", that is the capture time of
+ * the file, so averages are correct at any speed */
+
+#define REPLAY_MIN_SPEED 0.1
+#define REPLAY_MAX_SPEED 100.0
+
+gboolean replay_start(pcap_t *pch, pthread_mutex_t *pcap_mtx,
+                      capture_ring_t *ring, gdouble speed,
+                      gulong min_delay, gulong max_delay);
+void replay_stop(void);
+void replay_pause(void);
+void replay_resume(void);
+void replay_skip(void); /* releases the next packet now */
+gboolean replay_eof(void); /* true if the whole file was released */
+gchar *replay_error(void); /* read error ending the replay, NULL if none */
+void replay_ring_released(void); /* the consumer made room in the ring */
+gboolean replay_get_time(struct timeval *now); /* FALSE if not replaying */
+
+#endif
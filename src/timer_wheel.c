@@ -0,0 +1,269 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include "timer_wheel.h"
+
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+/* ticks covered by a single slot of level, and by the whole level */
+#define LEVEL_SPAN(level) (G_GUINT64_CONSTANT(1) << (WHEEL_BITS * (level)))
+
+struct timer_wheel_s
+{
+  wheel_timer_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  guint n_timers[WHEEL_LEVELS]; /* timers scheduled in each level */
+  guint64 cur;                  /* next tick to run */
+  guint64 target;               /* last tick to run, while advancing */
+  gboolean advancing;
+};
+
+static guint wheel_size(const timer_wheel_t *wheel);
+static void timer_link(timer_wheel_t *wheel, wheel_timer_t *timer);
+static void timer_unlink(timer_wheel_t *wheel, wheel_timer_t *timer);
+static void cascade(timer_wheel_t *wheel);
+
+/* ticks of base + delay_ms. Rounds up, so that a fired timer is never early */
+static guint64 deadline_tick(const struct timeval *base, gdouble delay_ms)
+{
+  gdouble ms = base->tv_sec * 1000.0 + base->tv_usec / 1000.0 + delay_ms;
+
+  if (ms <= 0)
+    return 0;
+  return (guint64)ceil(ms / WHEEL_TICK_MS);
+}
+
+/* tick containing t */
+static guint64 current_tick(const struct timeval *t)
+{
+  return (guint64)(t->tv_sec * 1000.0 + t->tv_usec / 1000.0) / WHEEL_TICK_MS;
+}
+
+/***************************************************************************
+ *
+ * timer_wheel_t implementation
+ *
+ **************************************************************************/
+
+timer_wheel_t *timer_wheel_new(void)
+{
+  return g_malloc0(sizeof(timer_wheel_t));
+}
+
+void timer_wheel_delete(timer_wheel_t *wheel)
+{
+  g_free(wheel);
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, const struct timeval *now,
+                         wheel_func_t func)
+{
+  wheel_timer_t *fired;
+  wheel_timer_t *timer;
+  guint64 next;
+  guint level;
+
+  g_assert(wheel && now && func);
+  g_assert(!wheel->advancing);
+
+  wheel->target = current_tick(now);
+  wheel->advancing = TRUE;
+
+  while (wheel->cur <= wheel->target)
+    {
+      if (!wheel_size(wheel))
+        {
+          wheel->cur = wheel->target + 1;
+          break;
+        }
+
+      /* if the lower levels are empty, whole rotations are skipped */
+      for (level = 0; level < WHEEL_LEVELS - 1 && !wheel->n_timers[level]; 
+           ++level)
+        ;
+      if (level)
+        {
+          next = (wheel->cur | (LEVEL_SPAN(level) - 1)) + 1;
+          if (next > wheel->target + 1)
+            {
+              wheel->cur = wheel->target + 1;
+              break;
+            }
+          wheel->cur = next;
+          cascade(wheel);
+          continue;
+        }
+
+      /* runs the current slot. The fired timers are detached first, since
+       * func can schedule or cancel timers */
+      fired = wheel->slots[0][wheel->cur & WHEEL_MASK];
+      wheel->slots[0][wheel->cur & WHEEL_MASK] = NULL;
+      if (fired)
+        fired->pprev = &fired;
+      wheel->cur++;
+      cascade(wheel);
+
+      while ((timer = fired) != NULL)
+        {
+          timer_unlink(wheel, timer);
+          func(timer);
+        }
+    }
+
+  wheel->advancing = FALSE;
+}
+
+/* total scheduled timers */
+static guint wheel_size(const timer_wheel_t *wheel)
+{
+  guint n = 0;
+  guint level;
+
+  for (level = 0; level < WHEEL_LEVELS; ++level)
+    n += wheel->n_timers[level];
+  return n;
+}
+
+/* puts timer in the slot of its deadline. Past deadlines go to the
+ * next slot to run */
+static void timer_link(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+  wheel_timer_t **head;
+  guint64 tick;
+  guint level;
+
+  if (!wheel_size(wheel) && !wheel->advancing)
+    {
+      /* an empty wheel restarts from the current time, even if it's
+       * back in time as when a new capture replays an older file */
+      wheel->cur = current_tick(&appdata.now);
+    }
+
+  tick = MAX(timer->tick, wheel->cur);
+  for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+    if (tick - wheel->cur < LEVEL_SPAN(level + 1))
+      break;
+  if (tick - wheel->cur >= LEVEL_SPAN(WHEEL_LEVELS))
+    tick = wheel->cur + LEVEL_SPAN(WHEEL_LEVELS) - 1; /* cascades again */
+
+  head = &wheel->slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+  timer->next = *head;
+  if (*head)
+    (*head)->pprev = &timer->next;
+  *head = timer;
+  timer->pprev = head;
+  timer->level = level;
+  wheel->n_timers[level]++;
+}
+
+static void timer_unlink(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+  *timer->pprev = timer->next;
+  if (timer->next)
+    timer->next->pprev = timer->pprev;
+  timer->next = NULL;
+  timer->pprev = NULL;
+  wheel->n_timers[timer->level]--;
+}
+
+/* when the wheel reaches the start of a slot of an upper level, the timers
+ * of that slot move down, nearer to their deadline */
+static void cascade(timer_wheel_t *wheel)
+{
+  wheel_timer_t *list;
+  wheel_timer_t *timer;
+  guint level;
+
+  for (level = WHEEL_LEVELS - 1; level > 0; --level)
+    {
+      if (wheel->cur & (LEVEL_SPAN(level) - 1))
+        continue;
+
+      list = wheel->slots[level][(wheel->cur >> (WHEEL_BITS * level)) & 
+                                 WHEEL_MASK];
+      wheel->slots[level][(wheel->cur >> (WHEEL_BITS * level)) & 
+                          WHEEL_MASK] = NULL;
+      while ((timer = list) != NULL)
+        {
+          list = timer->next;
+          wheel->n_timers[level]--;
+          timer_link(wheel, timer);
+        }
+    }
+}
+
+/***************************************************************************
+ *
+ * wheel_timer_t implementation
+ *
+ **************************************************************************/
+
+void wheel_timer_init(wheel_timer_t *timer)
+{
+  timer->next = NULL;
+  timer->pprev = NULL;
+  timer->tick = 0;
+  timer->level = 0;
+}
+
+void wheel_timer_set(timer_wheel_t *wheel, wheel_timer_t *timer, 
+                     const struct timeval *base, gdouble delay_ms)
+{
+  g_assert(wheel && timer && base);
+
+  if (timer->pprev)
+    timer_unlink(wheel, timer);
+  timer->tick = deadline_tick(base, delay_ms);
+  if (wheel->advancing && timer->tick <= wheel->target)
+    timer->tick = wheel->target + 1; /* not again in this advance */
+  timer_link(wheel, timer);
+}
+
+void wheel_timer_expedite(timer_wheel_t *wheel, wheel_timer_t *timer, 
+                          const struct timeval *base, gdouble delay_ms)
+{
+  guint64 tick;
+
+  g_assert(wheel && timer && base);
+
+  if (timer->pprev)
+    {
+      tick = deadline_tick(base, delay_ms);
+      if (wheel->advancing && tick <= wheel->target)
+        tick = wheel->target + 1;
+      if (tick >= timer->tick)
+        return;
+    }
+  wheel_timer_set(wheel, timer, base, delay_ms);
+}
+
+void wheel_timer_cancel(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+  g_assert(wheel && timer);
+
+  if (timer->pprev)
+    timer_unlink(wheel, timer);
+}
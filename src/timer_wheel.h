@@ -0,0 +1,63 @@
+/* EtherApe
+ * Copyright (C) 2001 Juan Toledo, Riccardo Ghetta
+ * $Id$
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "appdata.h"
+
+/* Hierarchical timing wheel.
+ * Timers are embedded in the objects they schedule, and fire when the 
+ * wheel is advanced past their deadline. Levels of 256 slots each cover
+ * growing time ranges; timers move to finer levels as their deadline
+ * nears, so advancing touches only the timers that fire.
+ * Times are in appdata.now scale, with a resolution of WHEEL_TICK_MS */
+#define WHEEL_TICK_MS 10
+
+typedef struct wheel_timer_s
+{
+  struct wheel_timer_s *next;
+  struct wheel_timer_s **pprev; /* NULL if not scheduled */
+  guint64 tick;                 /* deadline, in ticks */
+  guint level;                  /* wheel level holding the timer */
+} wheel_timer_t;
+
+/* called for each fired timer, already unscheduled */
+typedef void (*wheel_func_t)(wheel_timer_t *timer);
+
+typedef struct timer_wheel_s timer_wheel_t;
+
+timer_wheel_t *timer_wheel_new(void);
+void timer_wheel_delete(timer_wheel_t *wheel); /* timers are just dropped */
+/* fires every timer with deadline up to now. Timers set from func never 
+ * fire again during the same advance, and timers set with a deadline
+ * already passed fire at the first advance reaching a new tick */
+void timer_wheel_advance(timer_wheel_t *wheel, const struct timeval *now,
+                         wheel_func_t func);
+
+void wheel_timer_init(wheel_timer_t *timer);
+/* schedules timer at base + delay_ms, replacing the previous deadline */
+void wheel_timer_set(timer_wheel_t *wheel, wheel_timer_t *timer, 
+                     const struct timeval *base, gdouble delay_ms);
+/* as above, but only if the new deadline is earlier, or timer is idle */
+void wheel_timer_expedite(timer_wheel_t *wheel, wheel_timer_t *timer, 
+                          const struct timeval *base, gdouble delay_ms);
+void wheel_timer_cancel(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+#endif
@@ -39,9 +39,9 @@ void traffic_stats_init(traffic_stats_t *pkt_stat)
 
   g_queue_init(&pkt_stat->pkt_list);
 
-  basic_stats_reset(&pkt_stat->stats);
-  basic_stats_reset(&pkt_stat->stats_in);
-  basic_stats_reset(&pkt_stat->stats_out);
+  basic_stats_open(&pkt_stat->stats);
+  basic_stats_open(&pkt_stat->stats_in);
+  basic_stats_open(&pkt_stat->stats_out);
   
   protocol_stack_open(&pkt_stat->stats_protos);
 }
@@ -65,6 +65,14 @@ void traffic_stats_reset(traffic_stats_t *pkt_stat)
   basic_stats_reset(&pkt_stat->stats_out);
 }
 
+/* number of packets in the averaging window */
+gulong traffic_stats_active_packets(const traffic_stats_t *pkt_stat)
+{
+  if (appdata.bucket_stats)
+    return basic_stats_active_packets(&pkt_stat->stats);
+  return pkt_stat->pkt_list.length;
+}
+
 /* adds a packet */
 void 
 traffic_stats_add_packet(traffic_stats_t *pkt_stat, 
@@ -76,6 +84,22 @@ traffic_stats_add_packet(traffic_stats_t *pkt_stat,
   g_assert(pkt_stat);
   g_assert(new_pkt);
 
+  if (appdata.bucket_stats)
+    {
+      /* bucketed stats don't keep the packet, that can also be the sum
+       * of many packets */
+      basic_stats_add_packets(&pkt_stat->stats, new_pkt->size, 
+                              new_pkt->n_packets);
+      if (dir != OUTBOUND)
+        basic_stats_add_packets(&pkt_stat->stats_in, new_pkt->size, 
+                                new_pkt->n_packets);
+      if (dir != INBOUND)
+        basic_stats_add_packets(&pkt_stat->stats_out, new_pkt->size, 
+                                new_pkt->n_packets);
+      protocol_stack_add_pkt(&pkt_stat->stats_protos, new_pkt);
+      return;
+    }
+
   /* creates a new item, incrementing refcount of new_pkt */
   newit = packet_list_item_create(new_pkt, dir);
 
@@ -100,6 +124,17 @@ traffic_stats_purge_expired_packets(traffic_stats_t *pkt_stat, double pkt_expire
   double diffms;
   packet_list_item_t* packet;
 
+  if (appdata.bucket_stats)
+    {
+      /* bucketed stats: drops whole slots */
+      basic_stats_expire(&pkt_stat->stats, pkt_expire_time);
+      basic_stats_expire(&pkt_stat->stats_in, pkt_expire_time);
+      basic_stats_expire(&pkt_stat->stats_out, pkt_expire_time);
+      protocol_stack_expire(&pkt_stat->stats_protos, pkt_expire_time);
+      protocol_stack_purge_expired(&pkt_stat->stats_protos, proto_expire_time);
+      return;
+    }
+
   /* pkt queue is ordered by arrival time, so older pkts are at tail */
   while (pkt_stat->pkt_list.head)
   {
@@ -142,7 +177,7 @@ traffic_stats_update(traffic_stats_t *pkt_stat, double avg_time, double proto_ex
 {
   traffic_stats_purge_expired_packets(pkt_stat, avg_time, proto_expire_time);
 
-  if (!g_queue_is_empty(&pkt_stat->pkt_list))
+  if (traffic_stats_active_packets(pkt_stat))
     {
       gdouble ms_from_oldest = avg_time;
 
@@ -183,13 +218,13 @@ gchar *traffic_stats_dump(const traffic_stats_t *pkt_stat)
   msg_in = basic_stats_dump(&pkt_stat->stats_in);
   msg_out = basic_stats_dump(&pkt_stat->stats_out);
   msg_proto = protocol_stack_dump(&pkt_stat->stats_protos);
-  msg = g_strdup_printf("active_packets: %u\n"
+  msg = g_strdup_printf("active_packets: %lu\n"
                         "  in : [%s]\n"
                         "  out: [%s]\n"
                         "  tot: [%s]\n"
                         "  protocols:\n"
                         "  %s",
-                        pkt_stat->pkt_list.length, 
+                        traffic_stats_active_packets(pkt_stat), 
                         msg_in, msg_out, msg_tot, msg_proto);
   g_free(msg_tot);
   g_free(msg_in);
@@ -213,12 +248,12 @@ gchar *traffic_stats_xml(const traffic_stats_t *pkt_stat)
   msg_out = basic_stats_xml(&pkt_stat->stats_out);
   msg_proto = protocol_stack_xml(&pkt_stat->stats_protos);
   msg = xmltag("traffic_stats",
-               "\n<active_packets>%u</active_packets>\n"
+               "\n<active_packets>%lu</active_packets>\n"
                "<in>\n%s</in>\n"
                "<out>\n%s</out>\n"
                "<tot>\n%s</tot>\n"
                "%s",
-               pkt_stat->pkt_list.length, 
+               traffic_stats_active_packets(pkt_stat), 
                msg_in, msg_out, msg_tot, msg_proto);
   g_free(msg_tot);
   g_free(msg_in);
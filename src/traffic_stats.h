@@ -25,7 +25,8 @@
 
 typedef struct
 {
-  GQueue pkt_list;              /* list of packet_list_item_t - private */
+  GQueue pkt_list;              /* list of packet_list_item_t - private.
+                                 * Unused with bucketed stats */
   basic_stats_t stats;        /* total traffic stats */
   basic_stats_t stats_in;     /* inbound traffic stats */
   basic_stats_t stats_out;    /* outbound traffic stats */
@@ -39,6 +40,7 @@ void traffic_stats_add_packet( traffic_stats_t *pkt_stat,
                               packet_info_t *new_pkt, 
                               packet_direction dir); /* adds a packet */
 void traffic_stats_purge_expired_packets(traffic_stats_t *pkt_stat, double pkt_expire_time, double proto_expire_time);
+gulong traffic_stats_active_packets(const traffic_stats_t *pkt_stat);
 gboolean traffic_stats_update(traffic_stats_t *pkt_stat, double pkt_expire_time, double proto_expire_time);
 gchar *traffic_stats_dump(const traffic_stats_t *pkt_stat); 
 gchar *traffic_stats_xml(const traffic_stats_t *pkt_stat); 
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+# Times the batch replay of capture files with the SIMD header pre-pass, 
+# with --scalar-headers and with --generic-decode, in every operating mode.
+# Each run is repeated and the best time is reported, in seconds.
+#
+# Usage: bench-decode.sh capture-file...
+# The etherape binary can be given with ETHERAPE, default ../src/etherape,
+# and the number of runs with RUNS, default 5
+
+ETHERAPE=${ETHERAPE:-`dirname $0`/../src/etherape}
+RUNS=${RUNS:-5}
+
+if [ $# -eq 0 ]
+then
+	echo "usage: $0 capture-file..." >&2
+	exit 2
+fi
+
+# best elapsed time of RUNS runs of etherape with the given options
+best_time()
+{
+	BEST=
+	I=0
+	while [ $I -lt $RUNS ]
+	do
+		START=`date +%s.%N`
+		$ETHERAPE --batch -q -n "$@" > /dev/null 2>&1 || return 1
+		END=`date +%s.%N`
+		BEST=`echo "$START $END $BEST" | 
+		      awk '{ t = $2 - $1; if ($3 != "" && $3 < t) t = $3; 
+		             printf "%.3f", t }'`
+		I=`expr $I + 1`
+	done
+	echo $BEST
+}
+
+FAILED=0
+printf "%-30s %-5s %10s %10s %10s\n" file mode simd scalar generic
+for FILE in "$@"
+do
+	for MODE in link ip tcp
+	do
+		SIMD=`best_time -m $MODE -r "$FILE"` &&
+		SCALAR=`best_time -m $MODE -r "$FILE" --scalar-headers` &&
+		GENERIC=`best_time -m $MODE -r "$FILE" --generic-decode`
+		if [ $? -ne 0 ]
+		then
+			echo "FAILED $FILE ($MODE): replay error"
+			FAILED=1
+			continue
+		fi
+		printf "%-30s %-5s %10s %10s %10s\n" `basename "$FILE"` $MODE \
+			$SIMD $SCALAR $GENERIC
+	done
+done
+
+exit $FAILED
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+# Replays capture files in batch mode, once with the fast decode paths and
+# once with --generic-decode, in every operating mode, and compares the
+# final exports. They must be identical.
+#
+# Usage: compare-decode.sh capture-file...
+# The etherape binary can be given with ETHERAPE, default ../src/etherape
+
+ETHERAPE=${ETHERAPE:-`dirname $0`/../src/etherape}
+TMPDIR=`mktemp -d /tmp/compare-decode.XXXXXX` || exit 2
+trap 'rm -rf $TMPDIR' 0
+
+if [ $# -eq 0 ]
+then
+	echo "usage: $0 capture-file..." >&2
+	exit 2
+fi
+
+FAILED=0
+for FILE in "$@"
+do
+	for MODE in link ip tcp
+	do
+		FAST=$TMPDIR/fast.xml
+		GENERIC=$TMPDIR/generic.xml
+		rm -f $FAST $GENERIC $FAST.cmp $GENERIC.cmp
+
+		if ! $ETHERAPE --batch -q -n -m $MODE -r "$FILE" \
+				--final-export $FAST ||
+		   ! $ETHERAPE --batch -q -n -m $MODE -r "$FILE" \
+				--final-export $GENERIC --generic-decode
+		then
+			echo "FAILED $FILE ($MODE): replay error"
+			FAILED=1
+			continue
+		fi
+
+		# the header has the wall clock time of the export
+		grep -v '<timestamp>' $FAST > $FAST.cmp
+		grep -v '<timestamp>' $GENERIC > $GENERIC.cmp
+		if diff -u $GENERIC.cmp $FAST.cmp
+		then
+			echo "ok     $FILE ($MODE)"
+		else
+			echo "FAILED $FILE ($MODE): exports differ"
+			FAILED=1
+		fi
+	done
+done
+
+exit $FAILED